@@ -0,0 +1,97 @@
+#ifndef MUSICAT_AUDIO_KERNELS_H
+#define MUSICAT_AUDIO_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace musicat
+{
+// PCM conversion and mixing primitives with scalar, SSE2 and AVX2
+// versions, the best one the cpu supports is picked at runtime.
+// samples are interleaved stereo unless stated otherwise, f32 samples are
+// normalized to [-1, 1]
+namespace audio_kernels
+{
+
+enum kernel_level_t
+{
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+};
+
+struct kernels_t
+{
+    kernel_level_t level;
+    const char *name;
+
+    void (*s16_to_f32) (const int16_t *in, float *out, size_t count);
+    // rounds to nearest and saturates
+    void (*f32_to_s16) (const float *in, int16_t *out, size_t count);
+    // clamp to [-1, 1] in place
+    void (*clamp_f32) (float *buffer, size_t count);
+    void (*deinterleave_f32) (const float *in, float *left, float *right,
+                              size_t frames);
+    void (*interleave_f32) (const float *left, const float *right,
+                            float *out, size_t frames);
+    // dst += src * gain, saturating
+    void (*mix_s16) (int16_t *dst, const int16_t *src, size_t count,
+                     float gain);
+    // multiply by gain increasing by step each sample, saturating
+    void (*gain_s16) (int16_t *buffer, size_t count, float gain,
+                      float step);
+};
+
+// returns nullptr when the level isn't supported by this build or cpu
+const kernels_t *get_kernels (kernel_level_t level);
+
+// the best supported kernels, selected once
+const kernels_t &get_kernels ();
+
+inline void
+s16_to_f32 (const int16_t *in, float *out, size_t count)
+{
+    get_kernels ().s16_to_f32 (in, out, count);
+}
+
+inline void
+f32_to_s16 (const float *in, int16_t *out, size_t count)
+{
+    get_kernels ().f32_to_s16 (in, out, count);
+}
+
+inline void
+clamp_f32 (float *buffer, size_t count)
+{
+    get_kernels ().clamp_f32 (buffer, count);
+}
+
+inline void
+deinterleave_f32 (const float *in, float *left, float *right, size_t frames)
+{
+    get_kernels ().deinterleave_f32 (in, left, right, frames);
+}
+
+inline void
+interleave_f32 (const float *left, const float *right, float *out,
+                size_t frames)
+{
+    get_kernels ().interleave_f32 (left, right, out, frames);
+}
+
+inline void
+mix_s16 (int16_t *dst, const int16_t *src, size_t count, float gain)
+{
+    get_kernels ().mix_s16 (dst, src, count, gain);
+}
+
+inline void
+gain_s16 (int16_t *buffer, size_t count, float gain, float step)
+{
+    get_kernels ().gain_s16 (buffer, count, gain, step);
+}
+
+} // audio_kernels
+} // musicat
+
+#endif // MUSICAT_AUDIO_KERNELS_H
@@ -33,6 +33,16 @@ inline constexpr ssize_t READ_CHUNK_SIZE_OPUS = BUFSIZ / 8;
 inline constexpr size_t PROCESSING_BUFFER_SIZE_PCM = BUFSIZ * 8;
 inline constexpr size_t PROCESSING_BUFFER_SIZE_OPUS = BUFSIZ / 2;
 
+// processor main loop epoll
+inline constexpr int PROCESSOR_MAX_EVENTS = 8;
+// interval to pipe helper chain output to the next helper
+inline constexpr long PROCESSOR_CHAIN_PUMP_INTERVAL_MS = 10;
+
+// processor notifications written to its stdout
+inline constexpr const char PROCESSOR_NOTIFY_READY[] = "0";
+// persistent processor done with its current input
+inline constexpr const char PROCESSOR_NOTIFY_INPUT_END[] = "e";
+
 namespace musicat
 {
 namespace audio_processing
@@ -57,6 +67,7 @@ enum run_processor_error_t
     ERR_SFORK,
     ERR_LPIPE,
     ERR_LFORK,
+    ERR_SEPOLL,
 };
 
 struct track_data_t
@@ -73,6 +84,9 @@ struct helper_chain_option_t
     bool debug;
     std::string raw_args;
     bool parsed;
+    // run in process by native_processor instead of helper processor,
+    // only valid when parsed
+    bool native;
 
     // !TODO: to be implemented
     // std::string i18_band_equalizer;
@@ -94,6 +108,12 @@ struct processor_options_t
 
     // chain of effects
     std::deque<helper_chain_option_t> helper_chain;
+
+    // file_path changed, restart ffmpeg with the new input
+    bool switch_input;
+
+    // loudness normalization gain of the current input in dB
+    double normalize_gain;
 };
 
 processor_options_t create_options ();
@@ -136,7 +156,8 @@ parse_helper_chain_option (
 
             processor_options.helper_chain.push_back (
                 { command_options.debug,
-                  command_options.helper_chain.substr (start_d, res), false });
+                  command_options.helper_chain.substr (start_d, res), false,
+                  false });
 
             start_d = 0;
         }
@@ -158,14 +179,6 @@ int send_audio_routine (dpp::discord_voice_client *vclient,
 run_processor_error_t
 run_processor (child::command::command_options_t &process_options);
 
-std::string get_audio_stream_fifo_path (const std::string &id);
-
-mode_t get_audio_stream_fifo_mode_t ();
-
-std::string get_audio_stream_stdin_path (const std::string &id);
-
-std::string get_audio_stream_stdout_path (const std::string &id);
-
 } // audio_processing
 } // musicat
 
@@ -0,0 +1,82 @@
+#ifndef MUSICAT_AUDIO_RING_H
+#define MUSICAT_AUDIO_RING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+// must be power of two, roughly the same size as a pipe buffer
+// to keep effect change latency the same as fifo transport
+inline constexpr uint32_t AUDIO_RING_CAPACITY = 1 << 16;
+
+namespace musicat
+{
+// single producer single consumer ring buffer in named shared memory,
+// processor writes audio stream to it and Manager::stream reads from it
+namespace audio_ring
+{
+
+struct ring_header_t
+{
+    alignas (64) std::atomic<uint64_t> write_pos;
+    // futex word, bumped every write
+    std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> data_waiting;
+
+    alignas (64) std::atomic<uint64_t> read_pos;
+    // futex word, bumped every consume
+    std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> space_waiting;
+
+    alignas (64) std::atomic<uint32_t> writer_closed;
+    std::atomic<uint32_t> reader_closed;
+    uint32_t capacity;
+};
+
+struct ring_t
+{
+    ring_header_t *header;
+    uint8_t *data;
+    size_t map_size;
+};
+
+std::string get_ring_name (const std::string &id);
+
+// create and initialize shared memory, returns 0 on success
+int create_ring (const std::string &id,
+                 const uint32_t capacity = AUDIO_RING_CAPACITY);
+
+// map created shared memory, returns 0 on success
+int open_ring (const std::string &id, ring_t &ring);
+
+// unmap, doesn't mark anything closed
+void close_ring (ring_t &ring);
+
+int unlink_ring (const std::string &id);
+
+// blocks until everything written, returns -1 when reader closed
+ssize_t write_ring (ring_t &ring, const uint8_t *buffer, size_t size);
+
+// blocks until at least size bytes available or writer closed, or
+// timeout_ms passed (-1 waits forever). returns pointer to size bytes,
+// pointing straight to shared memory when the data is contiguous or
+// to scratch otherwise. *read_size is set to available size which can be
+// less than size when writer closed, 0 on timeout or end of stream.
+// call consume_ring with *read_size after done with the data
+const uint8_t *peek_ring (ring_t &ring, uint8_t *scratch, size_t size,
+                          size_t *read_size, int timeout_ms = -1);
+
+void consume_ring (ring_t &ring, size_t size);
+
+// wait until any data available, returns available size
+size_t wait_ring (ring_t &ring, int timeout_ms);
+
+void mark_writer_closed (ring_t &ring);
+
+void mark_reader_closed (ring_t &ring);
+
+} // audio_ring
+} // musicat
+
+#endif // MUSICAT_AUDIO_RING_H
@@ -10,7 +10,8 @@ namespace musicat
 namespace autocomplete
 {
 /**
- * @brief Filter candidate according to param, limit the result to 25
+ * @brief Filter candidate according to param, limit the result to 25 best
+ * matches ranked by search_index
  *
  * @param candidates
  * @param param
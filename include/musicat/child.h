@@ -1,7 +1,15 @@
 #ifndef MUSICAT_CHILD_H
 #define MUSICAT_CHILD_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// size of every text command frame, only used with MUSICAT_TEXT_COMMAND
 #define CMD_BUFSIZE BUFSIZ / 2
+// largest binary command frame payload accepted by readers
+#define CMD_MAX_PAYLOAD_SIZE 65536
+// most fds passed along with a single command
+#define CMD_MAX_FDS 4
 
 namespace musicat
 {
@@ -16,8 +24,14 @@ enum child_error_t
 
 int init ();
 
-int *get_parent_write_fd ();
-int *get_parent_read_fd ();
+// number of workers started by init
+size_t get_worker_count ();
+
+// worker commands for guild_id are sent to
+size_t get_guild_worker (const uint64_t guild_id);
+
+int *get_parent_write_fd (const size_t worker);
+int *get_parent_read_fd (const size_t worker);
 
 void shutdown ();
 
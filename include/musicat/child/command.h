@@ -2,7 +2,9 @@
 #define MUSICAT_CHILD_COMMAND_H
 
 #include "musicat/child.h"
+#include <stdint.h>
 #include <string>
+#include <sys/types.h>
 
 namespace musicat
 {
@@ -18,7 +20,8 @@ inline const struct
     const std::string shutdown = "shut";
 } command_execute_commands_t;
 
-// update set_option impl in child/command.cpp when changing this
+// update set_option impl in child/command.cpp and command_key_t below when
+// changing this. names are only sent with MUSICAT_TEXT_COMMAND
 inline const struct
 {
     const std::string command = "cmd";  // str
@@ -40,8 +43,58 @@ inline const struct
      */
     const std::string helper_chain = "ehl"; // str
     const std::string force = "frc";        // bool
+    // loudness normalization gain in dB
+    const std::string normalize_gain = "ng"; // double
 } command_options_keys_t;
 
+// binary key of each command_options_keys_t entry, in the same order
+enum command_key_t : uint8_t
+{
+    CMD_KEY_COMMAND = 1,
+    CMD_KEY_FILE_PATH,
+    CMD_KEY_DEBUG,
+    CMD_KEY_ID,
+    CMD_KEY_GUILD_ID,
+    CMD_KEY_READY,
+    CMD_KEY_SEEK,
+    CMD_KEY_VOLUME,
+    CMD_KEY_HELPER_CHAIN,
+    CMD_KEY_FORCE,
+    CMD_KEY_NORMALIZE_GAIN,
+    CMD_KEY_MAX,
+};
+
+enum command_value_type_t : uint8_t
+{
+    CMD_VALUE_STR = 1,
+    // int64_t
+    CMD_VALUE_INT,
+    CMD_VALUE_DOUBLE,
+};
+
+/**
+ * Encoded command ready to be written. Binary frame is a u32 payload size
+ * followed by fields of u8 command_key_t, u8 command_value_type_t, u16
+ * value size and the value, little endian. With MUSICAT_TEXT_COMMAND it's
+ * `key=value;` text padded to CMD_BUFSIZE when written instead
+ */
+struct command_t
+{
+    std::string frame;
+};
+
+command_t create_command ();
+
+void add_str_option (command_t &cmd, const command_key_t key,
+                     const std::string &value);
+
+// bools are sent as int
+void add_int_option (command_t &cmd, const command_key_t key,
+                     const int64_t value);
+
+void add_double_option (command_t &cmd, const command_key_t key,
+                        const double value);
+
 // update create_command_options impl below when changing this struct
 struct command_options_t
 {
@@ -57,15 +110,12 @@ struct command_options_t
     int child_read_fd;
     int child_write_fd;
 
-    std::string audio_stream_fifo_path;
     std::string guild_id;
     /**
      * Ready status
      */
     int ready;
     std::string seek;
-    std::string audio_stream_stdin_path;
-    std::string audio_stream_stdout_path;
     int volume;
     /**
      * A list with format `@effect_args@` without separator
@@ -78,33 +128,62 @@ struct command_options_t
      * Some will just ignore it
      */
     bool force;
+
+    double normalize_gain;
 };
 
 static inline command_options_t
 create_command_options ()
 {
-    return { "", "", false, "", -1, -1, -1,  -1, -1,
-             "", "", false, "", "", "", 100, "", false };
+    return { "", "", false, "", -1, -1, -1, -1,
+             -1, "", false, "", 100, "", false, 0.0 };
 }
 
-void command_queue_routine ();
+// write every queued command to worker
+void command_queue_routine (const size_t worker);
 
-void wait_for_command ();
+void wait_for_command (const size_t worker);
 
+// start command and notification threads of every worker
 void run_command_thread ();
 
-int send_command (const std::string &cmd);
+// queue cmd for the worker guild_id is routed to, commands of the same guild
+// are written in order
+int send_command (const command_t &cmd, const uint64_t guild_id);
 
 void wake ();
 
-// default values are used in the main thread ONLY! You should specify
-// write_fd and caller in child processes
-void write_command (const std::string &cmd,
-                    const int write_fd = *get_parent_write_fd (),
+void write_command (const command_t &cmd, const int write_fd,
                     const char *caller = "child::command");
 
-// should be called before send_command when setting value
-// and use the return string as value
+// write_command with up to CMD_MAX_FDS fds attached, write_fd must be a
+// unix socket. fds stay open in the caller
+void write_command_fds (const command_t &cmd, const int *fds,
+                        const size_t fd_count, const int write_fd,
+                        const char *caller);
+
+/**
+ * @brief Block until a whole command is read from fd, partial reads are
+ * continued. Malformed fields are logged and skipped
+ *
+ * @return 1 when options is filled, 0 on end of file, -1 on read error or
+ * a frame bigger than CMD_MAX_PAYLOAD_SIZE
+ */
+int read_command (const int fd, command_options_t &options,
+                  const char *caller = "child::command");
+
+// read_command taking fds attached to the command, fds must have room for
+// CMD_MAX_FDS. received fds are O_CLOEXEC and owned by the caller
+int read_command_fds (const int fd, command_options_t &options, int *fds,
+                      size_t *fd_count,
+                      const char *caller = "child::command");
+
+// parse binary frame payload without copying it, returns -1 when it's
+// malformed with every field before the bad one already set
+int parse_command_payload (const uint8_t *payload, const size_t size,
+                           command_options_t &options);
+
+// text format only, add_str_option sanitizes values itself
 std::string sanitize_command_value (const std::string &value);
 
 // mostly internal use
@@ -113,9 +192,15 @@ std::string sanitize_command_key_value (const std::string &key_value);
 void parse_command_to_options (const std::string &cmd,
                                command_options_t &options);
 
-int wait_slave_ready (std::string &id, const int timeout);
+int wait_slave_ready (const std::string &id, const int timeout);
+
+// fds are owned by slave ready queue until taken
+int mark_slave_ready (std::string &id, const int status = 0,
+                      const int *fds = nullptr, const size_t fd_count = 0);
 
-int mark_slave_ready (std::string &id, const int status = 0);
+// take fds sent along with slave ready status, returns count taken
+size_t take_slave_fds (const std::string &id, int *fds,
+                       const size_t max_fds);
 
 } // command
 } // child
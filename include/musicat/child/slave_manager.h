@@ -22,6 +22,14 @@ int wait (std::string &id, bool force_kill);
 
 int clean_up (std::string &id);
 
+// shutdown and clean up slave without waiting for it to exit, exited
+// slaves are waited by reap_exited
+int retire (std::string &id, bool force_kill);
+
+// wait every retired slave that has exited without blocking, returns
+// count reaped
+int reap_exited ();
+
 int shutdown_all ();
 
 int wait_all ();
@@ -25,7 +25,8 @@ void handle_worker_fork ();
 void run ();
 
 /**
- * @brief Create a one way pipe, read_fd and write_fd
+ * @brief Create a one way pipe, read_fd and write_fd. Both are O_CLOEXEC,
+ * spawned programs only get what they're given explicitly
  */
 std::pair<int, int> create_pipe ();
 
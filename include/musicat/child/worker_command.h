@@ -10,7 +10,28 @@ namespace child
 namespace worker_command
 {
 
-int create_audio_processor (command::command_options_t &options);
+// order of processor fds sent to main process along with its ready status,
+// there's no audio stream fd with MUSICAT_USE_SHM_RING
+enum processor_fd_t
+{
+    // processor stdin, write end
+    PROCESSOR_FD_COMMAND,
+    // processor stdout, read end
+    PROCESSOR_FD_NOTIFICATION,
+    // processor audio stream, read end
+    PROCESSOR_FD_STREAM,
+    PROCESSOR_FD_MAX,
+};
+
+/**
+ * @brief Fork audio processor connected with anonymous pipes. Main process
+ * ends of the pipes are put in parent_fds in processor_fd_t order, caller
+ * owns them
+ *
+ * @return int 0 on success
+ */
+int create_audio_processor (command::command_options_t &options,
+                            int *parent_fds, size_t *fd_count);
 
 } // worker_command
 } // child
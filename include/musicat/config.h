@@ -1,14 +1,100 @@
 #ifndef MUSICAT_CONFIG_H
 #define MUSICAT_CONFIG_H
 
+// audio kept buffered in voice client, stream sends more as soon as it
+// drops below this
 // !TODO: have an adjustable value based on active effect chain
-#define DPP_AUDIO_BUFFER_LENGTH_SECOND 1.0f
+#define STREAM_TARGET_BUFFER_MS 200
+// longest single pacing wait, stream reacts to state changes at least this
+// often while voice client buffer is full
+#define STREAM_PACER_MAX_WAIT_MS 20
 #define SLEEP_ON_BUFFER_THRESHOLD_MS 50
 
+// stream scheduler worker threads driving every playing guild, 0 uses one
+// for each cpu core
+#define STREAM_WORKER_COUNT 0
+
+// worker children spawning processors, each guild always goes to the same
+// worker. 0 uses one for each cpu core
+#define CHILD_WORKER_COUNT 0
+
+// yt-dlp processes running at once, the rest of the downloads wait in queue
+#define DOWNLOAD_WORKER_COUNT 3
+// attempts of each download before giving up on it
+#define DOWNLOAD_MAX_ATTEMPTS 3
+// wait before retrying a failed download, doubled on every attempt after
+#define DOWNLOAD_RETRY_BACKOFF_MS 2000
+
+// start playing a track still being downloaded once this much of it is in,
+// 0 waits for the whole download
+#define PROGRESSIVE_MIN_BYTES 262144
+
+// music folder tracks accessed this recently are never evicted, covers
+// tracks looked up but not queued yet
+#define TRACK_CACHE_MIN_IDLE_S 600
+
+// spawn and prime next track processor this long before current track ends
+#define PREROLL_BEFORE_END_MS 5000
+
 // use etf websocket protocol
 // #define MUSICAT_WS_P_ETF
 
 // use pcm instead of opus stream audio format
 #define MUSICAT_USE_PCM
 
+// send opus packets straight from the downloaded file when no effect is
+// active, only takes effect with MUSICAT_USE_PCM
+#define MUSICAT_OPUS_PASSTHROUGH
+
+// transport audio stream from processor through shared memory ring buffer
+// instead of fifo, only takes effect with MUSICAT_USE_PCM
+// #define MUSICAT_USE_SHM_RING
+
+// move processor audio stream from ffmpeg straight to the stream pipe with
+// splice when no effect or gain stage needs it, only takes effect without
+// MUSICAT_USE_SHM_RING
+#define MUSICAT_USE_SPLICE
+
+// keep guild processor alive across tracks and switch its input instead of
+// spawning a new one every track, only takes effect with MUSICAT_USE_PCM.
+// next track preroll is disabled with this
+// #define MUSICAT_PERSISTENT_PROCESSOR
+
+// send child process commands as `key=value;` text padded to CMD_BUFSIZE
+// instead of binary frames, readable when tracing the fifos
+// #define MUSICAT_TEXT_COMMAND
+
+// apply constant gain per track from its precomputed loudness, only takes
+// effect with MUSICAT_USE_PCM. tracks needing gain skip opus passthrough
+#define MUSICAT_LOUDNESS_NORMALIZATION
+
+// integrated loudness tracks are normalized to
+#define LOUDNESS_TARGET_LUFS -14.0
+// gain is lowered to keep true peak below this
+#define LOUDNESS_MAX_TRUE_PEAK_DBTP -1.0
+// highest gain applied to quiet tracks
+#define LOUDNESS_MAX_GAIN_DB 12.0
+// gain smaller than this is ignored
+#define LOUDNESS_GAIN_TOLERANCE_DB 0.5
+
+// evict least played track first when music folder is over quota instead
+// of least recently played, ties go to least recently played
+// #define MUSICAT_TRACK_CACHE_LFU
+
+#if defined(MUSICAT_USE_SHM_RING) && !defined(MUSICAT_USE_PCM)
+#undef MUSICAT_USE_SHM_RING
+#endif
+
+#if defined(MUSICAT_USE_SPLICE) && defined(MUSICAT_USE_SHM_RING)
+#undef MUSICAT_USE_SPLICE
+#endif
+
+#if defined(MUSICAT_PERSISTENT_PROCESSOR) && !defined(MUSICAT_USE_PCM)
+#undef MUSICAT_PERSISTENT_PROCESSOR
+#endif
+
+#if defined(MUSICAT_LOUDNESS_NORMALIZATION) && !defined(MUSICAT_USE_PCM)
+#undef MUSICAT_LOUDNESS_NORMALIZATION
+#endif
+
 #endif // MUSICAT_CONFIG_H
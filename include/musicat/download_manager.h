@@ -0,0 +1,99 @@
+#ifndef MUSICAT_DOWNLOAD_MANAGER_H
+#define MUSICAT_DOWNLOAD_MANAGER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace musicat
+{
+// fixed pool of threads running yt-dlp, at most one job for each file.
+// jobs run in priority order, failed jobs are retried with backoff
+namespace download_manager
+{
+
+// download is written to fname with this suffix as it comes and unlinked
+// once fname is in place or download is given up. readers can follow it
+// until then, it's rewritten from the start on retry
+inline constexpr const char *partial_file_suffix = ".partial";
+
+// lower runs first
+enum priority_t
+{
+    // track about to play or someone is waiting for
+    PRIORITY_PLAYING,
+    // next track in queue or track just requested
+    PRIORITY_NEXT,
+    // tracks queued in bulk, such as a playlist import
+    PRIORITY_BULK,
+    // autoplay track fetched ahead
+    PRIORITY_PREFETCH,
+    PRIORITY_MAX,
+};
+
+enum job_state_t
+{
+    JOB_QUEUED,
+    JOB_RUNNING,
+    // last attempt failed, queued again once backoff passed
+    JOB_BACKOFF,
+};
+
+struct job_info_t
+{
+    std::string fname;
+    std::string url;
+    priority_t priority;
+    job_state_t state;
+    // attempts started so far
+    int attempts;
+    // size of partial file, updated while running
+    int64_t bytes;
+};
+
+/**
+ * @brief Queue download of fname into music folder. Joins job already
+ * queued for the same file, raising its priority when the new one is
+ * higher. Workers are started on the first call
+ *
+ * @return int 0 when queued or joined, -1 when yt-dlp isn't configured or
+ * manager is shut down
+ */
+int enqueue (const std::string &fname, const std::string &url,
+             const priority_t priority);
+
+// raise priority of queued job, no-op when there's no job for fname
+void prioritize (const std::string &fname, const priority_t priority);
+
+// whether fname is queued, running or waiting to be retried
+bool is_pending (const std::string &fname);
+
+// block until job of fname is done or given up, returns immediately when
+// there's none. queued job is raised to PRIORITY_PLAYING
+void wait (const std::string &fname);
+
+/**
+ * @brief Block until fname is complete or its partial file has at least
+ * min_bytes. Queued job is raised to PRIORITY_PLAYING. min_bytes of 0
+ * waits for the whole download
+ *
+ * @return int 1 when partial file should be followed, 0 when download is
+ * done, given up or there's none
+ */
+int wait_playable (const std::string &fname, const int64_t min_bytes);
+
+// path of the file download of fname is being written to
+std::string get_partial_path (const std::string &fname);
+
+std::vector<job_info_t> get_jobs ();
+
+void print_jobs ();
+
+// kill running yt-dlp, drop every job and join workers. waiters are
+// released
+void shutdown ();
+
+} // download_manager
+} // musicat
+
+#endif // MUSICAT_DOWNLOAD_MANAGER_H
@@ -2,6 +2,7 @@
 #define MUSICAT_HELPER_PROCESSOR_H
 
 #include "musicat/audio_processing.h"
+#include "musicat/spawn.h"
 
 #define PROCESSOR_BUFFER_SIZE processor_buffer_size
 
@@ -26,19 +27,32 @@ struct helper_chain_t
     int child_read_fd;
     // child pid
     pid_t pid;
+    spawn::time_point_t spawned_at;
+    // no output read from child yet
+    bool output_pending;
 
     audio_processing::helper_chain_option_t options;
     // stream state
 };
 
-void close_all_helper_fds ();
-
-int manage_processor (const audio_processing::processor_options_t &options,
-                      void (*on_fork) ());
+// effect chain marked native by native_processor::manage_processor
+// is skipped
+int manage_processor (const audio_processing::processor_options_t &options);
 
 // run buffer through effect processor chain
 ssize_t run_through_chain (uint8_t *buffer, ssize_t *size);
 
+// pipe whatever available from each helper to the next, except the last
+void pump_chain ();
+
+// last helper output was read outside of the chain
+void mark_last_chain_output ();
+
+// returns nullptr if there's no active helper
+const helper_chain_t *get_last_chain ();
+
+size_t get_chain_size ();
+
 int shutdown_chain (bool discard_output = false);
 
 } // helper_processor
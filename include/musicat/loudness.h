@@ -0,0 +1,75 @@
+#ifndef MUSICAT_LOUDNESS_H
+#define MUSICAT_LOUDNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace musicat
+{
+// EBU R128 / ITU-R BS.1770 integrated loudness and true peak measurement of
+// 48kHz s16le stereo, analyzed once per downloaded track
+namespace loudness
+{
+
+// 4x oversampling interpolation filter taps for each phase
+inline constexpr size_t true_peak_taps = 12;
+
+struct analyzer_t
+{
+    // K-weighting filter state, [stage][channel][z1, z2]
+    double kz[2][2][2];
+
+    // K-weighted square sum of the current 100 ms sub-block
+    double sub_sum;
+    size_t sub_frames;
+    // square sums of the last 3 sub-blocks to make overlapping 400 ms blocks
+    double prev_sub_sums[3];
+    size_t sub_count;
+
+    // mean square of every gating block
+    std::vector<double> block_powers;
+
+    // last input samples of each channel, written twice to always have
+    // true_peak_taps contiguous samples
+    float history[2][true_peak_taps * 2];
+    size_t history_pos;
+    // absolute linear peak, 1.0 is full scale
+    double peak;
+};
+
+struct loudness_t
+{
+    // -inf when every block is gated (silent track)
+    double integrated_lufs;
+    double true_peak_dbtp;
+};
+
+void init_analyzer (analyzer_t &analyzer);
+
+// feed interleaved stereo frames
+void analyze_s16 (analyzer_t &analyzer, const int16_t *samples,
+                  size_t frames);
+
+void get_result (const analyzer_t &analyzer, loudness_t &result);
+
+// decode file with ffmpeg and measure it, returns 0 on success
+int analyze_file (const std::string &file_path, loudness_t &result,
+                  bool debug = false);
+
+// constant gain to reach LOUDNESS_TARGET_LUFS without going over
+// LOUDNESS_MAX_TRUE_PEAK_DBTP, 0 when it's within tolerance
+double get_gain_db (const loudness_t &loudness);
+
+// gain from track sidecar, 0 when track hasn't been analyzed
+double get_track_gain_db (const std::string &file_path);
+
+// analyze track in a background thread and save the result to its sidecar
+// when it hasn't been analyzed, does nothing if it's already being analyzed
+void analyze_track (const std::string &file_path);
+
+} // loudness
+} // musicat
+
+#endif // MUSICAT_LOUDNESS_H
@@ -124,6 +124,9 @@ int get_server_port ();
 
 std::string get_ytdlp_exe ();
 
+// music folder size limit in MiB, 0 when unlimited
+int64_t get_music_cache_quota_mb ();
+
 /**
  * @brief Search _find inside _vec
  *
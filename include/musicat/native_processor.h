@@ -0,0 +1,82 @@
+#ifndef MUSICAT_NATIVE_PROCESSOR_H
+#define MUSICAT_NATIVE_PROCESSOR_H
+
+#include "musicat/audio_processing.h"
+#include <string>
+#include <vector>
+
+// volume change ramp length, 20 ms of 48kHz stereo samples
+inline constexpr size_t VOLUME_RAMP_SAMPLES = 960 * 2;
+
+namespace musicat
+{
+// in-process effect chain for each slave child, runs every effect it knows
+// directly on the buffer instead of creating a helper processor for it
+// only accept s16le stereo 48kHz input and output
+namespace native_processor
+{
+
+enum biquad_type_t
+{
+    BIQUAD_PEAKING,
+    BIQUAD_LOWSHELF,
+    BIQUAD_HIGHSHELF,
+    BIQUAD_LOWPASS,
+    BIQUAD_HIGHPASS,
+};
+
+struct biquad_t
+{
+    biquad_type_t type;
+    double frequency;
+
+    // normalized coefficients
+    double b0, b1, b2, a1, a2;
+
+    // transposed direct form II state for each channel
+    double z1[2];
+    double z2[2];
+};
+
+struct native_chain_t
+{
+    // raw args of every effect chain handled natively, in order
+    std::vector<std::string> raw_args;
+    // filter stages of every effect chain, in order
+    std::vector<biquad_t> biquads;
+    // broadband gain, applied after every filter stage
+    double gain;
+};
+
+// whether every filter in ffmpeg audio filter args can be run natively
+bool is_supported (const std::string &raw_args);
+
+// mark which effect chain can be run natively and (re)create native chain
+// when its required effects changed, should be called before
+// helper_processor::manage_processor
+int manage_processor (audio_processing::processor_options_t &options);
+
+// run buffer through native effect chain in place
+ssize_t run_through_chain (uint8_t *buffer, ssize_t *size);
+
+// whether native effect chain and volume stage currently leave buffer
+// untouched
+bool is_passthrough ();
+
+// clear filter states, call this when the input stream is discontinued
+void reset_chain ();
+
+// set volume in percent, ramped in over VOLUME_RAMP_SAMPLES to avoid
+// clicking unless ramp is false
+void set_volume (int volume, bool ramp = true);
+
+// constant loudness normalization gain, applied with volume
+void set_normalize_gain (double gain_db, bool ramp = true);
+
+// run buffer through volume stage in place, should be the last stage
+ssize_t run_volume (uint8_t *buffer, ssize_t *size);
+
+} // native_processor
+} // musicat
+
+#endif // MUSICAT_NATIVE_PROCESSOR_H
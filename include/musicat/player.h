@@ -1,13 +1,19 @@
 #ifndef SHA_PLAYER_H
 #define SHA_PLAYER_H
 
+#include "musicat/audio_ring.h"
+#include "musicat/download_manager.h"
+#include "musicat/track_index.h"
 #include "yt-search/yt-search.h"
 #include "yt-search/yt-track-info.h"
+#include <atomic>
 #include <deque>
 #include <dpp/dpp.h>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -72,6 +78,10 @@ struct MCTrack : yt_search::YTrack
 
     size_t filesize;
 
+    // seek and duration index of the downloaded file, null when not
+    // loaded yet or the file can't be indexed
+    std::shared_ptr<track_index::track_index_t> index;
+
     MCTrack ();
     MCTrack (const yt_search::YTrack &t);
     ~MCTrack ();
@@ -84,6 +94,64 @@ struct track_progress
     int status;
 };
 
+/**
+ * @brief Playback position counted from audio actually handed to the voice
+ * client, in 48kHz samples. Written by the stream thread and voice client
+ * event, safe to read from anywhere.
+ */
+struct playback_clock_t
+{
+    // position the current stream started or seeked to
+    std::atomic<int64_t> base_samples;
+    // samples sent to the voice client since base
+    std::atomic<int64_t> sent_samples;
+    // samples still waiting in the voice client buffer
+    std::atomic<int64_t> buffered_samples;
+
+    playback_clock_t ();
+
+    /**
+     * @brief Start counting from start_ms, audio still buffered from
+     * before is not counted.
+     */
+    void reset (const int64_t start_ms);
+
+    void add_samples (const int64_t samples);
+
+    /**
+     * @brief Update with the voice client remaining buffer.
+     */
+    void set_buffered (const float secs_remaining);
+
+    int64_t get_ms () const;
+};
+
+/**
+ * @brief Opened audio processor of a stream.
+ */
+struct processor_stream_t
+{
+    std::string slave_id;
+    // worker processor is routed to
+    uint64_t guild_id;
+    // state the processor was created with
+    std::string file_path;
+    int volume;
+    std::string equalizer;
+
+    int read_fd;
+    int command_fd;
+    int notification_fd;
+    // audio stream when using shared memory transport
+    audio_ring::ring_t ring;
+};
+
+/**
+ * @brief Called once when a stream started by Manager::stream ends, with 0
+ * or the error code it would have thrown.
+ */
+using stream_end_t = std::function<void (int error)>;
+
 class Manager;
 using player_manager_ptr = std::shared_ptr<Manager>;
 
@@ -190,6 +258,11 @@ class Player
      */
     std::mutex t_mutex;
 
+    /**
+     * @brief Playback position of current track.
+     */
+    playback_clock_t clock;
+
     void init ();
 
     Player ();
@@ -281,7 +354,6 @@ class Manager
         info_messages_cache;
 
     // Mutexes
-    // dl: waiting_file_download
     // wd: waiting_vc_ready
     // c: connecting
     // dc: disconnecting
@@ -291,18 +363,24 @@ class Manager
     // im: ignore_marker
     // sq: stop_queue
     // as: audio_stream
-    std::mutex dl_m, wd_m, c_m, dc_m, ps_m, mp_m, imc_m, im_m, sq_m, as_m;
+    // pr: prerolled_processors, guild_processors, processor_seq
+    std::mutex wd_m, c_m, dc_m, ps_m, mp_m, imc_m, im_m, sq_m, as_m, pr_m;
 
     // Conditional variable, use notify_all
     std::condition_variable dl_cv, stop_queue_cv, as_cv;
     std::map<dpp::snowflake, dpp::snowflake> connecting, disconnecting;
     std::map<dpp::snowflake, std::string> waiting_vc_ready;
-    std::map<std::string, dpp::snowflake> waiting_file_download;
     std::map<std::string, processor_state_t> processor_states;
     std::map<dpp::snowflake, std::vector<std::string> > waiting_marker;
     std::vector<dpp::snowflake> manually_paused;
     std::map<dpp::snowflake, bool> stop_queue;
     std::vector<dpp::snowflake> ignore_marker;
+    // processors of the next track, primed and waiting for current track
+    // to end
+    std::map<dpp::snowflake, processor_stream_t> prerolled_processors;
+    // idle persistent processors waiting for the next track
+    std::map<dpp::snowflake, processor_stream_t> guild_processors;
+    uint64_t processor_seq;
 
     Manager (dpp::cluster *_cluster);
     ~Manager ();
@@ -439,14 +517,91 @@ class Manager
                                               const int64_t &amount = 1,
                                               const bool remove = false);
 
+    /**
+     * @brief Queue track download, joins download already queued for the
+     * same file
+     */
     void download (const std::string &fname, const std::string &url,
-                   const dpp::snowflake &guild_id);
+                   const download_manager::priority_t priority
+                   = download_manager::PRIORITY_NEXT);
 
     void wait_for_download (const std::string &file_name);
 
+    /**
+     * @brief Wait until enough of file_name is downloaded to start playing
+     * it, see PROGRESSIVE_MIN_BYTES
+     *
+     * @return true when it's still downloading and has to be played from its
+     * partial file
+     */
+    bool wait_for_playable (const std::string &file_name);
+
+    /**
+     * @brief Collect file names of every guild current and queued track
+     *
+     * @return false when a player is busy, in_use is incomplete
+     */
+    bool get_tracks_in_use (std::set<std::string> &in_use);
+
     bool is_waiting_file_download (const std::string &file_name);
 
-    void stream (dpp::discord_voice_client *v, player::MCTrack &track);
+    /**
+     * @brief Set up track stream and hand it to stream scheduler, returns
+     * as soon as it's streaming. on_end is called from the thread that ends
+     * it
+     *
+     * @throw int 1 when there's no connection, 2 when playback can't start.
+     *        on_end isn't called when this throws
+     */
+    void stream (dpp::discord_voice_client *v, player::MCTrack &track,
+                 const stream_end_t &on_end);
+
+    /**
+     * @brief Get unique slave id for a new processor of guild
+     */
+    std::string get_processor_id (const dpp::snowflake &guild_id);
+
+    /**
+     * @brief Spawn and prime processor of the track after current track in
+     * background, will also start downloading the track if it's missing
+     */
+    void preroll_next_track (const dpp::snowflake &guild_id);
+
+    /**
+     * @brief Take prerolled processor of guild, processor created with
+     * different file or effect state is shut down instead
+     *
+     * @return true when processor is usable
+     */
+    bool take_prerolled_processor (const dpp::snowflake &guild_id,
+                                   const std::string &file_path,
+                                   const int volume,
+                                   const std::string &equalizer,
+                                   processor_stream_t &processor);
+
+    /**
+     * @brief Shut down prerolled processor of guild if any
+     */
+    void discard_prerolled_processor (const dpp::snowflake &guild_id);
+
+    /**
+     * @brief Take idle persistent processor of guild
+     *
+     * @return true when guild has one
+     */
+    bool take_guild_processor (const dpp::snowflake &guild_id,
+                               processor_stream_t &processor);
+
+    /**
+     * @brief Keep persistent processor of guild to play the next track
+     */
+    void keep_guild_processor (const dpp::snowflake &guild_id,
+                               const processor_stream_t &processor);
+
+    /**
+     * @brief Shut down idle persistent processor of guild if any
+     */
+    void discard_guild_processor (const dpp::snowflake &guild_id);
     bool is_stream_stopping (const dpp::snowflake &guild_id);
     int set_stream_stopping (const dpp::snowflake &guild_id);
     int clear_stream_stopping (const dpp::snowflake &guild_id);
@@ -606,9 +761,23 @@ namespace util
 bool player_has_current_track (std::shared_ptr<player::Player> guild_player);
 
 /**
- * @brief Get track current progress in ms
+ * @brief Get track current progress in ms, pass player clock when track is
+ * the one currently playing
+ */
+player::track_progress
+get_track_progress (player::MCTrack &track,
+                    const player::playback_clock_t *clock = nullptr);
+
+/**
+ * @brief Format ms to ffmpeg -ss value
+ */
+std::string ms_to_seek_str (int64_t ms);
+
+/**
+ * @brief Parse [[hour:]minute:]second[.fraction] the same way ffmpeg parse
+ * -ss, returns -1 when invalid
  */
-player::track_progress get_track_progress (player::MCTrack &track);
+int64_t seek_str_to_ms (const std::string &str);
 
 } // util
 } // musicat
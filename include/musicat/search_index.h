@@ -0,0 +1,90 @@
+#ifndef MUSICAT_SEARCH_INDEX_H
+#define MUSICAT_SEARCH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace musicat
+{
+// ranked name lookup for autocomplete. names are matched by prefix, word
+// start, substring then subsequence, best matches are returned first
+namespace search_index
+{
+
+struct entry_t
+{
+    std::string name;
+    std::string value;
+    // lowercased with every run of punctuation and space folded to a single
+    // space
+    std::string normalized;
+};
+
+// where a word starts in normalized name of an entry
+struct word_key_t
+{
+    uint32_t entry;
+    uint32_t offset;
+};
+
+struct index_t
+{
+    std::vector<entry_t> entries;
+    // every word start of every entry sorted by the text from there, a
+    // flattened prefix trie. prefix lookup is a binary search
+    std::vector<word_key_t> word_keys;
+    // trigrams of normalized names to ascending entry positions
+    std::unordered_map<uint32_t, std::vector<uint32_t> > trigrams;
+};
+
+// best first
+enum match_t
+{
+    MATCH_NONE,
+    MATCH_SUBSEQUENCE,
+    MATCH_SUBSTRING,
+    MATCH_WORD_START,
+    MATCH_PREFIX,
+    MATCH_EXACT,
+};
+
+std::string normalize (const std::string &str);
+
+// candidates are name and value pairs
+void build (index_t &index,
+            const std::vector<std::pair<std::string, std::string> >
+                &candidates);
+
+/**
+ * @brief Score name against query, both normalized. Higher is better,
+ * better match kind always wins over closer match of worse kind
+ *
+ * @param fuzzy whether subsequence matches count
+ *
+ * @return int64_t 0 when name doesn't match
+ */
+int64_t score (const std::string &query, const std::string &name,
+               const bool fuzzy);
+
+/**
+ * @brief Best limit entries matching query, ties go to shorter then
+ * alphabetically first name. Every entry up to limit in index order when
+ * query is empty
+ *
+ * @param fuzzy whether subsequence matches count
+ *
+ * @return std::vector<std::pair<std::string, std::string> > name and value
+ * pairs
+ */
+std::vector<std::pair<std::string, std::string> >
+search (const index_t &index, const std::string &query, const size_t limit,
+        const bool fuzzy = false);
+
+} // search_index
+} // musicat
+
+#endif // MUSICAT_SEARCH_INDEX_H
@@ -0,0 +1,72 @@
+#ifndef MUSICAT_SPAWN_H
+#define MUSICAT_SPAWN_H
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace musicat
+{
+// start child programs without forking the caller, keeps spawn cost flat no
+// matter how big the caller is. latency from spawn to the first byte of
+// output is recorded per child type in each process
+namespace spawn
+{
+
+enum child_type_t
+{
+    // processor slave, create command until its ready notification
+    CHILD_AUDIO_PROCESSOR,
+    // ffmpeg decoding processor input
+    CHILD_PROCESSOR_FFMPEG,
+    // ffmpeg running a helper effect chain
+    CHILD_HELPER_FFMPEG,
+    // ffmpeg decoding track for loudness analysis
+    CHILD_LOUDNESS_FFMPEG,
+    CHILD_TYPE_MAX,
+};
+
+using time_point_t = std::chrono::steady_clock::time_point;
+
+struct fd_map_t
+{
+    // parent fd, must not be a stdio fd
+    int fd;
+    // number it has in child
+    int child_fd;
+};
+
+struct stats_t
+{
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t last_us;
+};
+
+/**
+ * @brief Spawn program searched in PATH. Every fd in fds is mapped to its
+ * child_fd and every other fd above stdio and the highest child_fd is
+ * closed in child, signal dispositions and mask are reset to default
+ *
+ * @return pid_t child pid, -1 on error
+ */
+pid_t spawn_process (const char *const argv[], const fd_map_t *fds,
+                     const size_t fd_count, const bool null_stderr);
+
+time_point_t now ();
+
+// record latency of a child which just gave its first output
+void record_first_byte (const child_type_t type,
+                        const time_point_t &spawned_at);
+
+stats_t get_stats (const child_type_t type);
+
+// print stats of every child type spawned by current process
+void print_stats ();
+
+} // spawn
+} // musicat
+
+#endif // MUSICAT_SPAWN_H
@@ -0,0 +1,42 @@
+#ifndef MUSICAT_STREAM_SCHEDULER_H
+#define MUSICAT_STREAM_SCHEDULER_H
+
+#include <stdint.h>
+
+namespace musicat
+{
+// fixed pool of worker threads driving every playing stream, each worker
+// waits for the fds of its streams with epoll. streams of a guild always go
+// to the same worker
+namespace stream_scheduler
+{
+
+// run stream until it has to wait, returns fd to wait to be readable before
+// calling it again or -1 when stream is done. must not block
+typedef int (*step_fn_t) (void *data);
+
+// called once after step returned -1 or when stream can't be waited for
+// anymore, should free data
+typedef void (*end_fn_t) (void *data);
+
+struct stream_t
+{
+    void *data;
+    step_fn_t step;
+    end_fn_t end;
+    // also wakes stream while it waits for the fd step returned, stream arms
+    // it to bound the wait. -1 when unused
+    int timer_fd;
+};
+
+// start driving stream, workers are started on the first call. stream is
+// run to its end in the calling thread when workers are unavailable
+void submit (const uint64_t guild_id, const stream_t &stream);
+
+// end every stream and join workers, call after running state is unset
+void shutdown ();
+
+} // stream_scheduler
+} // musicat
+
+#endif // MUSICAT_STREAM_SCHEDULER_H
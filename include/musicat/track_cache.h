@@ -0,0 +1,80 @@
+#ifndef MUSICAT_TRACK_CACHE_H
+#define MUSICAT_TRACK_CACHE_H
+
+#include <set>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+namespace musicat
+{
+// size, last access and play count of every track in music folder. keeps
+// the folder under MUSIC_CACHE_QUOTA_MB by evicting least recently played
+// tracks first, least played with MUSICAT_TRACK_CACHE_LFU. state is saved
+// in music folder to survive restarts
+namespace track_cache
+{
+
+struct entry_t
+{
+    std::string fname;
+    // track and its index sidecar
+    int64_t bytes;
+    // unix time
+    time_t last_access;
+    uint32_t play_count;
+};
+
+struct stats_t
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int64_t total_bytes;
+    // 0 when unlimited
+    int64_t quota_bytes;
+    size_t entry_count;
+};
+
+// fill in_use with file names of tracks that must not be evicted, returns
+// false when they can't be collected right now to skip evicting
+typedef bool (*in_use_fn_t) (std::set<std::string> &in_use);
+
+// load saved state and reconcile it with track catalog, which must be
+// initialized first
+void init (in_use_fn_t in_use_fn);
+
+// whether fname is in music folder, counted as a hit or a miss. a hit
+// counts as an access
+bool lookup (const std::string &fname);
+
+// record freshly downloaded track
+void add (const std::string &fname);
+
+// record track starting to play
+void record_play (const std::string &fname);
+
+/**
+ * @brief Evict tracks until music folder is under quota. Tracks in use,
+ * still downloading or accessed in the last few minutes are never evicted
+ *
+ * @return size_t number of evicted tracks
+ */
+size_t enforce_quota ();
+
+// write state to music folder when it changed since the last save, returns
+// 0 on success
+int save ();
+
+stats_t get_stats ();
+
+std::vector<entry_t> get_entries ();
+
+void print_stats ();
+
+} // track_cache
+} // musicat
+
+#endif // MUSICAT_TRACK_CACHE_H
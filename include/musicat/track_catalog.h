@@ -0,0 +1,72 @@
+#ifndef MUSICAT_TRACK_CATALOG_H
+#define MUSICAT_TRACK_CATALOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+namespace musicat
+{
+// every track in music folder, loaded once and kept current with inotify.
+// answers whether a track is downloaded without touching the filesystem
+namespace track_catalog
+{
+
+struct track_t
+{
+    std::string fname;
+    // youtube video id from `<title>-<id>.opus`, empty when fname doesn't
+    // follow it
+    std::string id;
+    std::string title;
+    int64_t filesize;
+    // index sidecar, 0 when it's missing
+    int64_t index_size;
+    time_t mtime;
+    // from index sidecar, 0 when it's missing
+    int64_t duration_ms;
+};
+
+/**
+ * @brief Load music folder content and start watching it. Must be called
+ * after child is initialized as it starts a thread
+ *
+ * @return int 0 on success, -1 when folder can't be watched. Whatever was
+ * loaded is still served but only updated by update
+ */
+int init ();
+
+// stop watching, catalog stays readable
+void shutdown ();
+
+// stat fname again, adding or dropping it. used where a change should be
+// visible before its inotify event arrives
+void update (const std::string &fname);
+
+bool exists (const std::string &fname);
+
+// returns false when fname isn't in music folder
+bool get (const std::string &fname, track_t &track);
+
+// returns false when no track has video id
+bool find_by_id (const std::string &id, track_t &track);
+
+std::vector<track_t> get_tracks ();
+
+// file names without extension, all when amount is 0
+std::vector<std::string> get_names (const size_t amount = 0);
+
+// best matching file names without extension for query, as name and value
+// pairs. fuzzy matches are included
+std::vector<std::pair<std::string, std::string> >
+search (const std::string &query, const size_t limit);
+
+size_t get_count ();
+
+} // track_catalog
+} // musicat
+
+#endif // MUSICAT_TRACK_CATALOG_H
@@ -0,0 +1,73 @@
+#ifndef MUSICAT_TRACK_INDEX_H
+#define MUSICAT_TRACK_INDEX_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// distance between index entries
+inline constexpr uint32_t TRACK_INDEX_INTERVAL_MS = 1000;
+
+namespace musicat
+{
+// seek and duration index of a downloaded ogg opus file, saved as sidecar
+// file next to the track
+namespace track_index
+{
+
+struct index_entry_t
+{
+    // granule position at the start of the page
+    int64_t granulepos;
+    // page offset in the file
+    int64_t byte_offset;
+};
+
+struct track_index_t
+{
+    // exact duration, pre-skip excluded
+    int64_t duration_ms;
+    // indexed file size, index is stale when the file size differs
+    int64_t filesize;
+    // OpusHead pre-skip, in 48kHz samples
+    int64_t pre_skip;
+    uint32_t interval_ms;
+    // first page containing every interval_ms mark, sorted
+    std::vector<index_entry_t> entries;
+
+    // filled by loudness analyzer after the index is built, integrated
+    // loudness is -inf for silent track
+    bool has_loudness;
+    double integrated_lufs;
+    double true_peak_dbtp;
+};
+
+std::string get_index_path (const std::string &file_path);
+
+// scan ogg pages of the file, returns 0 on success
+int build_index (const std::string &file_path, track_index_t &index,
+                 const uint32_t interval_ms = TRACK_INDEX_INTERVAL_MS);
+
+int write_index (const std::string &file_path, const track_index_t &index);
+
+// returns 0 on success, -1 when sidecar is missing, invalid or stale
+int read_index (const std::string &file_path, track_index_t &index);
+
+// read sidecar, build and save it when it's unusable
+int load_index (const std::string &file_path, track_index_t &index);
+
+// find the last entry starting at or before ms, returns nullptr when
+// index is empty
+const index_entry_t *find_entry_by_ms (const track_index_t &index,
+                                       int64_t ms);
+
+int64_t ms_to_byte (const track_index_t &index, int64_t ms);
+
+int64_t byte_to_ms (const track_index_t &index, int64_t byte);
+
+int64_t granulepos_to_ms (const track_index_t &index, int64_t granulepos);
+
+} // track_index
+} // musicat
+
+#endif // MUSICAT_TRACK_INDEX_H
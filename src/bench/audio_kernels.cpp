@@ -0,0 +1,198 @@
+// microbenchmark of every audio_kernels level this cpu supports, reports
+// nanoseconds per stereo frame over a 20 ms buffer
+#include "musicat/audio_kernels.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace musicat::audio_kernels;
+
+// 20 ms of 48kHz audio
+inline constexpr size_t bench_frames = 960;
+inline constexpr size_t bench_samples = bench_frames * 2;
+inline constexpr int bench_iterations = 20000;
+
+struct bench_buffers_t
+{
+    std::vector<int16_t> s16_a;
+    std::vector<int16_t> s16_b;
+    std::vector<float> f32_a;
+    std::vector<float> f32_b;
+    std::vector<float> left;
+    std::vector<float> right;
+};
+
+// keep the compiler from dropping results
+static volatile int64_t sink = 0;
+
+template <typename F>
+static double
+run_bench (bench_buffers_t &b, F fn)
+{
+    // warm up
+    for (int i = 0; i < bench_iterations / 10; i++)
+        fn ();
+
+    const auto start = std::chrono::steady_clock::now ();
+
+    for (int i = 0; i < bench_iterations; i++)
+        fn ();
+
+    const auto end = std::chrono::steady_clock::now ();
+
+    sink = sink + b.s16_a[0] + (int64_t)b.f32_a[0];
+
+    const double ns
+        = std::chrono::duration<double, std::nano> (end - start).count ();
+
+    return ns / ((double)bench_iterations * bench_frames);
+}
+
+static void
+fill_buffers (bench_buffers_t &b)
+{
+    b.s16_a.resize (bench_samples);
+    b.s16_b.resize (bench_samples);
+    b.f32_a.resize (bench_samples);
+    b.f32_b.resize (bench_samples);
+    b.left.resize (bench_frames);
+    b.right.resize (bench_frames);
+
+    srand (1);
+    for (size_t i = 0; i < bench_samples; i++)
+        {
+            b.s16_a[i] = (int16_t)((rand () % 65536) - 32768);
+            b.s16_b[i] = (int16_t)((rand () % 65536) - 32768);
+            b.f32_a[i] = ((float)(rand () % 4001) / 1000.0f) - 2.0f;
+        }
+}
+
+// compare against scalar, returns max absolute s16 difference
+static int
+check_kernels (const kernels_t &k, const kernels_t &ref)
+{
+    bench_buffers_t x, y;
+    fill_buffers (x);
+    fill_buffers (y);
+
+    int max_diff = 0;
+    const auto diff_s16 = [&max_diff] (const std::vector<int16_t> &a,
+                                       const std::vector<int16_t> &b) {
+        for (size_t i = 0; i < a.size (); i++)
+            {
+                const int d = abs (a[i] - b[i]);
+                if (d > max_diff)
+                    max_diff = d;
+            }
+    };
+
+    // odd count to go through the scalar tail too
+    const size_t count = bench_samples - 3;
+
+    // lossless kernels must match exactly
+    k.s16_to_f32 (x.s16_a.data (), x.f32_b.data (), count);
+    k.clamp_f32 (x.f32_a.data (), count);
+    k.deinterleave_f32 (x.f32_a.data (), x.left.data (), x.right.data (),
+                        bench_frames - 1);
+    k.interleave_f32 (x.left.data (), x.right.data (), x.f32_a.data (),
+                      bench_frames - 1);
+
+    ref.s16_to_f32 (y.s16_a.data (), y.f32_b.data (), count);
+    ref.clamp_f32 (y.f32_a.data (), count);
+    ref.deinterleave_f32 (y.f32_a.data (), y.left.data (), y.right.data (),
+                          bench_frames - 1);
+    ref.interleave_f32 (y.left.data (), y.right.data (), y.f32_a.data (),
+                        bench_frames - 1);
+
+    if (x.f32_a != y.f32_a || x.f32_b != y.f32_b)
+        return -1;
+
+    k.f32_to_s16 (x.f32_a.data (), x.s16_b.data (), count);
+    ref.f32_to_s16 (y.f32_a.data (), y.s16_b.data (), count);
+    diff_s16 (x.s16_b, y.s16_b);
+
+    k.mix_s16 (x.s16_a.data (), x.s16_b.data (), count, 0.7f);
+    ref.mix_s16 (y.s16_a.data (), y.s16_b.data (), count, 0.7f);
+    diff_s16 (x.s16_a, y.s16_a);
+
+    k.gain_s16 (x.s16_a.data (), count, 0.2f, 0.0005f);
+    ref.gain_s16 (y.s16_a.data (), count, 0.2f, 0.0005f);
+    diff_s16 (x.s16_a, y.s16_a);
+
+    return max_diff;
+}
+
+int
+main ()
+{
+    const kernel_level_t levels[]
+        = { KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2 };
+
+    const kernels_t &ref = *get_kernels (KERNEL_SCALAR);
+
+    printf ("selected: %s\n", get_kernels ().name);
+    printf ("%-8s %10s %10s %10s %10s %10s %10s %10s %6s\n", "kernel",
+            "s16>f32", "f32>s16", "clamp", "deintl", "intl", "mix", "gain",
+            "diff");
+
+    for (const kernel_level_t level : levels)
+        {
+            const kernels_t *kp = get_kernels (level);
+            if (!kp)
+                {
+                    printf ("%-8s unsupported\n",
+                            level == KERNEL_SSE2 ? "sse2" : "avx2");
+                    continue;
+                }
+
+            const kernels_t &k = *kp;
+
+            bench_buffers_t b;
+            fill_buffers (b);
+
+            const double s16_to_f32_ns = run_bench (b, [&] () {
+                k.s16_to_f32 (b.s16_a.data (), b.f32_b.data (),
+                              bench_samples);
+            });
+
+            const double f32_to_s16_ns = run_bench (b, [&] () {
+                k.f32_to_s16 (b.f32_a.data (), b.s16_b.data (),
+                              bench_samples);
+            });
+
+            const double clamp_ns = run_bench (b, [&] () {
+                k.clamp_f32 (b.f32_b.data (), bench_samples);
+            });
+
+            const double deinterleave_ns = run_bench (b, [&] () {
+                k.deinterleave_f32 (b.f32_a.data (), b.left.data (),
+                                    b.right.data (), bench_frames);
+            });
+
+            const double interleave_ns = run_bench (b, [&] () {
+                k.interleave_f32 (b.left.data (), b.right.data (),
+                                  b.f32_b.data (), bench_frames);
+            });
+
+            const double mix_ns = run_bench (b, [&] () {
+                k.mix_s16 (b.s16_a.data (), b.s16_b.data (), bench_samples,
+                           0.5f);
+            });
+
+            const double gain_ns = run_bench (b, [&] () {
+                k.gain_s16 (b.s16_a.data (), bench_samples, 1.0f, 0.0f);
+            });
+
+            printf ("%-8s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f "
+                    "%6d\n",
+                    k.name, s16_to_f32_ns, f32_to_s16_ns, clamp_ns,
+                    deinterleave_ns, interleave_ns, mix_ns, gain_ns,
+                    check_kernels (k, ref));
+        }
+
+    printf ("ns/frame, diff is max s16 difference from scalar, -1 when "
+            "lossless kernels mismatch\n");
+
+    return 0;
+}
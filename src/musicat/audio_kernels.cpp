@@ -0,0 +1,502 @@
+#include "musicat/audio_kernels.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MUSICAT_AUDIO_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace musicat
+{
+namespace audio_kernels
+{
+
+inline constexpr float s16_scale = 32768.0f;
+inline constexpr float s16_max = 32767.0f;
+inline constexpr float s16_min = -32768.0f;
+
+static inline int16_t
+saturate_s16 (float v)
+{
+    if (v > s16_max)
+        v = s16_max;
+    else if (v < s16_min)
+        v = s16_min;
+
+    return (int16_t)lrintf (v);
+}
+
+// scalar, also handles tails of every vectorized kernel
+
+static void
+s16_to_f32_scalar (const int16_t *in, float *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = (float)in[i] * (1.0f / s16_scale);
+}
+
+static void
+f32_to_s16_scalar (const float *in, int16_t *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = saturate_s16 (in[i] * s16_scale);
+}
+
+static void
+clamp_f32_scalar (float *buffer, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        {
+            if (buffer[i] > 1.0f)
+                buffer[i] = 1.0f;
+            else if (buffer[i] < -1.0f)
+                buffer[i] = -1.0f;
+        }
+}
+
+static void
+deinterleave_f32_scalar (const float *in, float *left, float *right,
+                         size_t frames)
+{
+    for (size_t i = 0; i < frames; i++)
+        {
+            left[i] = in[i * 2];
+            right[i] = in[(i * 2) + 1];
+        }
+}
+
+static void
+interleave_f32_scalar (const float *left, const float *right, float *out,
+                       size_t frames)
+{
+    for (size_t i = 0; i < frames; i++)
+        {
+            out[i * 2] = left[i];
+            out[(i * 2) + 1] = right[i];
+        }
+}
+
+static void
+mix_s16_scalar (int16_t *dst, const int16_t *src, size_t count, float gain)
+{
+    for (size_t i = 0; i < count; i++)
+        dst[i] = saturate_s16 ((float)dst[i] + ((float)src[i] * gain));
+}
+
+static void
+gain_s16_scalar (int16_t *buffer, size_t count, float gain, float step)
+{
+    for (size_t i = 0; i < count; i++)
+        buffer[i]
+            = saturate_s16 ((float)buffer[i] * (gain + (step * (float)i)));
+}
+
+static const kernels_t scalar_kernels
+    = { KERNEL_SCALAR,         "scalar",
+        s16_to_f32_scalar,     f32_to_s16_scalar,
+        clamp_f32_scalar,      deinterleave_f32_scalar,
+        interleave_f32_scalar, mix_s16_scalar,
+        gain_s16_scalar };
+
+#ifdef MUSICAT_AUDIO_KERNELS_X86
+
+// SSE2, 8 s16 or 4 f32 samples at a time
+
+#define SSE2_FN __attribute__ ((target ("sse2")))
+
+SSE2_FN static inline void
+sse2_load_s16 (const int16_t *p, __m128 &lo, __m128 &hi)
+{
+    const __m128i x = _mm_loadu_si128 ((const __m128i *)p);
+
+    // sign extend to 32 bit
+    lo = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (x, x), 16));
+    hi = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (x, x), 16));
+}
+
+// values must already be in s16 range, packs saturates the rest
+SSE2_FN static inline void
+sse2_store_s16 (int16_t *p, __m128 lo, __m128 hi)
+{
+    _mm_storeu_si128 ((__m128i *)p,
+                      _mm_packs_epi32 (_mm_cvtps_epi32 (lo),
+                                       _mm_cvtps_epi32 (hi)));
+}
+
+SSE2_FN static void
+s16_to_f32_sse2 (const int16_t *in, float *out, size_t count)
+{
+    const __m128 scale = _mm_set1_ps (1.0f / s16_scale);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        {
+            __m128 lo, hi;
+            sse2_load_s16 (in + i, lo, hi);
+
+            _mm_storeu_ps (out + i, _mm_mul_ps (lo, scale));
+            _mm_storeu_ps (out + i + 4, _mm_mul_ps (hi, scale));
+        }
+
+    s16_to_f32_scalar (in + i, out + i, count - i);
+}
+
+SSE2_FN static void
+f32_to_s16_sse2 (const float *in, int16_t *out, size_t count)
+{
+    const __m128 scale = _mm_set1_ps (s16_scale);
+    // clamp before converting, out of int32 range converts to INT_MIN
+    const __m128 vmax = _mm_set1_ps (s16_max);
+    const __m128 vmin = _mm_set1_ps (s16_min);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        {
+            __m128 lo = _mm_mul_ps (_mm_loadu_ps (in + i), scale);
+            __m128 hi = _mm_mul_ps (_mm_loadu_ps (in + i + 4), scale);
+
+            lo = _mm_max_ps (_mm_min_ps (lo, vmax), vmin);
+            hi = _mm_max_ps (_mm_min_ps (hi, vmax), vmin);
+
+            sse2_store_s16 (out + i, lo, hi);
+        }
+
+    f32_to_s16_scalar (in + i, out + i, count - i);
+}
+
+SSE2_FN static void
+clamp_f32_sse2 (float *buffer, size_t count)
+{
+    const __m128 vmax = _mm_set1_ps (1.0f);
+    const __m128 vmin = _mm_set1_ps (-1.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps (buffer + i);
+            _mm_storeu_ps (buffer + i,
+                           _mm_max_ps (_mm_min_ps (x, vmax), vmin));
+        }
+
+    clamp_f32_scalar (buffer + i, count - i);
+}
+
+SSE2_FN static void
+deinterleave_f32_sse2 (const float *in, float *left, float *right,
+                       size_t frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4)
+        {
+            const __m128 a = _mm_loadu_ps (in + (i * 2));
+            const __m128 b = _mm_loadu_ps (in + (i * 2) + 4);
+
+            _mm_storeu_ps (left + i, _mm_shuffle_ps (a, b, 0x88));
+            _mm_storeu_ps (right + i, _mm_shuffle_ps (a, b, 0xDD));
+        }
+
+    deinterleave_f32_scalar (in + (i * 2), left + i, right + i, frames - i);
+}
+
+SSE2_FN static void
+interleave_f32_sse2 (const float *left, const float *right, float *out,
+                     size_t frames)
+{
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4)
+        {
+            const __m128 l = _mm_loadu_ps (left + i);
+            const __m128 r = _mm_loadu_ps (right + i);
+
+            _mm_storeu_ps (out + (i * 2), _mm_unpacklo_ps (l, r));
+            _mm_storeu_ps (out + (i * 2) + 4, _mm_unpackhi_ps (l, r));
+        }
+
+    interleave_f32_scalar (left + i, right + i, out + (i * 2), frames - i);
+}
+
+SSE2_FN static void
+mix_s16_sse2 (int16_t *dst, const int16_t *src, size_t count, float gain)
+{
+    const __m128 vgain = _mm_set1_ps (gain);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        {
+            __m128 dlo, dhi, slo, shi;
+            sse2_load_s16 (dst + i, dlo, dhi);
+            sse2_load_s16 (src + i, slo, shi);
+
+            sse2_store_s16 (dst + i, _mm_add_ps (dlo, _mm_mul_ps (slo, vgain)),
+                            _mm_add_ps (dhi, _mm_mul_ps (shi, vgain)));
+        }
+
+    mix_s16_scalar (dst + i, src + i, count - i, gain);
+}
+
+SSE2_FN static void
+gain_s16_sse2 (int16_t *buffer, size_t count, float gain, float step)
+{
+    __m128 vgain = _mm_setr_ps (gain, gain + step, gain + (step * 2),
+                                gain + (step * 3));
+    const __m128 vstep4 = _mm_set1_ps (step * 4);
+    const __m128 vstep8 = _mm_set1_ps (step * 8);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        {
+            __m128 lo, hi;
+            sse2_load_s16 (buffer + i, lo, hi);
+
+            sse2_store_s16 (buffer + i, _mm_mul_ps (lo, vgain),
+                            _mm_mul_ps (hi, _mm_add_ps (vgain, vstep4)));
+
+            vgain = _mm_add_ps (vgain, vstep8);
+        }
+
+    gain_s16_scalar (buffer + i, count - i, gain + (step * (float)i), step);
+}
+
+static const kernels_t sse2_kernels
+    = { KERNEL_SSE2,         "sse2",
+        s16_to_f32_sse2,     f32_to_s16_sse2,
+        clamp_f32_sse2,      deinterleave_f32_sse2,
+        interleave_f32_sse2, mix_s16_sse2,
+        gain_s16_sse2 };
+
+// AVX2, 16 s16 or 8 f32 samples at a time
+
+#define AVX2_FN __attribute__ ((target ("avx2")))
+
+AVX2_FN static inline void
+avx2_load_s16 (const int16_t *p, __m256 &lo, __m256 &hi)
+{
+    const __m256i x = _mm256_loadu_si256 ((const __m256i *)p);
+
+    lo = _mm256_cvtepi32_ps (
+        _mm256_cvtepi16_epi32 (_mm256_castsi256_si128 (x)));
+    hi = _mm256_cvtepi32_ps (
+        _mm256_cvtepi16_epi32 (_mm256_extracti128_si256 (x, 1)));
+}
+
+// values must already be in s16 range, packs saturates the rest
+AVX2_FN static inline void
+avx2_store_s16 (int16_t *p, __m256 lo, __m256 hi)
+{
+    const __m256i packed = _mm256_packs_epi32 (_mm256_cvtps_epi32 (lo),
+                                               _mm256_cvtps_epi32 (hi));
+
+    // packs works per 128 bit lane, put the halves back in order
+    _mm256_storeu_si256 ((__m256i *)p,
+                         _mm256_permute4x64_epi64 (packed, 0xD8));
+}
+
+AVX2_FN static void
+s16_to_f32_avx2 (const int16_t *in, float *out, size_t count)
+{
+    const __m256 scale = _mm256_set1_ps (1.0f / s16_scale);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+        {
+            __m256 lo, hi;
+            avx2_load_s16 (in + i, lo, hi);
+
+            _mm256_storeu_ps (out + i, _mm256_mul_ps (lo, scale));
+            _mm256_storeu_ps (out + i + 8, _mm256_mul_ps (hi, scale));
+        }
+
+    s16_to_f32_scalar (in + i, out + i, count - i);
+}
+
+AVX2_FN static void
+f32_to_s16_avx2 (const float *in, int16_t *out, size_t count)
+{
+    const __m256 scale = _mm256_set1_ps (s16_scale);
+    // clamp before converting, out of int32 range converts to INT_MIN
+    const __m256 vmax = _mm256_set1_ps (s16_max);
+    const __m256 vmin = _mm256_set1_ps (s16_min);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+        {
+            __m256 lo = _mm256_mul_ps (_mm256_loadu_ps (in + i), scale);
+            __m256 hi = _mm256_mul_ps (_mm256_loadu_ps (in + i + 8), scale);
+
+            lo = _mm256_max_ps (_mm256_min_ps (lo, vmax), vmin);
+            hi = _mm256_max_ps (_mm256_min_ps (hi, vmax), vmin);
+
+            avx2_store_s16 (out + i, lo, hi);
+        }
+
+    f32_to_s16_scalar (in + i, out + i, count - i);
+}
+
+AVX2_FN static void
+clamp_f32_avx2 (float *buffer, size_t count)
+{
+    const __m256 vmax = _mm256_set1_ps (1.0f);
+    const __m256 vmin = _mm256_set1_ps (-1.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps (buffer + i);
+            _mm256_storeu_ps (buffer + i,
+                              _mm256_max_ps (_mm256_min_ps (x, vmax), vmin));
+        }
+
+    clamp_f32_scalar (buffer + i, count - i);
+}
+
+AVX2_FN static void
+deinterleave_f32_avx2 (const float *in, float *left, float *right,
+                       size_t frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8)
+        {
+            const __m256 a = _mm256_loadu_ps (in + (i * 2));
+            const __m256 b = _mm256_loadu_ps (in + (i * 2) + 8);
+
+            // shuffle works per 128 bit lane, leaving 64 bit pairs out of
+            // order: 0 1 4 5 2 3 6 7
+            const __m256 l = _mm256_shuffle_ps (a, b, 0x88);
+            const __m256 r = _mm256_shuffle_ps (a, b, 0xDD);
+
+            _mm256_storeu_ps (left + i,
+                              _mm256_castpd_ps (_mm256_permute4x64_pd (
+                                  _mm256_castps_pd (l), 0xD8)));
+            _mm256_storeu_ps (right + i,
+                              _mm256_castpd_ps (_mm256_permute4x64_pd (
+                                  _mm256_castps_pd (r), 0xD8)));
+        }
+
+    deinterleave_f32_scalar (in + (i * 2), left + i, right + i, frames - i);
+}
+
+AVX2_FN static void
+interleave_f32_avx2 (const float *left, const float *right, float *out,
+                     size_t frames)
+{
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8)
+        {
+            const __m256 l = _mm256_loadu_ps (left + i);
+            const __m256 r = _mm256_loadu_ps (right + i);
+
+            // frames 0 1 4 5 and 2 3 6 7
+            const __m256 lo = _mm256_unpacklo_ps (l, r);
+            const __m256 hi = _mm256_unpackhi_ps (l, r);
+
+            _mm256_storeu_ps (out + (i * 2),
+                              _mm256_permute2f128_ps (lo, hi, 0x20));
+            _mm256_storeu_ps (out + (i * 2) + 8,
+                              _mm256_permute2f128_ps (lo, hi, 0x31));
+        }
+
+    interleave_f32_scalar (left + i, right + i, out + (i * 2), frames - i);
+}
+
+AVX2_FN static void
+mix_s16_avx2 (int16_t *dst, const int16_t *src, size_t count, float gain)
+{
+    const __m256 vgain = _mm256_set1_ps (gain);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+        {
+            __m256 dlo, dhi, slo, shi;
+            avx2_load_s16 (dst + i, dlo, dhi);
+            avx2_load_s16 (src + i, slo, shi);
+
+            avx2_store_s16 (dst + i,
+                            _mm256_add_ps (dlo, _mm256_mul_ps (slo, vgain)),
+                            _mm256_add_ps (dhi, _mm256_mul_ps (shi, vgain)));
+        }
+
+    mix_s16_scalar (dst + i, src + i, count - i, gain);
+}
+
+AVX2_FN static void
+gain_s16_avx2 (int16_t *buffer, size_t count, float gain, float step)
+{
+    __m256 vgain = _mm256_setr_ps (gain, gain + step, gain + (step * 2),
+                                   gain + (step * 3), gain + (step * 4),
+                                   gain + (step * 5), gain + (step * 6),
+                                   gain + (step * 7));
+    const __m256 vstep8 = _mm256_set1_ps (step * 8);
+    const __m256 vstep16 = _mm256_set1_ps (step * 16);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+        {
+            __m256 lo, hi;
+            avx2_load_s16 (buffer + i, lo, hi);
+
+            avx2_store_s16 (buffer + i, _mm256_mul_ps (lo, vgain),
+                            _mm256_mul_ps (hi, _mm256_add_ps (vgain, vstep8)));
+
+            vgain = _mm256_add_ps (vgain, vstep16);
+        }
+
+    gain_s16_scalar (buffer + i, count - i, gain + (step * (float)i), step);
+}
+
+static const kernels_t avx2_kernels
+    = { KERNEL_AVX2,         "avx2",
+        s16_to_f32_avx2,     f32_to_s16_avx2,
+        clamp_f32_avx2,      deinterleave_f32_avx2,
+        interleave_f32_avx2, mix_s16_avx2,
+        gain_s16_avx2 };
+
+#endif // MUSICAT_AUDIO_KERNELS_X86
+
+const kernels_t *
+get_kernels (kernel_level_t level)
+{
+    switch (level)
+        {
+        case KERNEL_SCALAR:
+            return &scalar_kernels;
+
+#ifdef MUSICAT_AUDIO_KERNELS_X86
+        case KERNEL_SSE2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("sse2") ? &sse2_kernels : nullptr;
+
+        case KERNEL_AVX2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx2") ? &avx2_kernels : nullptr;
+#endif
+
+        default:
+            return nullptr;
+        }
+}
+
+static const kernels_t &
+select_kernels ()
+{
+    const kernel_level_t levels[] = { KERNEL_AVX2, KERNEL_SSE2 };
+
+    for (const kernel_level_t level : levels)
+        {
+            const kernels_t *k = get_kernels (level);
+            if (k)
+                return *k;
+        }
+
+    return scalar_kernels;
+}
+
+const kernels_t &
+get_kernels ()
+{
+    static const kernels_t &selected = select_kernels ();
+
+    return selected;
+}
+
+} // audio_kernels
+} // musicat
@@ -1,27 +1,37 @@
 #include "musicat/audio_processing.h"
+#include "musicat/audio_ring.h"
 #include "musicat/child.h"
 #include "musicat/child/command.h"
+#include "musicat/download_manager.h"
 #include "musicat/helper_processor.h"
 #include "musicat/musicat.h"
+#include "musicat/native_processor.h"
+#include "musicat/spawn.h"
 #include <assert.h>
 #include <chrono>
+#include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <sys/epoll.h>
 #include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 namespace musicat
 {
 namespace audio_processing
 {
 
-// need to make this global to close it on worker fork
 // processor audio stream out
 int write_fifo = -1,
     // ffmpeg stdout
@@ -29,10 +39,50 @@ int write_fifo = -1,
     // ffmpeg runtime command/stdin
     pwritefd = -1;
 
+#ifdef MUSICAT_USE_SHM_RING
+// processor audio stream out when using shared memory transport
+audio_ring::ring_t stream_ring = { nullptr, nullptr, 0 };
+#endif
+
 // whether current instance have notified parent that it's ready
 // through its stdout
 bool notified = false;
 
+// helper chain output currently watched by main loop epoll
+int chain_watch_fd = -1;
+pid_t chain_watch_pid = -1;
+bool chain_timer_armed = false;
+
+#ifdef MUSICAT_USE_SPLICE
+// cleared when stream pipe can't be spliced to, copy path is used instead
+bool splice_supported = true;
+#endif
+
+#ifdef MUSICAT_USE_PCM
+// s16le stereo
+inline constexpr size_t pcm_frame_size = 4;
+
+// tail of the last buffer short of a whole frame, goes in front of the next
+// one so native stages never start mid frame
+uint8_t frame_carry[pcm_frame_size];
+size_t frame_carry_size = 0;
+std::vector<uint8_t> frame_buffer = {};
+
+#ifdef MUSICAT_USE_SPLICE
+// bytes spliced past the last frame boundary
+size_t splice_frame_offset = 0;
+#endif
+#endif
+
+// current ffmpeg hasn't given any output yet
+bool ffmpeg_output_pending = false;
+spawn::time_point_t ffmpeg_spawned_at;
+
+// followed file not growing for this long is given up on
+inline constexpr int follow_stall_timeout_ms = 30000;
+// how often followed file is checked again once all of it is read
+inline constexpr int follow_poll_interval_ms = 100;
+
 inline constexpr const char audio_cmd_str[]
     = "[audio_processing::read_command ";
 inline constexpr const size_t audio_cmd_str_size
@@ -47,57 +97,80 @@ read_command (processor_options_t &options)
     cmdrfds[0].events = POLLIN;
     cmdrfds[0].fd = STDIN_FILENO;
 
-    ssize_t read_cmd_size = 0;
-    char cmd_buf[CMD_BUFSIZE + 1];
-
-    int has_cmd = poll (cmdrfds, 1, 1);
+    int has_cmd = poll (cmdrfds, 1, 0);
     bool read_cmd = (has_cmd > 0) && (cmdrfds[0].revents & POLLIN);
-    while (
-        read_cmd
-        && ((read_cmd_size = read (cmdrfds[0].fd, cmd_buf, CMD_BUFSIZE)) > 0))
+    while (read_cmd)
         {
-            cmd_buf[CMD_BUFSIZE] = '\0';
+            using namespace child::command;
+            command_options_t command_options = create_command_options ();
+
+            // a frame is never written partially, reading the rest of it
+            // doesn't block for long
+            if (child::command::read_command (cmdrfds[0].fd, command_options,
+                                              "audio_processing::read_command")
+                != 1)
+                break;
 
             if (options.debug)
                 {
                     write (STDERR_FILENO, audio_cmd_str, audio_cmd_str_size);
 
                     fprintf (stderr, audio_cmd_str2, options.guild_id.c_str (),
-                             cmd_buf);
+                             command_options.command.c_str ());
                 }
 
-            const std::string cmd (cmd_buf);
+            if (command_options.command == command_options_keys_t.seek)
+                {
+                    options.seek_to = command_options.seek;
+                }
 
-            {
-                using namespace child::command;
-                command_options_t command_options = create_command_options ();
-                parse_command_to_options (cmd, command_options);
-
-                if (command_options.command == command_options_keys_t.seek)
-                    {
-                        options.seek_to = command_options.seek;
-                    }
-
-                else if (command_options.command
-                         == command_options_keys_t.volume)
-                    {
-                        options.volume = command_options.volume;
-                    }
-                else if (command_options.command
-                         == command_options_keys_t.helper_chain)
-                    {
-                        options.helper_chain.clear ();
-                        parse_helper_chain_option (command_options, options);
-                    }
-            }
+            else if (command_options.command == command_options_keys_t.volume)
+                {
+                    options.volume = command_options.volume;
+                }
+            else if (command_options.command
+                     == command_options_keys_t.helper_chain)
+                {
+                    options.helper_chain.clear ();
+                    parse_helper_chain_option (command_options, options);
+                }
+            else if (command_options.command
+                     == command_options_keys_t.file_path)
+                {
+                    options.file_path = command_options.file_path;
+                    options.seek_to = command_options.seek;
+                    options.normalize_gain = command_options.normalize_gain;
+                    options.switch_input = true;
+                }
 
-            has_cmd = poll (cmdrfds, 1, 1);
+            has_cmd = poll (cmdrfds, 1, 0);
             read_cmd = (has_cmd > 0) && (cmdrfds[0].revents & POLLIN);
         }
 
     return 0;
 }
 
+// notification is sent as the command of a command frame
+static void
+notify_parent (const char *notification, const char *caller)
+{
+    child::command::command_t cmd = child::command::create_command ();
+    child::command::add_str_option (cmd, child::command::CMD_KEY_COMMAND,
+                                    notification);
+
+    child::command::write_command (cmd, STDOUT_FILENO, caller);
+}
+
+static void
+notify_ready (const char *caller)
+{
+    if (notified)
+        return;
+
+    notify_parent (PROCESSOR_NOTIFY_READY, caller);
+    notified = true;
+}
+
 inline constexpr const char *idfmt
     = "[audio_processing::write_stdout] size, will go to chain: %ld %d\n";
 inline constexpr const char *necdfmt
@@ -123,14 +196,42 @@ write_stdout (uint8_t *buffer, ssize_t *size, bool no_effect_chain)
     if (*size == 0)
         return 0;
 
-    if (!notified)
+#ifdef MUSICAT_USE_PCM
+    // a pipe read can end anywhere in a frame
+    if (frame_carry_size)
         {
-            child::command::write_command ("0", STDOUT_FILENO,
-                                           "audio_processing::write_stdout");
+            frame_buffer.resize (frame_carry_size + *size);
+            memcpy (frame_buffer.data (), frame_carry, frame_carry_size);
+            memcpy (frame_buffer.data () + frame_carry_size, buffer, *size);
 
-            notified = true;
+            buffer = frame_buffer.data ();
+            *size += frame_carry_size;
         }
 
+    frame_carry_size = *size % pcm_frame_size;
+    *size -= frame_carry_size;
+    memcpy (frame_carry, buffer + *size, frame_carry_size);
+
+    if (*size == 0)
+        return 0;
+#endif
+
+    // native chain runs after helper chain, output drained from helper
+    // chain still need to go through it
+    native_processor::run_through_chain (buffer, size);
+
+#ifdef MUSICAT_USE_PCM
+    native_processor::run_volume (buffer, size);
+#endif
+
+    notify_ready ("audio_processing::write_stdout");
+
+#ifdef MUSICAT_USE_SHM_RING
+    // fails when reader is gone, the same as broken fifo
+    ssize_t written = audio_ring::write_ring (stream_ring, buffer, *size);
+    if (written == -1)
+        return -1;
+#else
     ssize_t written = 0;
     ssize_t current_written = 0;
     while (((current_written
@@ -145,11 +246,75 @@ write_stdout (uint8_t *buffer, ssize_t *size, bool no_effect_chain)
 
             written += current_written;
         };
+#endif
 
     *size = 0;
 
     return written;
 }
+
+#ifdef MUSICAT_USE_SPLICE
+// ffmpeg output can go to stream pipe as is
+static bool
+can_splice ()
+{
+    if (!splice_supported || write_fifo == -1)
+        return false;
+
+#ifdef MUSICAT_USE_PCM
+    // rest of a frame partly spliced goes the same way, copy path only
+    // starts on a frame boundary
+    if (splice_frame_offset)
+        return true;
+
+    // carried bytes must go out first
+    if (frame_carry_size)
+        return false;
+#endif
+
+    return helper_processor::get_chain_size () == 0
+           && native_processor::is_passthrough ();
+}
+
+// move whatever ffmpeg output available to stream pipe without copying it
+// through userspace, blocks on stream pipe like write_stdout. returns 0 when
+// nothing was moved and the copy path should read it instead
+static ssize_t
+splice_stdout ()
+{
+    notify_ready ("audio_processing::splice_stdout");
+
+    size_t len = BUFFER_SIZE;
+
+#ifdef MUSICAT_USE_PCM
+    // only finish the frame, copy path might be needed after it
+    if (splice_frame_offset)
+        len = pcm_frame_size - splice_frame_offset;
+#endif
+
+    ssize_t moved;
+    while ((moved
+            = splice (preadfd, NULL, write_fifo, NULL, len, SPLICE_F_MOVE))
+               == -1
+           && errno == EINTR)
+        ;
+
+#ifdef MUSICAT_USE_PCM
+    if (moved > 0)
+        splice_frame_offset
+            = (splice_frame_offset + (size_t)moved) % pcm_frame_size;
+#endif
+
+    if (moved == -1 && errno == EINVAL)
+        {
+            perror ("[audio_processing::splice_stdout ERROR] splice");
+            splice_supported = false;
+            return 0;
+        }
+
+    return moved;
+}
+#endif
 /*
 static int
 run_reader (const processor_options_t &options,
@@ -364,7 +529,7 @@ send_audio_routine (dpp::discord_voice_client *vclient, uint16_t *send_buffer,
 processor_options_t
 create_options ()
 {
-    return { "", false, false, "", 100, "", "", {} };
+    return { "", false, false, "", 100, "", "", {}, false, 0.0 };
 }
 
 processor_options_t
@@ -924,75 +1089,215 @@ err_sfifo1:
 } // run_processor_2_child
 */
 
-// !TODO: refactor and use smt better to handle fds closing
-
-// close all unrelated fds when helper got forked
-static void
-handle_worker_fork ()
+static int
+epoll_watch (int epfd, int fd)
 {
-    close_valid_fd (&write_fifo);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
 
-    helper_processor::close_all_helper_fds ();
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) == 0)
+        return 0;
+
+    if (errno == EEXIST)
+        return epoll_ctl (epfd, EPOLL_CTL_MOD, fd, &ev);
+
+    return -1;
 }
 
+// keep the last helper output in epoll set and only arm pump timer
+// when there's more than one helper
 static void
-handle_helper_fork ()
+update_chain_watch (int epfd, int timer_fd)
 {
-    handle_worker_fork ();
-    // close parent fds in addition
-    close_valid_fd (&preadfd);
-    close_valid_fd (&pwritefd);
-}
+    if (epfd < 0)
+        return;
 
-static int
-run_standalone (const processor_options_t &options,
-                const processor_states_t &p_info)
-{
-    // request kernel to kill little self when parent dies
-    if (prctl (PR_SET_PDEATHSIG, SIGTERM) == -1)
+    const helper_processor::helper_chain_t *last_chain
+        = helper_processor::get_last_chain ();
+
+    const pid_t last_pid = last_chain ? last_chain->pid : -1;
+
+    // previous helper fd is removed from epoll set when closed
+    if (last_pid != chain_watch_pid)
         {
-            perror ("child standalone prctl");
-            _exit (EXIT_FAILURE);
+            chain_watch_pid = last_pid;
+            chain_watch_fd = -1;
+
+            if (last_chain && epoll_watch (epfd, last_chain->read_fd) == 0)
+                chain_watch_fd = last_chain->read_fd;
         }
-    preadfd = p_info.ppipefd[0];
-    int cwritefd = p_info.ppipefd[1];
-    int creadfd = p_info.cpipefd[0];
-    pwritefd = p_info.cpipefd[1];
 
-    close (preadfd);  /* Close unused read end */
-    close (pwritefd); /* Close unused read end */
+    const bool need_pump = helper_processor::get_chain_size () > 1;
 
-    int status;
-    status = dup2 (cwritefd, STDOUT_FILENO);
-    close (cwritefd);
-    if (status == -1)
+    if (need_pump == chain_timer_armed)
+        return;
+
+    struct itimerspec its;
+    memset (&its, 0, sizeof (its));
+
+    if (need_pump)
         {
-            perror ("child standalone dout");
-            _exit (EXIT_FAILURE);
+            its.it_value.tv_nsec = PROCESSOR_CHAIN_PUMP_INTERVAL_MS * 1000000;
+            its.it_interval.tv_nsec = its.it_value.tv_nsec;
         }
 
-    status = dup2 (creadfd, STDIN_FILENO);
-    close (creadfd);
-    if (status == -1)
+    if (timerfd_settime (timer_fd, 0, &its, NULL) == 0)
+        chain_timer_armed = need_pump;
+}
+
+static void
+manage_effect_chain (processor_options_t &options, int epfd = -1,
+                     int timer_fd = -1)
+{
+    // native first to mark which effect doesn't need helper
+    native_processor::manage_processor (options);
+    helper_processor::manage_processor (options);
+
+    update_chain_watch (epfd, timer_fd);
+}
+
+// copy partial file still being downloaded into pipe_fd as it grows, until
+// download manager unlinks it or the pipe reader is gone. a failed attempt
+// leaves it in place and the retry rewrites it from the start with the same
+// bytes, copying goes on once it's past what was already copied. closes
+// both fds
+static void
+follow_file (int file_fd, int pipe_fd, const std::string final_path)
+{
+    // reader going away is seen as EPIPE
+    sigset_t mask;
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGPIPE);
+    pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+    uint8_t buffer[BUFFER_SIZE];
+    int idle_ms = 0;
+    bool unlinked = false;
+    off_t last_size = -1;
+
+    while (true)
         {
-            perror ("child standalone din");
-            _exit (EXIT_FAILURE);
+            const ssize_t read_size = read (file_fd, buffer, BUFFER_SIZE);
+
+            if (read_size == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    perror ("[audio_processing::follow_file ERROR] read");
+                    break;
+                }
+
+            if (read_size > 0)
+                {
+                    ssize_t written = 0;
+                    while (written < read_size)
+                        {
+                            const ssize_t current_written
+                                = write (pipe_fd, buffer + written,
+                                         read_size - written);
+
+                            if (current_written == -1 && errno == EINTR)
+                                continue;
+
+                            if (current_written < 1)
+                                break;
+
+                            written += current_written;
+                        }
+
+                    if (written < read_size)
+                        break;
+
+                    idle_ms = 0;
+                    continue;
+                }
+
+            // caught up with the download, whatever was written before
+            // unlink has been read by now
+            if (unlinked)
+                {
+                    // giving up leaves no complete file
+                    struct stat final_stat;
+                    if (stat (final_path.c_str (), &final_stat) != 0)
+                        fprintf (stderr,
+                                 "[audio_processing::follow_file ERROR] "
+                                 "Download of '%s' failed, track ends "
+                                 "early\n",
+                                 final_path.c_str ());
+
+                    break;
+                }
+
+            struct stat file_stat;
+            if (fstat (file_fd, &file_stat) == 0)
+                {
+                    if (file_stat.st_nlink == 0)
+                        {
+                            unlinked = true;
+                            continue;
+                        }
+
+                    // retry still catching up counts as progress
+                    if (file_stat.st_size != last_size)
+                        {
+                            last_size = file_stat.st_size;
+                            idle_ms = 0;
+                        }
+                }
+
+            if (idle_ms >= follow_stall_timeout_ms)
+                {
+                    fprintf (stderr,
+                             "[audio_processing::follow_file ERROR] Partial "
+                             "file stopped growing, giving up\n");
+                    break;
+                }
+
+            // POLLERR once reader is gone
+            struct pollfd pfds[1] = { { pipe_fd, 0, 0 } };
+            if (poll (pfds, 1, follow_poll_interval_ms) > 0)
+                break;
+
+            idle_ms += follow_poll_interval_ms;
         }
 
-    // redirect ffmpeg stderr to /dev/null
-    if (!options.debug)
+    close_valid_fd (&file_fd);
+    close_valid_fd (&pipe_fd);
+}
+
+// spawn ffmpeg decoding options.file_path with stdin and stdout connected
+// to child ends of p_info pipes, returns its pid or -1. when the file is
+// still being downloaded ffmpeg reads its partial file through a pipe fed
+// by follow_file
+static pid_t
+spawn_standalone (const processor_options_t &options,
+                  const processor_states_t &p_info)
+{
+    std::string file_path = options.file_path;
+
+    int follow_fd = -1;
+    int follow_pipe[2] = { -1, -1 };
+
+    struct stat file_stat;
+    if (stat (file_path.c_str (), &file_stat) != 0)
         {
-            // redirect ffmpeg stderr to /dev/null
-            int dnull = open ("/dev/null", O_WRONLY);
-            dup2 (dnull, STDERR_FILENO);
-            close (dnull);
+            // file is in place when this fails, download just finished
+            follow_fd = open ((file_path
+                               + download_manager::partial_file_suffix)
+                                  .c_str (),
+                              O_RDONLY | O_CLOEXEC);
+
+            if (follow_fd != -1 && pipe2 (follow_pipe, O_CLOEXEC) == 0)
+                file_path = "pipe:3";
+            else
+                close_valid_fd (&follow_fd);
         }
 
-    const std::string file_path = options.file_path;
-
     const bool need_seek = !options.seek_to.empty ();
 
-    char *args[64] = {
+    const char *args[64] = {
         "ffmpeg",
     };
     int args_idx = 1;
@@ -1000,28 +1305,33 @@ run_standalone (const processor_options_t &options,
     if (need_seek)
         {
             args[args_idx++] = "-ss";
-            args[args_idx++] = (char *)options.seek_to.c_str ();
+            args[args_idx++] = options.seek_to.c_str ();
         }
 
+#ifdef MUSICAT_USE_PCM
+    // volume is applied in process as the last stage of the chain
+    std::string vol_arg = "anull";
+#else
     std::string vol_arg
         = "volume=" + std::to_string ((float)options.volume / (float)100);
-
-    char *rest_args[] = { "-v",
-                          "debug",
-                          "-i",
-                          (char *)file_path.c_str (),
-                          "-af",
-                          (char *)vol_arg.c_str (),
-                          "-ac",
-                          "2",
-                          "-ar",
-                          "48000",
-                          /*"-preset", "ultrafast",*/ "-threads",
-                          "1",
-                          "-stdin",
-                          USING_FORMAT,
-                          OUT_CMD,
-                          (char *)NULL };
+#endif
+
+    const char *rest_args[] = { "-v",
+                                "debug",
+                                "-i",
+                                file_path.c_str (),
+                                "-af",
+                                vol_arg.c_str (),
+                                "-ac",
+                                "2",
+                                "-ar",
+                                "48000",
+                                /*"-preset", "ultrafast",*/ "-threads",
+                                "1",
+                                "-stdin",
+                                USING_FORMAT,
+                                OUT_CMD,
+                                NULL };
 
     for (unsigned long i = 0; i < (sizeof (rest_args) / sizeof (rest_args[0]));
          i++)
@@ -1036,20 +1346,42 @@ run_standalone (const processor_options_t &options,
                 fprintf (stderr, "%s\n", args[i]);
             }
 
-    execvp ("ffmpeg", args);
+    spawn::fd_map_t fds[3] = { { p_info.cpipefd[0], STDIN_FILENO },
+                               { p_info.ppipefd[1], STDOUT_FILENO } };
+    size_t fd_count = 2;
 
-    perror ("child standalone exit");
-    _exit (EXIT_FAILURE);
+    if (follow_fd != -1)
+        fds[fd_count++] = { follow_pipe[0], 3 };
+
+    ffmpeg_spawned_at = spawn::now ();
+
+    const pid_t pid
+        = spawn::spawn_process (args, fds, fd_count, !options.debug);
+
+    ffmpeg_output_pending = pid != -1;
+
+    if (follow_fd != -1)
+        {
+            close_valid_fd (&follow_pipe[0]);
+
+            if (pid != -1)
+                std::thread (follow_file, follow_fd, follow_pipe[1],
+                             options.file_path)
+                    .detach ();
+            else
+                {
+                    close_valid_fd (&follow_fd);
+                    close_valid_fd (&follow_pipe[1]);
+                }
+        }
+
+    return pid;
 }
 
 // should be run as a child process
 run_processor_error_t
 run_processor (child::command::command_options_t &process_options)
 {
-    // !TODO: remove this useless child_write_fd entirely
-    close (process_options.child_write_fd);
-    process_options.child_write_fd = -1;
-
     processor_states_t p_info;
 
     processor_options_t options = create_options ();
@@ -1058,6 +1390,9 @@ run_processor (child::command::command_options_t &process_options)
     options.id = process_options.id;
     options.guild_id = process_options.guild_id;
     options.volume = process_options.volume;
+    options.normalize_gain = process_options.normalize_gain;
+    // start position, only used by the first ffmpeg instance
+    options.seek_to = process_options.seek;
 
     run_processor_error_t init_error = SUCCESS;
     run_processor_error_t error_status = SUCCESS;
@@ -1067,6 +1402,10 @@ run_processor (child::command::command_options_t &process_options)
     int cwritefd, creadfd, cstatus = 0;
     struct pollfd prfds[1], pwfds[1];
 
+    // main loop blocks on these until there's something to do
+    int epfd = -1, timer_fd = -1;
+    struct epoll_event events[PROCESSOR_MAX_EVENTS];
+
     // main loop variable definition
     ssize_t last_read_size = 0;
     uint8_t rest_buffer[BUFFER_SIZE];
@@ -1074,60 +1413,33 @@ run_processor (child::command::command_options_t &process_options)
     processor_options_t current_options = copy_options (options);
     parse_helper_chain_option (process_options, options);
 
-    helper_processor::manage_processor (options, handle_helper_fork);
+    manage_effect_chain (options);
 
-    int stdin_fifo, fifo_status, stdout_fifo;
+#ifdef MUSICAT_USE_PCM
+    native_processor::set_volume (options.volume, false);
+#endif
 
-    write_fifo
-        = open (process_options.audio_stream_fifo_path.c_str (), O_WRONLY);
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+    native_processor::set_normalize_gain (options.normalize_gain, false);
+#endif
 
-    if (write_fifo < 0)
+#ifdef MUSICAT_USE_SHM_RING
+    if (audio_ring::open_ring (process_options.id, stream_ring) != 0)
         {
-            perror ("write_fifo");
+            fprintf (stderr, "[audio_processing::run_processor ERROR] "
+                             "Failed opening audio ring\n");
             init_error = ERR_SFIFO;
             goto err_sfifo1;
         }
-
-    stdin_fifo
-        = open (process_options.audio_stream_stdin_path.c_str (), O_RDONLY);
-
-    if (stdin_fifo < 0)
-        {
-            perror ("stdin_fifo");
-            init_error = ERR_SFIFO;
-            goto err_sfifo2;
-        }
-
-    fifo_status = dup2 (stdin_fifo, STDIN_FILENO);
-    close (stdin_fifo);
-    if (fifo_status == -1)
-        {
-            perror ("dup2 stdin_fifo");
-            init_error = ERR_SFIFO;
-            goto err_sfifo3;
-        }
-
-    stdout_fifo
-        = open (process_options.audio_stream_stdout_path.c_str (), O_WRONLY);
-
-    if (stdout_fifo < 0)
-        {
-            perror ("stdout_fifo");
-            init_error = ERR_SFIFO;
-            goto err_sfifo4;
-        }
-
-    fifo_status = dup2 (stdout_fifo, STDOUT_FILENO);
-    close (stdout_fifo);
-    if (fifo_status == -1)
-        {
-            perror ("dup2 stdout_fifo");
-            init_error = ERR_SFIFO;
-            goto err_sfifo5;
-        }
+#else
+    // stdin and stdout are already connected by worker, only audio stream
+    // pipe is left
+    write_fifo = process_options.child_write_fd;
+    process_options.child_write_fd = -1;
+#endif
 
     // prepare required pipes for bidirectional interprocess communication
-    if (pipe (p_info.ppipefd) == -1)
+    if (pipe2 (p_info.ppipefd, O_CLOEXEC) == -1)
         {
             perror ("ppipe");
             init_error = ERR_SPIPE;
@@ -1136,7 +1448,7 @@ run_processor (child::command::command_options_t &process_options)
     preadfd = p_info.ppipefd[0];
     cwritefd = p_info.ppipefd[1];
 
-    if (pipe (p_info.cpipefd) == -1)
+    if (pipe2 (p_info.cpipefd, O_CLOEXEC) == -1)
         {
             perror ("cpipe");
             init_error = ERR_SPIPE;
@@ -1146,28 +1458,22 @@ run_processor (child::command::command_options_t &process_options)
     pwritefd = p_info.cpipefd[1];
 
     // create a child
-    p_info.cpid = fork ();
+    p_info.cpid = spawn_standalone (options, p_info);
     if (p_info.cpid == -1)
         {
-            perror ("fork");
             init_error = ERR_SFORK;
             goto err_sfork;
         }
 
-    if (p_info.cpid == 0)
-        {
-            // close unrelated fds
-            handle_worker_fork ();
-
-            run_standalone (options, p_info);
-        }
-
     close (cwritefd); /* Close unused write end */
     close (creadfd);  /* Close unused read end */
 
     cwritefd = -1;
     creadfd = -1;
 
+    // start position applied, don't treat it as runtime seek
+    options.seek_to = "";
+
     // prepare required data for polling
     prfds[0].events = POLLIN;
     pwfds[0].events = POLLOUT;
@@ -1175,16 +1481,97 @@ run_processor (child::command::command_options_t &process_options)
     prfds[0].fd = preadfd;
     pwfds[0].fd = pwritefd;
 
+    // watch ffmpeg stdout, commands and helper chain in a single set
+    epfd = epoll_create1 (EPOLL_CLOEXEC);
+    timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (epfd == -1 || timer_fd == -1 || epoll_watch (epfd, preadfd) == -1
+        || epoll_watch (epfd, STDIN_FILENO) == -1
+        || epoll_watch (epfd, timer_fd) == -1)
+        {
+            perror ("main epoll");
+            error_status = ERR_SEPOLL;
+            options.panic_break = true;
+        }
+    else
+        update_chain_watch (epfd, timer_fd);
+
     // main loop, breaking means exiting
     while (!options.panic_break)
         {
-            // poll ffmpeg stdout
-            int read_has_event = poll (prfds, 1, 0);
-            bool read_ready
-                = (read_has_event > 0) && (prfds[0].revents & POLLIN);
+            // block until ffmpeg output, command, helper chain output
+            // or pump timer is ready
+            const int n_event
+                = epoll_wait (epfd, events, PROCESSOR_MAX_EVENTS, -1);
+
+            if (n_event == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    perror ("main epoll_wait");
+                    break;
+                }
+
+            uint32_t stream_events = 0, cmd_events = 0, chain_events = 0;
+
+            for (int i = 0; i < n_event; i++)
+                {
+                    const int fd = events[i].data.fd;
+
+                    if (fd == preadfd)
+                        stream_events = events[i].events;
+                    else if (fd == STDIN_FILENO)
+                        cmd_events = events[i].events;
+                    else if (fd == chain_watch_fd)
+                        chain_events = events[i].events;
+                    else if (fd == timer_fd)
+                        {
+                            uint64_t expirations = 0;
+                            read (timer_fd, &expirations,
+                                  sizeof (expirations));
+
+                            helper_processor::pump_chain ();
+                        }
+                }
+
+            // ffmpeg stdout
+            int read_has_event = 0;
+            bool read_ready = stream_events & EPOLLIN;
 
             ssize_t input_read_size = 0;
 
+#ifdef MUSICAT_USE_SPLICE
+            if (read_ready && can_splice ())
+                {
+                    const ssize_t moved = splice_stdout ();
+
+                    if (moved == -1)
+                        {
+                            options.panic_break = true;
+                            break;
+                        }
+
+                    if (moved > 0)
+                        {
+                            if (ffmpeg_output_pending)
+                                {
+                                    spawn::record_first_byte (
+                                        spawn::CHILD_PROCESSOR_FFMPEG,
+                                        ffmpeg_spawned_at);
+
+                                    ffmpeg_output_pending = false;
+                                }
+
+                            // rest of the pipe is spliced on the next
+                            // wakeup, hangup is only handled once it's
+                            // drained
+                            read_ready = false;
+                            stream_events = 0;
+                        }
+                }
+#endif
+
             if (read_ready)
                 {
                     // with known chunk size that always guarantee correct read
@@ -1201,6 +1588,15 @@ run_processor (child::command::command_options_t &process_options)
                                         READ_CHUNK_SIZE))
                                > 0))
                         {
+                            if (ffmpeg_output_pending)
+                                {
+                                    spawn::record_first_byte (
+                                        spawn::CHILD_PROCESSOR_FFMPEG,
+                                        ffmpeg_spawned_at);
+
+                                    ffmpeg_output_pending = false;
+                                }
+
                             input_read_size += current_read;
                             if (input_read_size == BUFFER_SIZE)
                                 {
@@ -1239,32 +1635,90 @@ run_processor (child::command::command_options_t &process_options)
                                 };
                         }
                 }
-            else if ((prfds[0].revents & POLLERR)
-                     || (prfds[0].revents & POLLHUP))
+            else if (stream_events & (EPOLLERR | EPOLLHUP))
                 {
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+                    // input done, keep running and wait for the next one
+                    close_valid_fd (&pwritefd);
+
+                    waitpid (p_info.cpid, &cstatus, 0);
+                    if (options.debug)
+                        fprintf (stderr, "processor child status: %d\n",
+                                 cstatus);
+
+                    cstatus = 0;
+                    p_info.cpid = -1;
+
+                    epoll_ctl (epfd, EPOLL_CTL_DEL, preadfd, NULL);
+                    close_valid_fd (&preadfd);
+
+                    prfds[0].fd = -1;
+                    pwfds[0].fd = -1;
+
+                    notify_parent (PROCESSOR_NOTIFY_INPUT_END,
+                                   "audio_processing::run_processor");
+#else
                     // we got doomed
                     perror ("main poll");
                     break;
+#endif
+                }
+
+            // last helper output ready before the next input comes
+            if (chain_events & EPOLLIN)
+                {
+                    uint8_t chain_buffer[BUFFER_SIZE];
+                    ssize_t chain_read_size
+                        = read (chain_watch_fd, chain_buffer, BUFFER_SIZE);
+
+                    if (chain_read_size > 0)
+                        helper_processor::mark_last_chain_output ();
+
+                    if (chain_read_size > 0
+                        && write_stdout (chain_buffer, &chain_read_size, true)
+                               == -1)
+                        {
+                            options.panic_break = true;
+                            break;
+                        }
+
+                    // helper exited, stop watching it
+                    if (chain_read_size == 0)
+                        {
+                            epoll_ctl (epfd, EPOLL_CTL_DEL, chain_watch_fd,
+                                       NULL);
+                            chain_watch_fd = -1;
+                        }
+                }
+            else if (chain_events & (EPOLLERR | EPOLLHUP))
+                {
+                    epoll_ctl (epfd, EPOLL_CTL_DEL, chain_watch_fd, NULL);
+                    chain_watch_fd = -1;
                 }
 
-            // !TODO: poll and read for commands from stdin
-            // commands: volume, panic_break
-            // probably create a big struct for every possible options and one
-            // universal command parser that will set those options
             // commands should always be the length of CMD_BUFSIZE
-            read_command (options);
+            if (cmd_events & EPOLLIN)
+                read_command (options);
+            else if (cmd_events & (EPOLLERR | EPOLLHUP))
+                {
+                    // no more command writer, don't spin on it
+                    epoll_ctl (epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                }
+
             if (options.panic_break)
                 break;
 
-            helper_processor::manage_processor (options, handle_helper_fork);
+            manage_effect_chain (options, epfd, timer_fd);
 
             // recreate ffmpeg process to update filter chain
-            if (!options.seek_to.empty ())
+            if (!options.seek_to.empty () || options.switch_input)
                 {
-                    close (pwritefd);
+                    close_valid_fd (&pwritefd);
 
-                    // signal ffmpeg to stop keep reading input file
-                    kill (p_info.cpid, SIGTERM);
+                    // signal ffmpeg to stop keep reading input file,
+                    // already exited when switching after input ended
+                    if (p_info.cpid > 0)
+                        kill (p_info.cpid, SIGTERM);
 
                     // read the rest of data before closing current instance
                     // have some patient and wait for 1000 ms each poll
@@ -1278,9 +1732,10 @@ run_processor (child::command::command_options_t &process_options)
                     //     POLLIN);
                     while (/*read_ready
                            && */
-                           (input_read_size
-                            = read (preadfd, rest_buffer, BUFFER_SIZE))
-                           > 0)
+                           preadfd != -1
+                           && (input_read_size
+                               = read (preadfd, rest_buffer, BUFFER_SIZE))
+                                  > 0)
                         {
                             if (write_stdout (rest_buffer, &input_read_size)
                                 == -1)
@@ -1294,23 +1749,46 @@ run_processor (child::command::command_options_t &process_options)
                             //              && (prfds[0].revents & POLLIN);
                         }
 
-                    helper_processor::shutdown_chain (true);
+                    // effect state carries over to the next input
+                    if (!options.switch_input)
+                        {
+                            helper_processor::shutdown_chain (true);
+                            native_processor::reset_chain ();
+#ifdef MUSICAT_USE_PCM
+                            frame_carry_size = 0;
+#ifdef MUSICAT_USE_SPLICE
+                            splice_frame_offset = 0;
+#endif
+#endif
+                        }
 
                     // wait for child to finish transferring data
-                    waitpid (p_info.cpid, &cstatus, 0);
-                    if (options.debug)
-                        fprintf (stderr, "processor child status: %d\n",
-                                 cstatus);
+                    if (p_info.cpid > 0)
+                        {
+                            waitpid (p_info.cpid, &cstatus, 0);
+                            if (options.debug)
+                                fprintf (stderr,
+                                         "processor child status: %d\n",
+                                         cstatus);
+                        }
 
                     // close read fd
-                    close (preadfd);
+                    if (preadfd != -1)
+                        {
+                            epoll_ctl (epfd, EPOLL_CTL_DEL, preadfd, NULL);
+                            close (preadfd);
+                        }
 
                     preadfd = -1;
 
                     cstatus = 0;
 
+                    // let parent know where the new input starts
+                    if (options.switch_input)
+                        notified = false;
+
                     // do the same setup routine as startup
-                    if (pipe (p_info.ppipefd) == -1)
+                    if (pipe2 (p_info.ppipefd, O_CLOEXEC) == -1)
                         {
                             perror ("ppipe");
                             error_status = ERR_LPIPE;
@@ -1319,7 +1797,7 @@ run_processor (child::command::command_options_t &process_options)
                     preadfd = p_info.ppipefd[0];
                     cwritefd = p_info.ppipefd[1];
 
-                    if (pipe (p_info.cpipefd) == -1)
+                    if (pipe2 (p_info.cpipefd, O_CLOEXEC) == -1)
                         {
                             perror ("cpipe");
                             init_error = ERR_SPIPE;
@@ -1334,10 +1812,9 @@ run_processor (child::command::command_options_t &process_options)
                     creadfd = p_info.cpipefd[0];
                     pwritefd = p_info.cpipefd[1];
 
-                    p_info.cpid = fork ();
+                    p_info.cpid = spawn_standalone (options, p_info);
                     if (p_info.cpid == -1)
                         {
-                            perror ("fork");
                             error_status = ERR_LFORK;
 
                             close (preadfd);
@@ -1353,14 +1830,6 @@ run_processor (child::command::command_options_t &process_options)
                             break;
                         }
 
-                    if (p_info.cpid == 0)
-                        {
-                            // close unrelated fds to avoid deadlock
-                            handle_worker_fork ();
-
-                            run_standalone (options, p_info);
-                        }
-
                     close (cwritefd); /* Close unused write end */
                     close (creadfd);  /* Close unused write end */
 
@@ -1371,17 +1840,26 @@ run_processor (child::command::command_options_t &process_options)
                     prfds[0].fd = preadfd;
                     pwfds[0].fd = pwritefd;
 
-                    helper_processor::manage_processor (options,
-                                                        handle_helper_fork);
+                    if (epoll_watch (epfd, preadfd) == -1)
+                        {
+                            perror ("epoll_watch");
+                            error_status = ERR_SEPOLL;
+                            break;
+                        }
+
+                    manage_effect_chain (options, epfd, timer_fd);
 
                     // mark changes done
                     options.seek_to = "";
+                    options.switch_input = false;
                 }
 
-            // !TODO: put volume to always in the last chain
             // runtime effects here
             if (options.volume != current_options.volume)
                 {
+#ifdef MUSICAT_USE_PCM
+                    native_processor::set_volume (options.volume);
+#else
                     const std::string str_buf
                         = "call -1 volume "
                           + std::to_string ((float)options.volume / (float)100)
@@ -1389,21 +1867,35 @@ run_processor (child::command::command_options_t &process_options)
                     const char *buf = str_buf.c_str ();
 
                     write (pwritefd, buf, str_buf.size () + 1);
+#endif
                     current_options.volume = options.volume;
                 }
+
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+            // switched to another track
+            if (options.normalize_gain != current_options.normalize_gain)
+                {
+                    native_processor::set_normalize_gain (
+                        options.normalize_gain);
+                    current_options.normalize_gain = options.normalize_gain;
+                }
+#endif
         }
 
     // exiting, clean up
     // fds to close: preadfd pwritefd write_fifo
     close_valid_fd (&pwritefd);
 
-    // signal ffmpeg to stop keep reading input file
-    kill (p_info.cpid, SIGTERM);
+    // signal ffmpeg to stop keep reading input file, persistent processor
+    // might have no ffmpeg running between inputs
+    if (p_info.cpid > 0)
+        kill (p_info.cpid, SIGTERM);
 
     // read the rest of data before closing ffmpeg stdout
     // as it was signaled to terminate, we can read until its stdout is done
     // transferring data and finally closed
-    while ((last_read_size = read (preadfd, rest_buffer, BUFFER_SIZE)) > 0)
+    while (preadfd != -1
+           && (last_read_size = read (preadfd, rest_buffer, BUFFER_SIZE)) > 0)
         {
             if (write_stdout (rest_buffer, &last_read_size) == -1)
                 {
@@ -1421,15 +1913,29 @@ run_processor (child::command::command_options_t &process_options)
 
     cstatus = 0;
 
-    waitpid (p_info.cpid, &cstatus, 0); /* Wait for child */
-    if (options.debug)
-        fprintf (stderr, "processor child status: %d\n", cstatus);
+    if (p_info.cpid > 0)
+        {
+            waitpid (p_info.cpid, &cstatus, 0); /* Wait for child */
+            if (options.debug)
+                fprintf (stderr, "processor child status: %d\n", cstatus);
+        }
 
     close_valid_fd (&preadfd);
     close_valid_fd (&write_fifo);
+    close_valid_fd (&timer_fd);
+
+#ifdef MUSICAT_USE_SHM_RING
+    // let reader know there's no more data
+    audio_ring::mark_writer_closed (stream_ring);
+    audio_ring::close_ring (stream_ring);
+#endif
+    close_valid_fd (&epfd);
 
     if (options.debug)
-        fprintf (stderr, "fds closed\n");
+        {
+            fprintf (stderr, "fds closed\n");
+            spawn::print_stats ();
+        }
 
     close (STDOUT_FILENO);
     return error_status;
@@ -1442,42 +1948,16 @@ err_spipe2:
     close (preadfd);
     close (cwritefd);
 err_spipe1:
-err_sfifo5:
-err_sfifo4:
-err_sfifo3:
-err_sfifo2:
-    close (write_fifo);
+    close_valid_fd (&write_fifo);
+#ifdef MUSICAT_USE_SHM_RING
+    audio_ring::mark_writer_closed (stream_ring);
+    audio_ring::close_ring (stream_ring);
 err_sfifo1:
-    // close (process_options.child_write_fd);
-    // process_options.child_write_fd = -1;
+#endif
 
     close (STDOUT_FILENO);
     return init_error;
 } // run_processor
 
-std::string
-get_audio_stream_fifo_path (const std::string &id)
-{
-    return std::string ("/tmp/musicat.") + id + ".audio_stream";
-}
-
-mode_t
-get_audio_stream_fifo_mode_t ()
-{
-    return 0600;
-}
-
-std::string
-get_audio_stream_stdin_path (const std::string &id)
-{
-    return std::string ("/tmp/musicat.") + id + ".stdin";
-}
-
-std::string
-get_audio_stream_stdout_path (const std::string &id)
-{
-    return std::string ("/tmp/musicat.") + id + ".stdout";
-}
-
 } // audio_processing
 } // musicat
@@ -0,0 +1,353 @@
+#include "musicat/audio_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace musicat
+{
+namespace audio_ring
+{
+
+// writer wait timeout to recheck whether reader is still there
+inline constexpr int writer_wait_timeout_ms = 1000;
+
+static long
+futex_wait (std::atomic<uint32_t> *addr, uint32_t val, int timeout_ms)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    // shared futex as the memory is mapped by different processes
+    return syscall (SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val,
+                    timeout_ms < 0 ? NULL : &ts, NULL, 0);
+}
+
+static void
+futex_wake (std::atomic<uint32_t> *addr)
+{
+    syscall (SYS_futex, (uint32_t *)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static size_t
+get_map_size (const uint32_t capacity)
+{
+    return sizeof (ring_header_t) + capacity;
+}
+
+std::string
+get_ring_name (const std::string &id)
+{
+    return std::string ("/musicat.") + id + ".ring";
+}
+
+int
+create_ring (const std::string &id, const uint32_t capacity)
+{
+    if (!capacity || (capacity & (capacity - 1)))
+        return -1;
+
+    const std::string name = get_ring_name (id);
+    const size_t map_size = get_map_size (capacity);
+
+    shm_unlink (name.c_str ());
+
+    int fd = shm_open (name.c_str (), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        {
+            perror ("audio_ring::create_ring shm_open");
+            return -1;
+        }
+
+    void *map = MAP_FAILED;
+
+    if (ftruncate (fd, map_size) == -1)
+        {
+            perror ("audio_ring::create_ring ftruncate");
+            goto err1;
+        }
+
+    map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        {
+            perror ("audio_ring::create_ring mmap");
+            goto err1;
+        }
+
+    {
+        ring_header_t *header = new (map) ring_header_t;
+        header->write_pos = 0;
+        header->data_seq = 0;
+        header->data_waiting = 0;
+        header->read_pos = 0;
+        header->space_seq = 0;
+        header->space_waiting = 0;
+        header->writer_closed = 0;
+        header->reader_closed = 0;
+        header->capacity = capacity;
+    }
+
+    munmap (map, map_size);
+    close (fd);
+
+    return 0;
+
+err1:
+    close (fd);
+    shm_unlink (name.c_str ());
+    return -1;
+}
+
+int
+open_ring (const std::string &id, ring_t &ring)
+{
+    const std::string name = get_ring_name (id);
+
+    int fd = shm_open (name.c_str (), O_RDWR, 0600);
+    if (fd < 0)
+        {
+            perror ("audio_ring::open_ring shm_open");
+            return -1;
+        }
+
+    struct stat st;
+    if (fstat (fd, &st) == -1 || (size_t)st.st_size < sizeof (ring_header_t))
+        {
+            close (fd);
+            return -1;
+        }
+
+    void *map = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+
+    // mapping stays valid after closing fd
+    close (fd);
+
+    if (map == MAP_FAILED)
+        {
+            perror ("audio_ring::open_ring mmap");
+            return -1;
+        }
+
+    ring.header = (ring_header_t *)map;
+    ring.data = (uint8_t *)map + sizeof (ring_header_t);
+    ring.map_size = st.st_size;
+
+    if (get_map_size (ring.header->capacity) != ring.map_size)
+        {
+            close_ring (ring);
+            return -1;
+        }
+
+    return 0;
+}
+
+void
+close_ring (ring_t &ring)
+{
+    if (!ring.header)
+        return;
+
+    munmap ((void *)ring.header, ring.map_size);
+
+    ring.header = nullptr;
+    ring.data = nullptr;
+    ring.map_size = 0;
+}
+
+int
+unlink_ring (const std::string &id)
+{
+    return shm_unlink (get_ring_name (id).c_str ());
+}
+
+ssize_t
+write_ring (ring_t &ring, const uint8_t *buffer, size_t size)
+{
+    ring_header_t *h = ring.header;
+    const uint64_t capacity = h->capacity;
+    const uint64_t mask = capacity - 1;
+
+    size_t written = 0;
+    while (written < size)
+        {
+            if (h->reader_closed.load ())
+                return -1;
+
+            const uint64_t wpos = h->write_pos.load (std::memory_order_relaxed);
+            const uint32_t seq = h->space_seq.load ();
+            const uint64_t space = capacity - (wpos - h->read_pos.load ());
+
+            if (!space)
+                {
+                    h->space_waiting.store (1);
+
+                    // recheck after announcing wait to not miss a wake
+                    if (wpos - h->read_pos.load () == capacity
+                        && !h->reader_closed.load ())
+                        futex_wait (&h->space_seq, seq,
+                                    writer_wait_timeout_ms);
+
+                    continue;
+                }
+
+            size_t chunk = size - written;
+            if (chunk > space)
+                chunk = space;
+
+            const size_t offset = wpos & mask;
+            const size_t first = chunk < capacity - offset
+                                     ? chunk
+                                     : capacity - offset;
+
+            memcpy (ring.data + offset, buffer + written, first);
+            if (first < chunk)
+                memcpy (ring.data, buffer + written + first, chunk - first);
+
+            h->write_pos.store (wpos + chunk);
+            h->data_seq.fetch_add (1);
+
+            if (h->data_waiting.exchange (0))
+                futex_wake (&h->data_seq);
+
+            written += chunk;
+        }
+
+    return written;
+}
+
+size_t
+wait_ring (ring_t &ring, int timeout_ms)
+{
+    ring_header_t *h = ring.header;
+
+    const uint64_t rpos = h->read_pos.load (std::memory_order_relaxed);
+    const uint32_t seq = h->data_seq.load ();
+    uint64_t avail = h->write_pos.load () - rpos;
+
+    if (avail || h->writer_closed.load () || timeout_ms == 0)
+        return avail;
+
+    h->data_waiting.store (1);
+
+    // recheck after announcing wait to not miss a wake
+    avail = h->write_pos.load () - rpos;
+    if (!avail && !h->writer_closed.load ())
+        futex_wait (&h->data_seq, seq, timeout_ms);
+
+    return h->write_pos.load () - rpos;
+}
+
+const uint8_t *
+peek_ring (ring_t &ring, uint8_t *scratch, size_t size, size_t *read_size,
+           int timeout_ms)
+{
+    ring_header_t *h = ring.header;
+    const uint64_t capacity = h->capacity;
+    const uint64_t mask = capacity - 1;
+
+    if (size > capacity)
+        size = capacity;
+
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    const uint64_t rpos = h->read_pos.load (std::memory_order_relaxed);
+    uint64_t avail = 0;
+
+    while ((avail = h->write_pos.load () - rpos) < size)
+        {
+            if (h->writer_closed.load ())
+                {
+                    // recheck as writer might wrote the last data
+                    // right before closing
+                    avail = h->write_pos.load () - rpos;
+                    break;
+                }
+
+            int remaining_ms = -1;
+            if (timeout_ms >= 0)
+                {
+                    struct timespec now;
+                    clock_gettime (CLOCK_MONOTONIC, &now);
+
+                    const long elapsed
+                        = (now.tv_sec - start.tv_sec) * 1000
+                          + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+                    if (elapsed >= timeout_ms)
+                        {
+                            *read_size = 0;
+                            return nullptr;
+                        }
+
+                    remaining_ms = timeout_ms - elapsed;
+                }
+
+            const uint32_t seq = h->data_seq.load ();
+            h->data_waiting.store (1);
+
+            if (h->write_pos.load () - rpos < size && !h->writer_closed.load ())
+                futex_wait (&h->data_seq, seq, remaining_ms);
+        }
+
+    if (avail > size)
+        avail = size;
+
+    *read_size = avail;
+
+    if (!avail)
+        return nullptr;
+
+    const size_t offset = rpos & mask;
+
+    // contiguous, no copy needed
+    if (offset + avail <= capacity)
+        return ring.data + offset;
+
+    const size_t first = capacity - offset;
+    memcpy (scratch, ring.data + offset, first);
+    memcpy (scratch + first, ring.data, avail - first);
+
+    return scratch;
+}
+
+void
+consume_ring (ring_t &ring, size_t size)
+{
+    ring_header_t *h = ring.header;
+
+    h->read_pos.store (h->read_pos.load (std::memory_order_relaxed) + size);
+    h->space_seq.fetch_add (1);
+
+    if (h->space_waiting.exchange (0))
+        futex_wake (&h->space_seq);
+}
+
+void
+mark_writer_closed (ring_t &ring)
+{
+    ring.header->writer_closed.store (1);
+    ring.header->data_seq.fetch_add (1);
+    futex_wake (&ring.header->data_seq);
+}
+
+void
+mark_reader_closed (ring_t &ring)
+{
+    ring.header->reader_closed.store (1);
+    ring.header->space_seq.fetch_add (1);
+    futex_wake (&ring.header->space_seq);
+}
+
+} // audio_ring
+} // musicat
@@ -1,65 +1,101 @@
 #include "musicat/child.h"
 #include "musicat/child/command.h"
 #include "musicat/child/worker.h"
+#include "musicat/config.h"
+#include "musicat/musicat.h"
 #include "musicat/thread_manager.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 namespace musicat
 {
 namespace child
 {
 
-static int pm_write_fd = -1;
-static int pm_read_fd = -1;
+struct worker_handle_t
+{
+    pid_t pid;
+    // commands to worker
+    int write_fd;
+    // worker replies and fds of its slaves
+    int read_fd;
+};
+
+// never changes after init
+static std::vector<worker_handle_t> workers;
+
+size_t
+get_worker_count ()
+{
+    return workers.size ();
+}
+
+size_t
+get_guild_worker (const uint64_t guild_id)
+{
+    if (workers.empty ())
+        return 0;
 
-static pid_t cm_pid = -1;
+    return guild_id % workers.size ();
+}
 
 int *
-get_parent_write_fd ()
+get_parent_write_fd (const size_t worker)
 {
-    return &pm_write_fd;
+    return &workers.at (worker).write_fd;
 }
 
 int *
-get_parent_read_fd ()
+get_parent_read_fd (const size_t worker)
 {
-    return &pm_read_fd;
+    return &workers.at (worker).read_fd;
 }
 
-int
-init ()
+static int
+start_worker ()
 {
-    fprintf (stderr, "[child] Initializing...\n");
-    thread_manager::print_total_thread ();
     int pipe_fds[4];
 
-    if ((pipe (&pipe_fds[0])) == -1)
+    if ((pipe2 (&pipe_fds[0], O_CLOEXEC)) == -1)
         {
             fprintf (stderr, "[child ERROR] Can't create pipe\n");
             perror ("child pipe");
             return ERR_CPIPE;
         }
-    pm_write_fd = pipe_fds[1];
+    int pm_write_fd = pipe_fds[1];
     int cm_read_fd = pipe_fds[0];
 
-    if ((pipe (&pipe_fds[2])) == -1)
+    // worker passes fds of its slaves through this
+    if ((socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, &pipe_fds[2]))
+        == -1)
         {
-            fprintf (stderr, "[child ERROR] Can't create pipe\n");
-            perror ("child pipe");
+            fprintf (stderr, "[child ERROR] Can't create socket\n");
+            perror ("child socketpair");
+
+            close (pm_write_fd);
+            close (cm_read_fd);
             return ERR_CPIPE;
         }
     int cm_write_fd = pipe_fds[3];
-    pm_read_fd = pipe_fds[2];
+    int pm_read_fd = pipe_fds[2];
 
-    cm_pid = fork ();
+    pid_t cm_pid = fork ();
     if (cm_pid < 0)
         {
             fprintf (stderr, "[child ERROR] Can't fork\n");
             perror ("child fork");
+
+            close (pm_write_fd);
+            close (cm_read_fd);
+            close (pm_read_fd);
+            close (cm_write_fd);
             return ERR_CWORKER;
         }
 
@@ -67,8 +103,15 @@ init ()
         {
             close (pm_read_fd);
             close (pm_write_fd);
-            pm_read_fd = -1;
-            pm_write_fd = -1;
+
+            // other workers must see main process closing their pipe
+            for (worker_handle_t &w : workers)
+                {
+                    close_valid_fd (&w.write_fd);
+                    close_valid_fd (&w.read_fd);
+                }
+
+            workers.clear ();
 
             if (prctl (PR_SET_PDEATHSIG, SIGTERM) == -1)
                 {
@@ -82,8 +125,34 @@ init ()
 
     close (cm_read_fd);
     close (cm_write_fd);
-    cm_read_fd = -1;
-    cm_write_fd = -1;
+
+    workers.push_back ({ cm_pid, pm_write_fd, pm_read_fd });
+
+    return SUCCESS;
+}
+
+int
+init ()
+{
+    fprintf (stderr, "[child] Initializing...\n");
+    thread_manager::print_total_thread ();
+
+    size_t count = CHILD_WORKER_COUNT;
+    if (!count)
+        count = std::thread::hardware_concurrency ();
+    if (!count)
+        count = 1;
+
+    int status = SUCCESS;
+
+    // run with whatever started, only fail when there's none
+    while (workers.size () < count && (status = start_worker ()) == SUCCESS)
+        ;
+
+    if (workers.empty ())
+        return status;
+
+    fprintf (stderr, "[child] Started %ld worker(s)\n", workers.size ());
 
     // the first thread ever created in the program
     command::run_command_thread ();
@@ -98,13 +167,19 @@ shutdown ()
 
     command::wake ();
 
-    close (pm_write_fd);
+    for (worker_handle_t &w : workers)
+        close_valid_fd (&w.write_fd);
 
-    int cm_status = 0;
-    waitpid (cm_pid, &cm_status, 0);
-    fprintf (stderr, "[child] Status: %d\n", cm_status);
+    for (worker_handle_t &w : workers)
+        {
+            int cm_status = 0;
+            waitpid (w.pid, &cm_status, 0);
+            fprintf (stderr, "[child] Worker %d status: %d\n", w.pid,
+                     cm_status);
+        }
 
-    close (pm_read_fd);
+    for (worker_handle_t &w : workers)
+        close_valid_fd (&w.read_fd);
 }
 
 } // child
@@ -1,9 +1,16 @@
 #include "musicat/child/command.h"
 #include "musicat/child.h"
+#include "musicat/config.h"
 #include "musicat/musicat.h"
 #include "musicat/thread_manager.h"
 #include <chrono>
+#include <errno.h>
 #include <mutex>
+#include <string.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
 
 namespace musicat
 {
@@ -14,14 +21,135 @@ namespace child
 namespace command
 {
 
-std::deque<std::string> command_queue;
-std::mutex command_mutex;
-std::condition_variable command_cv;
+// encoded frames waiting to be written to a worker
+struct worker_queue_t
+{
+    std::deque<command_t> commands;
+    std::mutex m; // commands
+    std::condition_variable cv;
+};
+
+// one for each worker, never changes after run_command_thread
+std::vector<worker_queue_t *> worker_queues;
 
 std::map<std::string, std::pair<bool, int> > slave_ready_queue;
-std::mutex sr_m;
+// fds sent along with ready status, owned until taken
+std::map<std::string, std::vector<int> > slave_fds;
+std::mutex sr_m; // slave_ready_queue, slave_fds
 std::condition_variable sr_cv;
 
+// value type of every key
+static command_value_type_t
+get_key_type (const command_key_t key)
+{
+    switch (key)
+        {
+        case CMD_KEY_DEBUG:
+        case CMD_KEY_READY:
+        case CMD_KEY_VOLUME:
+        case CMD_KEY_FORCE:
+            return CMD_VALUE_INT;
+        case CMD_KEY_NORMALIZE_GAIN:
+            return CMD_VALUE_DOUBLE;
+        default:
+            return CMD_VALUE_STR;
+        }
+}
+
+static const std::string &
+get_key_name (const command_key_t key)
+{
+    switch (key)
+        {
+        case CMD_KEY_COMMAND:
+            return command_options_keys_t.command;
+        case CMD_KEY_FILE_PATH:
+            return command_options_keys_t.file_path;
+        case CMD_KEY_DEBUG:
+            return command_options_keys_t.debug;
+        case CMD_KEY_ID:
+            return command_options_keys_t.id;
+        case CMD_KEY_GUILD_ID:
+            return command_options_keys_t.guild_id;
+        case CMD_KEY_READY:
+            return command_options_keys_t.ready;
+        case CMD_KEY_SEEK:
+            return command_options_keys_t.seek;
+        case CMD_KEY_VOLUME:
+            return command_options_keys_t.volume;
+        case CMD_KEY_HELPER_CHAIN:
+            return command_options_keys_t.helper_chain;
+        case CMD_KEY_FORCE:
+            return command_options_keys_t.force;
+        default:
+            return command_options_keys_t.normalize_gain;
+        }
+}
+
+// every key in command_key_t should be handled in one of these setters
+static void
+set_str_option (command_options_t &options, const command_key_t key,
+                const char *value, const size_t size)
+{
+    switch (key)
+        {
+        case CMD_KEY_COMMAND:
+            options.command.assign (value, size);
+            break;
+        case CMD_KEY_FILE_PATH:
+            options.file_path.assign (value, size);
+            break;
+        case CMD_KEY_ID:
+            options.id.assign (value, size);
+            break;
+        case CMD_KEY_GUILD_ID:
+            options.guild_id.assign (value, size);
+            break;
+        case CMD_KEY_SEEK:
+            options.seek.assign (value, size);
+            break;
+        case CMD_KEY_HELPER_CHAIN:
+            options.helper_chain += '@';
+            options.helper_chain.append (value, size);
+            options.helper_chain += '@';
+            break;
+        default:
+            break;
+        }
+}
+
+static void
+set_int_option (command_options_t &options, const command_key_t key,
+                const int64_t value)
+{
+    switch (key)
+        {
+        case CMD_KEY_DEBUG:
+            options.debug = value == 1;
+            break;
+        case CMD_KEY_READY:
+            options.ready = (int)value;
+            break;
+        case CMD_KEY_VOLUME:
+            options.volume = (int)value;
+            break;
+        case CMD_KEY_FORCE:
+            options.force = value == 1;
+            break;
+        default:
+            break;
+        }
+}
+
+static void
+set_double_option (command_options_t &options, const command_key_t key,
+                   const double value)
+{
+    if (key == CMD_KEY_NORMALIZE_GAIN)
+        options.normalize_gain = value;
+}
+
+// text format `key=value` of a single option
 int
 set_option (command_options_t &options, std::string &cmd_option)
 {
@@ -58,143 +186,251 @@ set_option (command_options_t &options, std::string &cmd_option)
             opt += c;
         }
 
-    // every value in command_options_keys_t should be handled here
-    if (opt == command_options_keys_t.id)
-        {
-            options.id = value;
-        }
-    else if (opt == command_options_keys_t.command)
+    for (uint8_t k = CMD_KEY_COMMAND; k < CMD_KEY_MAX; k++)
         {
-            options.command = value;
-        }
-    else if (opt == command_options_keys_t.file_path)
-        {
-            options.file_path = value;
-        }
-    else if (opt == command_options_keys_t.debug)
-        {
-            options.debug = value == "1";
-        }
-    else if (opt == command_options_keys_t.guild_id)
-        {
-            options.guild_id = value;
-        }
-    else if (opt == command_options_keys_t.ready)
-        {
-            options.ready = atoi (value.c_str ());
-        }
-    else if (opt == command_options_keys_t.seek)
-        {
-            options.seek = value;
-        }
-    else if (opt == command_options_keys_t.volume)
-        {
-            options.volume = atoi (value.c_str ());
+            const command_key_t key = (command_key_t)k;
+
+            if (opt != get_key_name (key))
+                continue;
+
+            switch (get_key_type (key))
+                {
+                case CMD_VALUE_INT:
+                    set_int_option (options, key, atoll (value.c_str ()));
+                    break;
+                case CMD_VALUE_DOUBLE:
+                    set_double_option (options, key, atof (value.c_str ()));
+                    break;
+                default:
+                    set_str_option (options, key, value.data (),
+                                    value.size ());
+                    break;
+                }
+
+            break;
         }
-    else if (opt == command_options_keys_t.helper_chain)
+
+    return 0;
+}
+
+static inline void
+store_le (uint8_t *dst, uint64_t value, const size_t size)
+{
+    for (size_t i = 0; i < size; i++)
         {
-            options.helper_chain += '@' + value + '@';
+            dst[i] = value & 0xff;
+            value >>= 8;
         }
-    else if (opt == command_options_keys_t.force)
+}
+
+static inline uint64_t
+load_le (const uint8_t *src, const size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t i = size; i > 0; i--)
+        value = (value << 8) | src[i - 1];
+
+    return value;
+}
+
+// binary frame size prefix
+inline constexpr size_t frame_header_size = 4;
+// key, type and value size
+inline constexpr size_t field_header_size = 4;
+
+command_t
+create_command ()
+{
+    command_t cmd;
+
+#ifndef MUSICAT_TEXT_COMMAND
+    cmd.frame.assign (frame_header_size, '\0');
+#endif
+
+    return cmd;
+}
+
+inline constexpr const char *aofmt
+    = "[child::command::add_option ERROR] Value of key %d too big, "
+      "dropping it: %ld\n";
+
+#ifndef MUSICAT_TEXT_COMMAND
+static void
+append_field (command_t &cmd, const command_key_t key,
+              const command_value_type_t type, const void *value,
+              const size_t size)
+{
+    if (size > UINT16_MAX)
         {
-            options.force = value == "1";
+            fprintf (stderr, aofmt, key, size);
+            return;
         }
 
-    return 0;
+    uint8_t header[field_header_size] = { key, type };
+    store_le (header + 2, size, 2);
+
+    cmd.frame.append ((const char *)header, field_header_size);
+    cmd.frame.append ((const char *)value, size);
+
+    // keep frame writable as is
+    store_le ((uint8_t *)cmd.frame.data (),
+              cmd.frame.size () - frame_header_size, frame_header_size);
 }
+#endif
 
 void
-command_queue_routine ()
+add_str_option (command_t &cmd, const command_key_t key,
+                const std::string &value)
 {
-    std::lock_guard<std::mutex> lk (command_mutex);
+#ifdef MUSICAT_TEXT_COMMAND
+    cmd.frame += get_key_name (key) + '=' + sanitize_command_value (value)
+                 + ';';
+#else
+    append_field (cmd, key, CMD_VALUE_STR, value.data (), value.size ());
+#endif
+}
 
-    auto i = command_queue.begin ();
-    while (i != command_queue.end ())
-        {
-            write_command (*i);
+void
+add_int_option (command_t &cmd, const command_key_t key,
+                const int64_t value)
+{
+#ifdef MUSICAT_TEXT_COMMAND
+    cmd.frame += get_key_name (key) + '=' + std::to_string (value) + ';';
+#else
+    uint8_t buf[8];
+    store_le (buf, (uint64_t)value, sizeof (buf));
+
+    append_field (cmd, key, CMD_VALUE_INT, buf, sizeof (buf));
+#endif
+}
 
-            // !TODO: read for status and write it to main parent
+void
+add_double_option (command_t &cmd, const command_key_t key,
+                   const double value)
+{
+#ifdef MUSICAT_TEXT_COMMAND
+    cmd.frame += get_key_name (key) + '=' + std::to_string (value) + ';';
+#else
+    uint64_t bits;
+    memcpy (&bits, &value, sizeof (bits));
 
-            i = command_queue.erase (i);
-        }
+    uint8_t buf[8];
+    store_le (buf, bits, sizeof (buf));
+
+    append_field (cmd, key, CMD_VALUE_DOUBLE, buf, sizeof (buf));
+#endif
+}
+
+void
+command_queue_routine (const size_t worker)
+{
+    worker_queue_t *q = worker_queues.at (worker);
+
+    std::deque<command_t> commands;
+    {
+        std::lock_guard<std::mutex> lk (q->m);
+        commands.swap (q->commands);
+    }
+
+    // a worker slow to read only holds back its own guilds
+    for (const command_t &cmd : commands)
+        write_command (cmd, *get_parent_write_fd (worker));
 }
 
 void
-wait_for_command ()
+wait_for_command (const size_t worker)
 {
-    std::unique_lock<std::mutex> ulk (command_mutex);
+    worker_queue_t *q = worker_queues.at (worker);
 
-    command_cv.wait (ulk, [] () {
-        return (command_queue.size () > 0) || !get_running_state ();
+    std::unique_lock<std::mutex> ulk (q->m);
+
+    q->cv.wait (ulk, [q] () {
+        return (q->commands.size () > 0) || !get_running_state ();
     });
 }
 
 void
-handle_child_message (command_options_t &options)
+handle_child_message (command_options_t &options, const int *fds,
+                      const size_t fd_count)
 {
     if (options.command == command_options_keys_t.ready)
         {
-            mark_slave_ready (options.id, options.ready);
+            mark_slave_ready (options.id, options.ready, fds, fd_count);
+            return;
         }
+
+    // nobody to take them
+    for (size_t i = 0; i < fd_count; i++)
+        close (fds[i]);
 }
 
 void
 run_command_thread ()
 {
-    std::thread command_thread ([] () {
-        thread_manager::DoneSetter tmds;
+    const size_t count = get_worker_count ();
 
-        while (get_running_state ())
-            {
-                command_queue_routine ();
-                wait_for_command ();
-            }
-    });
-
-    // !TODO: create a thread to read from worker
-    // and do stuff like notify cv
-    std::thread notify_thread ([] () {
-        thread_manager::DoneSetter tmds;
+    for (size_t i = 0; i < count; i++)
+        worker_queues.push_back (new worker_queue_t ());
 
-        char read_buf[CMD_BUFSIZE + 1];
-        size_t read_size = 0;
+    for (size_t i = 0; i < count; i++)
+        {
+            std::thread command_thread ([i] () {
+                thread_manager::DoneSetter tmds;
 
-        while (get_running_state ()
-               && ((read_size
-                    = read (*get_parent_read_fd (), read_buf, CMD_BUFSIZE))
-                   > 0))
-            {
-                read_buf[CMD_BUFSIZE] = '\0';
+                while (get_running_state ())
+                    {
+                        command_queue_routine (i);
+                        wait_for_command (i);
+                    }
+            });
 
-                fprintf (stderr,
-                         "[child::command] Received "
-                         "notification: %s\n",
-                         read_buf);
+            std::thread notify_thread ([i] () {
+                thread_manager::DoneSetter tmds;
 
-                std::string read_str (read_buf);
+                const int read_fd = *get_parent_read_fd (i);
 
                 command_options_t options = create_command_options ();
-                parse_command_to_options (read_str, options);
-
-                // !TODO: handle options
-                handle_child_message (options);
-            }
-    });
-
-    thread_manager::dispatch (command_thread);
-    thread_manager::dispatch (notify_thread);
+                int fds[CMD_MAX_FDS];
+                size_t fd_count = 0;
+
+                while (get_running_state ()
+                       && read_command_fds (read_fd, options, fds, &fd_count)
+                              == 1)
+                    {
+                        fprintf (stderr,
+                                 "[child::command] Received "
+                                 "notification from worker %ld: %s %s %d\n",
+                                 i, options.command.c_str (),
+                                 options.id.c_str (), options.ready);
+
+                        // !TODO: handle options
+                        handle_child_message (options, fds, fd_count);
+
+                        options = create_command_options ();
+                    }
+            });
+
+            thread_manager::dispatch (command_thread);
+            thread_manager::dispatch (notify_thread);
+        }
 }
 
 int
-send_command (const std::string &cmd)
+send_command (const command_t &cmd, const uint64_t guild_id)
 {
+    if (worker_queues.empty ())
+        return ERR_CWORKER;
+
+    worker_queue_t *q = worker_queues[get_guild_worker (guild_id)];
+
     {
-        std::lock_guard<std::mutex> lk (command_mutex);
+        std::lock_guard<std::mutex> lk (q->m);
 
-        command_queue.push_back (cmd);
+        q->commands.push_back (cmd);
     }
 
-    wake ();
+    q->cv.notify_all ();
 
     return SUCCESS;
 }
@@ -202,7 +438,12 @@ send_command (const std::string &cmd)
 void
 wake ()
 {
-    command_cv.notify_all ();
+    for (worker_queue_t *q : worker_queues)
+        {
+            // waiter is either before its predicate check or waiting
+            std::lock_guard<std::mutex> lk (q->m);
+            q->cv.notify_all ();
+        }
 }
 
 inline constexpr const char *wcwffmt
@@ -213,8 +454,54 @@ inline constexpr const char *wccfmt
 inline constexpr const char *wccfmt2
     = "[%s child::command::write_command ERROR] Dropping command: %s\n";
 
+inline constexpr const char *wcwefmt
+    = "[%s child::command::write_command ERROR] Write failed: %s\n";
+
+inline constexpr const char *wcfcfmt
+    = "[%s child::command::write_command ERROR] Too many fds: %ld > %d\n";
+
+// sendmsg with fds attached to the first byte, returns bytes sent
+static ssize_t
+send_fds (const int fd, const char *data, const size_t size, const int *fds,
+          const size_t fd_count)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE (sizeof (int) * CMD_MAX_FDS)];
+    } control;
+    memset (&control, 0, sizeof (control));
+
+    struct msghdr msg;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE (sizeof (int) * fd_count);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int) * fd_count);
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * fd_count);
+
+    return sendmsg (fd, &msg, MSG_NOSIGNAL);
+}
+
 void
-write_command (const std::string &cmd, const int write_fd, const char *caller)
+write_command (const command_t &cmd, const int write_fd, const char *caller)
+{
+    write_command_fds (cmd, nullptr, 0, write_fd, caller);
+}
+
+void
+write_command_fds (const command_t &cmd, const int *fds,
+                   const size_t fd_count, const int write_fd,
+                   const char *caller)
 {
     if (write_fd < 0)
         {
@@ -222,18 +509,263 @@ write_command (const std::string &cmd, const int write_fd, const char *caller)
             return;
         }
 
-    const size_t cmd_size = cmd.size ();
+    if (fd_count > CMD_MAX_FDS)
+        {
+            fprintf (stderr, wcfcfmt, caller, fd_count, CMD_MAX_FDS);
+            return;
+        }
+
+#ifdef MUSICAT_TEXT_COMMAND
+    const size_t cmd_size = cmd.frame.size ();
     if (cmd_size > CMD_BUFSIZE)
         {
             fprintf (stderr, wccfmt, caller, cmd_size, CMD_BUFSIZE);
-            fprintf (stderr, wccfmt2, caller, cmd.c_str ());
+            fprintf (stderr, wccfmt2, caller, cmd.frame.c_str ());
             return;
         }
 
-    std::string cpy (cmd);
+    std::string cpy (cmd.frame);
     cpy.resize (CMD_BUFSIZE, '\0');
+#else
+    const size_t cmd_size = cmd.frame.size () - frame_header_size;
+    if (cmd_size > CMD_MAX_PAYLOAD_SIZE)
+        {
+            fprintf (stderr, wccfmt, caller, cmd_size, CMD_MAX_PAYLOAD_SIZE);
+            return;
+        }
+
+    const std::string &cpy = cmd.frame;
+#endif
+
+    // whole frame or the reader loses track of the next one
+    size_t written = 0;
+    while (written < cpy.size ())
+        {
+            // fds go with the first byte
+            const ssize_t n
+                = (fd_count && !written)
+                      ? send_fds (write_fd, cpy.data (), cpy.size (), fds,
+                                  fd_count)
+                      : write (write_fd, cpy.data () + written,
+                               cpy.size () - written);
+
+            if (n == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    fprintf (stderr, wcwefmt, caller, strerror (errno));
+                    return;
+                }
+
+            written += n;
+        }
+}
+
+// recvmsg taking fds attached to the data, fds that don't fit are closed
+static ssize_t
+recv_fds (const int fd, uint8_t *buf, const size_t size, int *fds,
+          size_t *fd_count)
+{
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = size;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE (sizeof (int) * CMD_MAX_FDS)];
+    } control;
+
+    struct msghdr msg;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+
+    const ssize_t n = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+        return n;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+         cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET
+                || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+
+            const size_t count
+                = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+
+            for (size_t i = 0; i < count; i++)
+                {
+                    int rfd;
+                    memcpy (&rfd, CMSG_DATA (cmsg) + (i * sizeof (int)),
+                            sizeof (int));
+
+                    if (*fd_count < CMD_MAX_FDS)
+                        fds[(*fd_count)++] = rfd;
+                    else
+                        close (rfd);
+                }
+        }
+
+    return n;
+}
+
+// returns 1 when size is read, 0 on end of file before anything is read,
+// -1 on error or end of file in the middle. fds are taken from the first
+// read when provided
+static int
+read_full (const int fd, uint8_t *buf, const size_t size, int *fds = nullptr,
+           size_t *fd_count = nullptr)
+{
+    size_t total = 0;
+
+    while (total < size)
+        {
+            const ssize_t n
+                = fds ? recv_fds (fd, buf + total, size - total, fds, fd_count)
+                      : read (fd, buf + total, size - total);
+
+            if (n == 0)
+                return total ? -1 : 0;
+
+            if (n > 0)
+                {
+                    total += n;
+                    fds = nullptr;
+                    continue;
+                }
+
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN)
+                return -1;
+
+            // rest of the frame is on its way
+            struct pollfd pfds[1] = { { fd, POLLIN, 0 } };
+            poll (pfds, 1, -1);
+        }
+
+    return 1;
+}
+
+inline constexpr const char *rcfmt
+    = "[%s child::command::read_command ERROR] Invalid frame of size %ld\n";
+
+int
+read_command (const int fd, command_options_t &options, const char *caller)
+{
+    return read_command_fds (fd, options, nullptr, nullptr, caller);
+}
 
-    write (write_fd, cpy.c_str (), CMD_BUFSIZE);
+int
+read_command_fds (const int fd, command_options_t &options, int *fds,
+                  size_t *fd_count, const char *caller)
+{
+    if (fd_count)
+        *fd_count = 0;
+
+#ifdef MUSICAT_TEXT_COMMAND
+    char buf[CMD_BUFSIZE + 1];
+
+    const int status
+        = read_full (fd, (uint8_t *)buf, CMD_BUFSIZE, fds, fd_count);
+    if (status != 1)
+        return status;
+
+    buf[CMD_BUFSIZE] = '\0';
+
+    parse_command_to_options (buf, options);
+
+    return 1;
+#else
+    uint8_t header[frame_header_size];
+
+    int status = read_full (fd, header, frame_header_size, fds, fd_count);
+    if (status != 1)
+        return status;
+
+    const size_t size = load_le (header, frame_header_size);
+
+    // can't find the next frame after a bogus size
+    if (size > CMD_MAX_PAYLOAD_SIZE)
+        {
+            fprintf (stderr, rcfmt, caller, size);
+            return -1;
+        }
+
+    uint8_t payload[CMD_MAX_PAYLOAD_SIZE];
+
+    status = read_full (fd, payload, size);
+    if (status != 1)
+        return -1;
+
+    if (parse_command_payload (payload, size, options) != 0)
+        fprintf (stderr, rcfmt, caller, size);
+
+    return 1;
+#endif
+}
+
+int
+parse_command_payload (const uint8_t *payload, const size_t size,
+                       command_options_t &options)
+{
+    size_t pos = 0;
+
+    while (pos < size)
+        {
+            if (size - pos < field_header_size)
+                return -1;
+
+            const command_key_t key = (command_key_t)payload[pos];
+            const command_value_type_t type
+                = (command_value_type_t)payload[pos + 1];
+            const size_t value_size = load_le (payload + pos + 2, 2);
+
+            pos += field_header_size;
+
+            if (size - pos < value_size)
+                return -1;
+
+            const uint8_t *value = payload + pos;
+            pos += value_size;
+
+            // unknown or mismatched field from a different build, skip it
+            if (key < CMD_KEY_COMMAND || key >= CMD_KEY_MAX
+                || type != get_key_type (key))
+                continue;
+
+            switch (type)
+                {
+                case CMD_VALUE_INT:
+                    if (value_size == 8)
+                        set_int_option (options, key,
+                                        (int64_t)load_le (value, 8));
+                    break;
+                case CMD_VALUE_DOUBLE:
+                    if (value_size == 8)
+                        {
+                            const uint64_t bits = load_le (value, 8);
+
+                            double d;
+                            memcpy (&d, &bits, sizeof (d));
+
+                            set_double_option (options, key, d);
+                        }
+                    break;
+                default:
+                    set_str_option (options, key, (const char *)value,
+                                    value_size);
+                    break;
+                }
+        }
+
+    return 0;
 }
 
 static const std::string to_sanitize_command_value ("\\=;");
@@ -339,7 +871,7 @@ parse_command_to_options (const std::string &cmd, command_options_t &options)
 }
 
 int
-wait_slave_ready (std::string &id, const int timeout)
+wait_slave_ready (const std::string &id, const int timeout)
 {
     {
         std::lock_guard<std::mutex> lk (sr_m);
@@ -383,11 +915,26 @@ wait_slave_ready (std::string &id, const int timeout)
 }
 
 int
-mark_slave_ready (std::string &id, const int status)
+mark_slave_ready (std::string &id, const int status, const int *fds,
+                  const size_t fd_count)
 {
     {
         std::lock_guard<std::mutex> lk (sr_m);
         slave_ready_queue.insert_or_assign (id, std::make_pair (true, status));
+
+        // previous ones were never taken
+        auto i = slave_fds.find (id);
+        if (i != slave_fds.end ())
+            {
+                for (int fd : i->second)
+                    close (fd);
+
+                slave_fds.erase (i);
+            }
+
+        if (fd_count)
+            slave_fds.insert (
+                std::make_pair (id, std::vector<int> (fds, fds + fd_count)));
     }
 
     sr_cv.notify_all ();
@@ -395,6 +942,29 @@ mark_slave_ready (std::string &id, const int status)
     return 0;
 }
 
+size_t
+take_slave_fds (const std::string &id, int *fds, const size_t max_fds)
+{
+    std::lock_guard<std::mutex> lk (sr_m);
+
+    auto i = slave_fds.find (id);
+    if (i == slave_fds.end ())
+        return 0;
+
+    size_t count = 0;
+    for (int fd : i->second)
+        {
+            if (count < max_fds)
+                fds[count++] = fd;
+            else
+                close (fd);
+        }
+
+    slave_fds.erase (i);
+
+    return count;
+}
+
 } // command
 } // child
 } // musicat
@@ -1,3 +1,4 @@
+#include "musicat/child/slave_manager.h"
 #include "musicat/child/worker.h"
 #include "musicat/child/worker_management.h"
 #include "musicat/musicat.h"
@@ -14,6 +15,9 @@ namespace slave_manager
 
 std::map<std::string, command::command_options_t> slave_list;
 
+// shut down slaves not reaped yet, pid to id
+std::map<pid_t, std::string> exiting_list;
+
 int
 insert_slave (command::command_options_t &options)
 {
@@ -152,6 +156,61 @@ clean_up (std::string &id)
     return 0;
 }
 
+int
+retire (std::string &id, bool force_kill)
+{
+    auto i = slave_list.find (id);
+    if (i == slave_list.end ())
+        {
+            return 1;
+        }
+
+    shutdown_routine (i->second);
+
+    if (force_kill)
+        {
+            fprintf (stderr, wrfkfmt, i->second.pid, id.c_str ());
+
+            kill (i->second.pid, SIGKILL);
+        }
+
+    clean_up_routine (i->second);
+
+    if (i->second.pid > 0)
+        exiting_list.insert (std::make_pair (i->second.pid, id));
+
+    slave_list.erase (i);
+
+    // usually not exited yet, reaped once SIGCHLD arrives
+    reap_exited ();
+
+    return 0;
+}
+
+int
+reap_exited ()
+{
+    int reaped = 0;
+
+    auto i = exiting_list.begin ();
+    while (i != exiting_list.end ())
+        {
+            int status = 0;
+            if (waitpid (i->first, &status, WNOHANG) == 0)
+                {
+                    i++;
+                    continue;
+                }
+
+            fprintf (stderr, wrefmt, i->second.c_str (), i->first, status);
+
+            i = exiting_list.erase (i);
+            reaped++;
+        }
+
+    return reaped;
+}
+
 int
 shutdown_all ()
 {
@@ -177,6 +236,18 @@ wait_all ()
             i++;
         }
 
+    // already shut down, their pipes are closed
+    auto ei = exiting_list.begin ();
+    while (ei != exiting_list.end ())
+        {
+            int status = 0;
+            waitpid (ei->first, &status, 0);
+
+            fprintf (stderr, wrefmt, ei->second.c_str (), ei->first, status);
+
+            ei = exiting_list.erase (ei);
+        }
+
     return 0;
 }
 
@@ -6,10 +6,15 @@
 #include "musicat/musicat.h"
 #include <condition_variable>
 #include <deque>
+#include <errno.h>
+#include <fcntl.h>
 #include <map>
+#include <poll.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -24,13 +29,21 @@ namespace worker
 static int read_fd = -1;
 static int write_fd = -1;
 
+// SIGCHLD of retired slaves, blocked while worker runs
+static int sig_fd = -1;
+static sigset_t orig_sigmask;
+
 int
 execute (command::command_options_t &options)
 {
     int status = 0;
 
     auto slave_info = slave_manager::get_slave (options.id);
-    std::string ready_msg (command::command_options_keys_t.ready);
+    command::command_t ready_msg = command::create_command ();
+
+    // main process ends of slave pipes, sent with ready status
+    int fds[CMD_MAX_FDS];
+    size_t fd_count = 0;
 
     if (slave_info.first == 0 && slave_info.second.command == options.command)
         {
@@ -46,16 +59,16 @@ execute (command::command_options_t &options)
     if (options.command
         == command::command_execute_commands_t.create_audio_processor)
         {
-            status = worker_command::create_audio_processor (options);
+            status = worker_command::create_audio_processor (options, fds,
+                                                             &fd_count);
         }
     else if (options.command == command::command_execute_commands_t.shutdown)
         {
             if (slave_info.first != 0)
                 return slave_info.first;
 
-            slave_manager::shutdown (options.id);
-            slave_manager::wait (options.id, options.force);
-            slave_manager::clean_up (options.id);
+            // reaped later, other commands don't wait for it to exit
+            slave_manager::retire (options.id, options.force);
 
             return 0;
         }
@@ -66,25 +79,19 @@ execute (command::command_options_t &options)
         }
 
 ret:
-    ready_msg += '=' + std::to_string (status) + ';'
-                 + command::command_options_keys_t.id + '=' + options.id + ';'
-                 + command::command_options_keys_t.command + '='
-                 + command::command_options_keys_t.ready + ';';
+    command::add_int_option (ready_msg, command::CMD_KEY_READY, status);
+    command::add_str_option (ready_msg, command::CMD_KEY_ID, options.id);
+    command::add_str_option (ready_msg, command::CMD_KEY_COMMAND,
+                             command::command_options_keys_t.ready);
 
-    command::write_command (ready_msg, write_fd, "child::worker::execute");
-
-    return status;
-}
-
-int
-handle_command (std::string cmd)
-{
-    command::command_options_t options = command::create_command_options ();
-    parse_command_to_options (cmd, options);
+    command::write_command_fds (ready_msg, fds, fd_count, write_fd,
+                                "child::worker::execute");
 
-    execute (options);
+    // slave must see main process closing them, not keep them open here
+    for (size_t i = 0; i < fd_count; i++)
+        close (fds[i]);
 
-    return 0;
+    return status;
 }
 
 void
@@ -105,25 +112,75 @@ void
 handle_worker_fork ()
 {
     close_fds ();
+    close_valid_fd (&sig_fd);
+    sigprocmask (SIG_SETMASK, &orig_sigmask, NULL);
+
     slave_manager::handle_worker_fork ();
 }
 
+static void
+drain_sig_fd ()
+{
+    struct signalfd_siginfo si;
+    while (read (sig_fd, &si, sizeof (si)) > 0)
+        ;
+
+    slave_manager::reap_exited ();
+}
+
 void
 run ()
 {
-    char cmd[CMD_BUFSIZE + 1];
+    command::command_options_t options = command::create_command_options ();
+
+    sigset_t chld_mask;
+    sigemptyset (&chld_mask);
+    sigaddset (&chld_mask, SIGCHLD);
+
+    if (sigprocmask (SIG_BLOCK, &chld_mask, &orig_sigmask) == 0)
+        sig_fd = signalfd (-1, &chld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    // retired slaves are only reaped on exit without it
+    if (sig_fd == -1)
+        perror ("[child::worker ERROR] signalfd");
+
+    struct pollfd pfds[2] = { { read_fd, POLLIN, 0 }, { sig_fd, POLLIN, 0 } };
 
     // main_loop
-    size_t read_size = 0;
-    while ((read_size = read (read_fd, cmd, CMD_BUFSIZE)) > 0)
+    int read_status = 1;
+    while (read_status == 1)
         {
-            cmd[CMD_BUFSIZE] = '\n';
-            fprintf (stderr, "[child::worker] Received command: `%s`\n", cmd);
+            if (poll (pfds, 2, -1) == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    read_status = -1;
+                    break;
+                }
+
+            if (pfds[1].revents & POLLIN)
+                drain_sig_fd ();
+
+            if (!pfds[0].revents)
+                continue;
+
+            read_status
+                = command::read_command (read_fd, options, "child::worker");
+
+            if (read_status != 1)
+                break;
+
+            fprintf (stderr, "[child::worker] Received command: `%s` %s\n",
+                     options.command.c_str (), options.id.c_str ());
+
+            execute (options);
 
-            handle_command (cmd);
+            options = command::create_command_options ();
         }
 
     close (read_fd);
+    close_valid_fd (&sig_fd);
 
     slave_manager::shutdown_all ();
     slave_manager::wait_all ();
@@ -133,11 +190,11 @@ run ()
 
     close (write_fd);
 
-    if (read_size < 0)
+    if (read_status < 0)
         {
             fprintf (stderr, "[child::worker ERROR] Error reading command\n");
             perror ("child::worker main_loop");
-            _exit (read_size);
+            _exit (EXIT_FAILURE);
         }
 
     _exit (SUCCESS);
@@ -147,7 +204,7 @@ std::pair<int, int>
 create_pipe ()
 {
     int fds[2];
-    if (pipe (fds) == -1)
+    if (pipe2 (fds, O_CLOEXEC) == -1)
         {
             perror ("create_pipe");
 
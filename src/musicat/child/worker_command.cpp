@@ -1,8 +1,11 @@
+#include "musicat/child/worker_command.h"
 #include "musicat/audio_processing.h"
+#include "musicat/audio_ring.h"
 #include "musicat/child.h"
 #include "musicat/child/slave_manager.h"
 #include "musicat/child/worker.h"
-#include <sys/stat.h>
+#include "musicat/musicat.h"
+#include <stdlib.h>
 #include <unistd.h>
 
 namespace musicat
@@ -13,93 +16,98 @@ namespace worker_command
 {
 
 int
-create_audio_processor (command::command_options_t &options)
+create_audio_processor (command::command_options_t &options,
+                        int *parent_fds, size_t *fd_count)
 {
-    std::pair<int, int> pipe_fds = worker::create_pipe ();
-    pid_t status = -1;
-
-    if (pipe_fds.first == -1)
-        {
-            return status;
-        }
-    int read_fd = pipe_fds.first;
-    int write_fd = pipe_fds.second;
-
-    // !TODO: create fifos here
-    std::string as_fp
-        = audio_processing::get_audio_stream_fifo_path (options.id);
+    *fd_count = 0;
 
-    std::string si_fp
-        = audio_processing::get_audio_stream_stdin_path (options.id);
-
-    std::string so_fp
-        = audio_processing::get_audio_stream_stdout_path (options.id);
+    pid_t status = -1;
 
-    unlink (as_fp.c_str ());
-    unlink (si_fp.c_str ());
-    unlink (so_fp.c_str ());
+    // read end first, processor reads commands and writes the rest
+    std::pair<int, int> cmd_fds = { -1, -1 }, notify_fds = { -1, -1 },
+                        stream_fds = { -1, -1 };
 
-    const auto fifo_bitmask
-        = audio_processing::get_audio_stream_fifo_mode_t ();
+    cmd_fds = worker::create_pipe ();
+    if (cmd_fds.first == -1)
+        return status;
 
-    if ((status = mkfifo (as_fp.c_str (), fifo_bitmask)) < 0)
-        {
-            perror ("cap as_fp");
-            goto err1;
-        }
+    notify_fds = worker::create_pipe ();
+    if (notify_fds.first == -1)
+        goto err1;
 
-    if ((status = mkfifo (si_fp.c_str (), fifo_bitmask)) < 0)
+#ifdef MUSICAT_USE_SHM_RING
+    // audio stream goes through shared memory instead
+    if ((status = audio_ring::create_ring (options.id)) < 0)
         {
-            perror ("cap si_fp");
+            fprintf (stderr, "[worker_command::create_audio_processor ERROR] "
+                             "Failed creating audio ring\n");
             goto err2;
         }
-
-    if ((status = mkfifo (so_fp.c_str (), fifo_bitmask)) < 0)
-        {
-            perror ("cap so_fp");
-            goto err3;
-        }
-
-    options.audio_stream_fifo_path = as_fp;
-    options.audio_stream_stdin_path = si_fp;
-    options.audio_stream_stdout_path = so_fp;
+#else
+    stream_fds = worker::create_pipe ();
+    if (stream_fds.first == -1)
+        goto err2;
+#endif
 
     status = fork ();
 
     if (status < 0)
         {
             perror ("cap fork");
-            goto err4;
+            goto err3;
         }
 
     if (status == 0)
         {
             worker::handle_worker_fork ();
 
-            close (read_fd);
+            // command comes through stdin and notification goes to stdout
+            if (dup2 (cmd_fds.first, STDIN_FILENO) == -1
+                || dup2 (notify_fds.second, STDOUT_FILENO) == -1)
+                {
+                    perror ("cap dup2");
+                    _exit (EXIT_FAILURE);
+                }
+
+            close (cmd_fds.first);
+            close (cmd_fds.second);
+            close (notify_fds.first);
+            close (notify_fds.second);
+            close_valid_fd (&stream_fds.first);
 
-            options.child_write_fd = write_fd;
+            options.child_write_fd = stream_fds.second;
 
             status = audio_processing::run_processor (options);
             _exit (status);
         }
 
-    close (write_fd);
+    close (cmd_fds.first);
+    close (notify_fds.second);
+    close_valid_fd (&stream_fds.second);
 
     options.pid = status;
-    options.parent_read_fd = read_fd;
+
+    parent_fds[PROCESSOR_FD_COMMAND] = cmd_fds.second;
+    parent_fds[PROCESSOR_FD_NOTIFICATION] = notify_fds.first;
+    *fd_count = PROCESSOR_FD_NOTIFICATION + 1;
+
+    if (stream_fds.first != -1)
+        parent_fds[(*fd_count)++] = stream_fds.first;
 
     return 0;
 
-err4:
-    unlink (so_fp.c_str ());
 err3:
-    unlink (si_fp.c_str ());
+    close_valid_fd (&stream_fds.first);
+    close_valid_fd (&stream_fds.second);
+#ifdef MUSICAT_USE_SHM_RING
+    audio_ring::unlink_ring (options.id);
+#endif
 err2:
-    unlink (as_fp.c_str ());
+    close (notify_fds.first);
+    close (notify_fds.second);
 err1:
-    close (read_fd);
-    close (write_fd);
+    close (cmd_fds.first);
+    close (cmd_fds.second);
     return status;
 }
 
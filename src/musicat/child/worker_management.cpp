@@ -1,4 +1,7 @@
+#include "musicat/audio_ring.h"
 #include "musicat/child/command.h"
+#include "musicat/config.h"
+#include "musicat/musicat.h"
 #include <unistd.h>
 
 namespace musicat
@@ -11,14 +14,9 @@ namespace worker_management
 int
 shutdown_audio_processor (command::command_options_t &options)
 {
-    if (options.parent_read_fd > -1)
-        {
-            // close parent read fd now since processor
-            // mainly uses fifo and only have one pipe
-            // connected to parent
-            close (options.parent_read_fd);
-            options.parent_read_fd = -1;
-        }
+    // every processor pipe is owned by main process, processor exits
+    // once they're closed
+    close_valid_fd (&options.parent_read_fd);
 
     return 0;
 }
@@ -26,9 +24,9 @@ shutdown_audio_processor (command::command_options_t &options)
 int
 clean_up_audio_processor (command::command_options_t &options)
 {
-    unlink (options.audio_stream_fifo_path.c_str ());
-    unlink (options.audio_stream_stdin_path.c_str ());
-    unlink (options.audio_stream_stdout_path.c_str ());
+#ifdef MUSICAT_USE_SHM_RING
+    audio_ring::unlink_ring (options.id);
+#endif
 
     return 0;
 }
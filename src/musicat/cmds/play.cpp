@@ -5,6 +5,8 @@
 #include "musicat/musicat.h"
 #include "musicat/search-cache.h"
 #include "musicat/thread_manager.h"
+#include "musicat/track_cache.h"
+#include "musicat/track_catalog.h"
 #include "musicat/util.h"
 #include "yt-search/yt-playlist.h"
 #include "yt-search/yt-search.h"
@@ -27,17 +29,17 @@ query (const dpp::autocomplete_t &event, std::string param,
 
     std::vector<std::pair<std::string, std::string> > avail = {};
 
-    const bool no_len = param.empty ();
-
-    std::vector<std::string> get
-        = player_manager->get_available_tracks (no_len ? 25U : 0U);
-    avail.reserve (get.size ());
-
-    for (const std::string &i : get)
-        avail.push_back (std::make_pair (i, i));
+    if (param.empty ())
+        {
+            std::vector<std::string> get
+                = player_manager->get_available_tracks (25U);
+            avail.reserve (get.size ());
 
-    if (!no_len)
-        avail = musicat::autocomplete::filter_candidates (avail, param);
+            for (const std::string &i : get)
+                avail.push_back (std::make_pair (i, i));
+        }
+    else
+        avail = track_catalog::search (param, 25U);
 
     if (get_debug_state ())
         {
@@ -411,28 +413,21 @@ track_exist (const std::string &fname, const std::string &url,
     bool dling = false;
     int status = 0;
 
-    std::ifstream test (get_music_folder_path () + fname,
-                        std::ios_base::in | std::ios_base::binary);
-
-    if (!test.is_open ())
+    if (!track_cache::lookup (fname))
         {
             dling = true;
             if (from_interaction)
                 status = 1;
 
-            if (!no_download
-                && player_manager->waiting_file_download.find (fname)
-                       == player_manager->waiting_file_download.end ())
-                {
-                    player_manager->download (fname, url, guild_id);
-                }
-        }
-    else
-        {
-            test.close ();
-            if (from_interaction)
-                status = 1;
+            // only autoplay adds track without interaction
+            if (!no_download)
+                player_manager->download (
+                    fname, url,
+                    from_interaction ? download_manager::PRIORITY_NEXT
+                                     : download_manager::PRIORITY_PREFETCH);
         }
+    else if (from_interaction)
+        status = 1;
 
     return { dling, status };
 }
@@ -556,7 +551,7 @@ add_track (bool playlist, dpp::snowflake guild_id, std::string arg_query,
 
             if (dling)
                 {
-                    player_manager->wait_for_download (fname);
+                    player_manager->wait_for_playable (fname);
                     if (from_interaction)
                         event.edit_response (
                             util::response::reply_added_track (
@@ -69,7 +69,8 @@ _process_command (const dpp::interaction_create_t &event,
         }
 
     player::MCTrack current_track = guild_player->current_track;
-    player::track_progress prog = util::get_track_progress (current_track);
+    player::track_progress prog
+        = util::get_track_progress (current_track, &guild_player->clock);
 
     if (prog.status)
         return _create_processed_t ("`[ERROR]` Missing metadata");
@@ -302,7 +302,9 @@ slash_run (const dpp::slashcommand_t &event)
     // !TODO: probably add a mutex for safety just in case?
     player::MCTrack &track = player->current_track;
 
-    const uint64_t duration = track.info.duration ();
+    const uint64_t duration = track.index && track.index->duration_ms
+                                  ? track.index->duration_ms
+                                  : track.info.duration ();
 
     if (!duration || !track.filesize)
         {
@@ -332,7 +334,11 @@ slash_run (const dpp::slashcommand_t &event)
 
     float byte_per_ms = (float)track.filesize / (float)duration;
 
-    track.current_byte = (int64_t)(byte_per_ms * total_ms);
+    if (track.index && !track.index->entries.empty ())
+        track.current_byte
+            = track_index::ms_to_byte (*track.index, total_ms);
+    else
+        track.current_byte = (int64_t)(byte_per_ms * total_ms);
 
     if (debug)
         {
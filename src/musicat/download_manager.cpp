@@ -0,0 +1,560 @@
+#include "musicat/download_manager.h"
+#include "musicat/config.h"
+#include "musicat/loudness.h"
+#include "musicat/musicat.h"
+#include "musicat/spawn.h"
+#include "musicat/track_cache.h"
+#include "musicat/track_catalog.h"
+#include "musicat/track_index.h"
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace musicat
+{
+namespace download_manager
+{
+
+using steady_clock = std::chrono::steady_clock;
+using time_point_t = steady_clock::time_point;
+
+// how often running job is checked for exit and partial file size
+inline constexpr std::chrono::milliseconds job_poll_interval (100);
+
+struct job_t
+{
+    job_info_t info;
+    // backoff job isn't run before this
+    time_point_t not_before;
+    // running yt-dlp, -1 when not running
+    pid_t pid;
+    // enqueue order, jobs of the same priority run in order
+    uint64_t seq;
+};
+
+static std::map<std::string, job_t> jobs;
+static uint64_t next_seq = 0;
+static bool stopping = false;
+static std::mutex m; // jobs, next_seq, stopping
+// workers wait for runnable job
+static std::condition_variable job_cv;
+// waiters wait for their job to leave jobs
+static std::condition_variable done_cv;
+
+static std::vector<std::thread> workers;
+static std::once_flag workers_flag;
+
+static const char *
+get_state_name (const job_state_t state)
+{
+    switch (state)
+        {
+        case JOB_QUEUED:
+            return "queued";
+        case JOB_RUNNING:
+            return "running";
+        case JOB_BACKOFF:
+            return "backoff";
+        }
+
+    return "unknown";
+}
+
+// highest priority job that can run now, sets wake_at to the earliest time
+// a backoff job can run otherwise
+static job_t *
+take_next (const time_point_t &now, time_point_t &wake_at)
+{
+    job_t *next = nullptr;
+
+    for (auto &i : jobs)
+        {
+            job_t &job = i.second;
+
+            if (job.info.state == JOB_RUNNING)
+                continue;
+
+            if (job.info.state == JOB_BACKOFF && job.not_before > now)
+                {
+                    if (job.not_before < wake_at)
+                        wake_at = job.not_before;
+
+                    continue;
+                }
+
+            if (!next || job.info.priority < next->info.priority
+                || (job.info.priority == next->info.priority
+                    && job.seq < next->seq))
+                next = &job;
+        }
+
+    return next;
+}
+
+// wait for pid to exit, recording size of partial_path into job while it
+// runs. returns exit status or -1
+static int
+wait_job (job_t *job, const pid_t pid, const std::string &partial_path)
+{
+    {
+        std::lock_guard<std::mutex> lk (m);
+        job->pid = pid;
+
+        // shutdown started before pid was known
+        if (stopping)
+            kill (pid, SIGTERM);
+    }
+
+    int status = 0;
+    pid_t waited;
+    while ((waited = waitpid (pid, &status, WNOHANG)) == 0)
+        {
+            struct stat part_stat;
+            if (stat (partial_path.c_str (), &part_stat) == 0)
+                {
+                    std::lock_guard<std::mutex> lk (m);
+
+                    if (job->info.bytes != part_stat.st_size)
+                        {
+                            job->info.bytes = part_stat.st_size;
+
+                            // wait_playable waiters check size
+                            done_cv.notify_all ();
+                        }
+                }
+
+            std::this_thread::sleep_for (job_poll_interval);
+        }
+
+    {
+        std::lock_guard<std::mutex> lk (m);
+        job->pid = -1;
+    }
+
+    if (waited == -1)
+        {
+            perror ("[download_manager::wait_job ERROR] waitpid");
+            return -1;
+        }
+
+    if (!WIFEXITED (status))
+        return -1;
+
+    return WEXITSTATUS (status);
+}
+
+// stream of yt-dlp is webm, copy it into ogg opus container the rest of the
+// player reads. written to a temp file first so file_path only ever
+// appears complete
+static int
+remux_partial (job_t *job, const std::string &partial_path,
+               const std::string &file_path)
+{
+    const std::string tmp_path = file_path + ".tmp";
+
+    const char *argv[]
+        = { "ffmpeg", "-v",   "error", "-y", "-i", partial_path.c_str (),
+            "-vn",    "-c:a", "copy",  "-f", "opus", tmp_path.c_str (),
+            NULL };
+
+    const pid_t pid = spawn::spawn_process (argv, NULL, 0, false);
+    if (pid == -1)
+        return -1;
+
+    const int status = wait_job (job, pid, partial_path);
+
+    if (status == 0 && rename (tmp_path.c_str (), file_path.c_str ()) == 0)
+        return 0;
+
+    if (status == 0)
+        perror ("[download_manager::remux_partial ERROR] rename");
+
+    unlink (tmp_path.c_str ());
+
+    return status == 0 ? -1 : status;
+}
+
+// spawn yt-dlp writing to partial file and remux it once done, returns exit
+// status or -1. partial file is left for the caller to unlink. a retry
+// truncates the partial file of the failed attempt instead of replacing it
+// so followers keep their file
+static int
+run_job (job_t *job, const std::string &fname, const std::string &url)
+{
+    const std::string yt_dlp = get_ytdlp_exe ();
+    const std::string music_folder_path = get_music_folder_path ();
+    const std::string file_path = music_folder_path + fname;
+    const std::string partial_path = file_path + partial_file_suffix;
+
+    {
+        struct stat buf;
+        if (stat (music_folder_path.c_str (), &buf) != 0)
+            std::filesystem::create_directory (music_folder_path);
+    }
+
+    // no shell, url goes after -- so it's never parsed as an option. audio
+    // is written to stdout as it comes so it can be played while still
+    // downloading
+    const char *argv[] = { yt_dlp.c_str (),
+                           "-f",
+                           "251",
+                           "--http-chunk-size",
+                           "2M",
+                           "-o",
+                           "-",
+                           "--",
+                           url.c_str (),
+                           NULL };
+
+    // always log these to easily spot problem in prod
+    fprintf (stderr, "[download_manager] Download: \"%s\" \"%s\"\n",
+             fname.c_str (), url.c_str ());
+
+    int partial_fd = open (partial_path.c_str (),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (partial_fd == -1)
+        {
+            perror ("[download_manager::run_job ERROR] open");
+            return -1;
+        }
+
+    spawn::fd_map_t fds[1] = { { partial_fd, STDOUT_FILENO } };
+
+    const pid_t pid = spawn::spawn_process (argv, fds, 1, false);
+
+    close_valid_fd (&partial_fd);
+
+    if (pid == -1)
+        return -1;
+
+    const int status = wait_job (job, pid, partial_path);
+
+    if (status != 0)
+        return status;
+
+    struct stat part_stat;
+    if (stat (partial_path.c_str (), &part_stat) != 0
+        || part_stat.st_size == 0)
+        {
+            fprintf (stderr,
+                     "[download_manager::run_job ERROR] yt-dlp exited "
+                     "without writing '%s'\n",
+                     partial_path.c_str ());
+            return -1;
+        }
+
+    return remux_partial (job, partial_path, file_path);
+}
+
+// index before marking done so stream doesn't need to scan the file right
+// before playing
+static void
+index_track (const std::string &fname)
+{
+    track_index::track_index_t index;
+    const std::string file_path = get_music_folder_path () + fname;
+
+    if (track_index::build_index (file_path, index) != 0
+        || track_index::write_index (file_path, index) != 0)
+        fprintf (stderr,
+                 "[download_manager::index_track ERROR] Failed indexing "
+                 "'%s'\n",
+                 file_path.c_str ());
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+    else
+        loudness::analyze_track (file_path);
+#endif
+}
+
+static void
+run_worker ()
+{
+    std::unique_lock<std::mutex> lk (m);
+
+    while (!stopping)
+        {
+            time_point_t wake_at = time_point_t::max ();
+            job_t *job = take_next (steady_clock::now (), wake_at);
+
+            if (!job)
+                {
+                    if (wake_at == time_point_t::max ())
+                        job_cv.wait (lk);
+                    else
+                        job_cv.wait_until (lk, wake_at);
+
+                    continue;
+                }
+
+            job->info.state = JOB_RUNNING;
+            job->info.attempts++;
+            job->info.bytes = 0;
+
+            const std::string fname = job->info.fname;
+            const std::string url = job->info.url;
+
+            lk.unlock ();
+
+            const int status = run_job (job, fname, url);
+
+            if (status == 0)
+                {
+                    index_track (fname);
+
+                    // waiters find it right after it's marked done
+                    track_catalog::update (fname);
+                    track_cache::add (fname);
+                }
+
+            lk.lock ();
+
+            const bool retrying
+                = status != 0 && !stopping
+                  && job->info.attempts < DOWNLOAD_MAX_ATTEMPTS;
+
+            // ends anyone following it, file_path is in place by now when
+            // download succeeded. kept for a retry, followers read on once
+            // it rewrote what they already have
+            if (!retrying)
+                unlink (get_partial_path (fname).c_str ());
+
+            if (retrying)
+                {
+                    const auto backoff
+                        = std::chrono::milliseconds (DOWNLOAD_RETRY_BACKOFF_MS)
+                          * (1 << (job->info.attempts - 1));
+
+                    fprintf (stderr,
+                             "[download_manager ERROR] Download of '%s' "
+                             "failed with status %d, retrying in %ld ms\n",
+                             fname.c_str (), status, (long)backoff.count ());
+
+                    job->info.state = JOB_BACKOFF;
+                    job->not_before = steady_clock::now () + backoff;
+
+                    // other workers might be sleeping past this backoff
+                    job_cv.notify_all ();
+                    continue;
+                }
+
+            if (status != 0)
+                fprintf (stderr,
+                         "[download_manager ERROR] Giving up downloading "
+                         "'%s' after %d attempt(s)\n",
+                         fname.c_str (), job->info.attempts);
+
+            jobs.erase (fname);
+            done_cv.notify_all ();
+        }
+}
+
+static void
+start_workers ()
+{
+    const size_t count = DOWNLOAD_WORKER_COUNT ? DOWNLOAD_WORKER_COUNT : 1;
+
+    for (size_t i = 0; i < count; i++)
+        workers.emplace_back (run_worker);
+}
+
+int
+enqueue (const std::string &fname, const std::string &url,
+         const priority_t priority)
+{
+    if (get_ytdlp_exe ().empty ())
+        {
+            fprintf (stderr,
+                     "[download_manager::enqueue ERROR] yt-dlp executable "
+                     "isn't configured, unable to download track '%s'\n",
+                     fname.c_str ());
+
+            return -1;
+        }
+
+    // already downloaded
+    if (track_catalog::exists (fname))
+        return 0;
+
+    std::call_once (workers_flag, start_workers);
+
+    {
+        std::lock_guard<std::mutex> lk (m);
+
+        if (stopping)
+            return -1;
+
+        auto i = jobs.find (fname);
+        if (i != jobs.end ())
+            {
+                if (priority < i->second.info.priority)
+                    i->second.info.priority = priority;
+
+                return 0;
+            }
+
+        job_t job = { { fname, url, priority, JOB_QUEUED, 0, 0 },
+                      time_point_t (),
+                      -1,
+                      next_seq++ };
+
+        jobs.insert (std::make_pair (fname, job));
+    }
+
+    job_cv.notify_one ();
+
+    return 0;
+}
+
+void
+prioritize (const std::string &fname, const priority_t priority)
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    auto i = jobs.find (fname);
+    if (i != jobs.end () && priority < i->second.info.priority)
+        i->second.info.priority = priority;
+}
+
+bool
+is_pending (const std::string &fname)
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    return jobs.find (fname) != jobs.end ();
+}
+
+void
+wait (const std::string &fname)
+{
+    std::unique_lock<std::mutex> lk (m);
+
+    auto i = jobs.find (fname);
+    if (i == jobs.end ())
+        return;
+
+    // someone is blocked on it
+    if (i->second.info.priority > PRIORITY_PLAYING)
+        i->second.info.priority = PRIORITY_PLAYING;
+
+    done_cv.wait (lk, [&fname] () {
+        return stopping || jobs.find (fname) == jobs.end ();
+    });
+}
+
+int
+wait_playable (const std::string &fname, const int64_t min_bytes)
+{
+    if (min_bytes <= 0)
+        {
+            wait (fname);
+            return 0;
+        }
+
+    std::unique_lock<std::mutex> lk (m);
+
+    auto i = jobs.find (fname);
+    if (i == jobs.end ())
+        return 0;
+
+    if (i->second.info.priority > PRIORITY_PLAYING)
+        i->second.info.priority = PRIORITY_PLAYING;
+
+    int ret = 0;
+
+    done_cv.wait (lk, [&fname, min_bytes, &ret] () {
+        if (stopping)
+            return true;
+
+        auto i = jobs.find (fname);
+        if (i == jobs.end ())
+            return true;
+
+        // bytes is reset on retry, it's the size of the current attempt
+        ret = i->second.info.state == JOB_RUNNING
+              && i->second.info.bytes >= min_bytes;
+
+        return ret == 1;
+    });
+
+    return ret;
+}
+
+std::string
+get_partial_path (const std::string &fname)
+{
+    return get_music_folder_path () + fname + partial_file_suffix;
+}
+
+std::vector<job_info_t>
+get_jobs ()
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    std::vector<job_info_t> ret;
+    ret.reserve (jobs.size ());
+
+    for (const auto &i : jobs)
+        ret.push_back (i.second.info);
+
+    return ret;
+}
+
+void
+print_jobs ()
+{
+    const std::vector<job_info_t> job_list = get_jobs ();
+
+    fprintf (stderr, "[download_manager] %ld job(s)\n", job_list.size ());
+
+    for (const job_info_t &job : job_list)
+        fprintf (stderr,
+                 "  %-8s priority %d attempts %d bytes %ld '%s'\n",
+                 get_state_name (job.state), job.priority, job.attempts,
+                 job.bytes, job.fname.c_str ());
+}
+
+void
+shutdown ()
+{
+    // no worker is started after this
+    std::call_once (workers_flag, [] () {});
+
+    {
+        std::lock_guard<std::mutex> lk (m);
+        stopping = true;
+
+        for (auto &i : jobs)
+            {
+                if (i.second.pid > 0)
+                    kill (i.second.pid, SIGTERM);
+            }
+    }
+
+    job_cv.notify_all ();
+
+    for (std::thread &t : workers)
+        {
+            if (t.joinable ())
+                t.join ();
+        }
+
+    {
+        std::lock_guard<std::mutex> lk (m);
+        jobs.clear ();
+    }
+
+    done_cv.notify_all ();
+}
+
+} // download_manager
+} // musicat
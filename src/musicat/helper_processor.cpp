@@ -2,8 +2,10 @@
 #include "musicat/audio_processing.h"
 #include "musicat/child/worker.h"
 #include "musicat/musicat.h"
+#include "musicat/spawn.h"
+#include <errno.h>
+#include <stdio.h>
 #include <sys/poll.h>
-#include <sys/prctl.h>
 #include <sys/wait.h>
 
 namespace musicat
@@ -12,78 +14,35 @@ namespace helper_processor
 {
 std::deque<helper_chain_t> active_helpers = {};
 
-void
-close_all_helper_fds ()
-{
-    for (helper_chain_t &i : active_helpers)
-        {
-            close_valid_fd (&i.child_write_fd);
-            close_valid_fd (&i.child_read_fd);
-            close_valid_fd (&i.write_fd);
-            close_valid_fd (&i.read_fd);
-        }
-}
-
-void
-helper_main (helper_chain_t &options)
+// spawn ffmpeg running the helper effect with stdin and stdout connected
+// to child ends of the helper pipes, returns its pid or -1
+static pid_t
+spawn_helper (const helper_chain_t &options)
 {
-    // request kernel to kill little self when parent dies
-    if (prctl (PR_SET_PDEATHSIG, SIGTERM) == -1)
-        {
-            perror ("helper_processor::helper_main prctl");
-            _exit (EXIT_FAILURE);
-        }
-
-    int status;
-    status = dup2 (options.child_write_fd, STDOUT_FILENO);
-    close_valid_fd (&options.child_write_fd);
-    if (status == -1)
-        {
-            perror ("helper_processor::helper_main dout");
-            _exit (EXIT_FAILURE);
-        }
-
-    status = dup2 (options.child_read_fd, STDIN_FILENO);
-    close_valid_fd (&options.child_read_fd);
-    if (status == -1)
-        {
-            perror ("helper_processor::helper_main din");
-            _exit (EXIT_FAILURE);
-        }
-
-    // redirect ffmpeg stderr to /dev/null
-    if (!options.options.debug)
-        {
-            // redirect ffmpeg stderr to /dev/null
-            int dnull = open ("/dev/null", O_WRONLY);
-            dup2 (dnull, STDERR_FILENO);
-            close (dnull);
-        }
-
-    char *args[] = { "ffmpeg",
-                     "-v",
-                     "debug",
-                     "-f",
-                     "s16le",
-                     "-ac",
-                     "2",
-                     "-ar",
-                     "48000",
-                     "-i",
-                     "pipe:0",
-                     "-af",
-                     (char *)options.options.raw_args.c_str (),
-                     "-f",
-                     "s16le",
-                     "-ac",
-                     "2",
-                     "-ar",
-                     "48000",
-                     /*"-preset", "ultrafast",*/ "-threads",
-                     "1",
-                     "-nostdin",
-                     "pipe:1",
-                     (char *)NULL };
+    const char *args[] = { "ffmpeg",
+                           "-v",
+                           "debug",
+                           "-f",
+                           "s16le",
+                           "-ac",
+                           "2",
+                           "-ar",
+                           "48000",
+                           "-i",
+                           "pipe:0",
+                           "-af",
+                           options.options.raw_args.c_str (),
+                           "-f",
+                           "s16le",
+                           "-ac",
+                           "2",
+                           "-ar",
+                           "48000",
+                           /*"-preset", "ultrafast",*/ "-threads",
+                           "1",
+                           "-nostdin",
+                           "pipe:1",
+                           NULL };
 
     if (options.options.debug)
         for (unsigned long i = 0; i < (sizeof (args) / sizeof (args[0])); i++)
@@ -94,15 +53,29 @@ helper_main (helper_chain_t &options)
                 fprintf (stderr, "%s\n", args[i]);
             }
 
-    execvp ("ffmpeg", args);
+    const spawn::fd_map_t fds[]
+        = { { options.child_read_fd, STDIN_FILENO },
+            { options.child_write_fd, STDOUT_FILENO } };
+
+    return spawn::spawn_process (args, fds, sizeof (fds) / sizeof (fds[0]),
+                                 !options.options.debug);
+}
+
+// record spawn latency on the first output of a helper
+static void
+mark_output (helper_chain_t &hc)
+{
+    if (!hc.output_pending)
+        return;
 
-    perror ("helper_processor::helper_main exit");
-    _exit (EXIT_FAILURE);
+    spawn::record_first_byte (spawn::CHILD_HELPER_FFMPEG, hc.spawned_at);
+    hc.output_pending = false;
 }
 
+// create helper and put it at position in the chain
 int
 create_helper (const audio_processing::helper_chain_option_t &hco,
-               void (*on_fork) ())
+               size_t position)
 {
     helper_chain_t helper_process;
 
@@ -122,28 +95,16 @@ create_helper (const audio_processing::helper_chain_option_t &hco,
     helper_process.child_write_fd = fip.second;
     helper_process.child_read_fd = sep.first;
     helper_process.write_fd = sep.second;
+    helper_process.spawned_at = spawn::now ();
 
-    pid = fork ();
+    pid = spawn_helper (helper_process);
     if (pid == -1)
         {
             goto err3;
         }
 
     helper_process.pid = pid;
-
-    if (pid == 0)
-        {
-            // close parent fds
-            close (helper_process.write_fd);
-            close (helper_process.read_fd);
-            helper_process.write_fd = -1;
-            helper_process.read_fd = -1;
-
-            // close every unrelated fds
-            on_fork ();
-
-            helper_main (helper_process);
-        }
+    helper_process.output_pending = true;
 
     // close child fds
     close (helper_process.child_write_fd);
@@ -151,7 +112,8 @@ create_helper (const audio_processing::helper_chain_option_t &hco,
     helper_process.child_write_fd = -1;
     helper_process.child_read_fd = -1;
 
-    active_helpers.push_back (helper_process);
+    active_helpers.insert (active_helpers.begin () + position,
+                           helper_process);
 
     return 0;
 
@@ -225,6 +187,8 @@ handle_middle_chain (std::deque<helper_chain_t>::iterator hci)
         read_ready
         && ((buf_size = read (hci->read_fd, buf, PROCESSOR_BUFFER_SIZE)) > 0))
         {
+            mark_output (*hci);
+
             write (nhc.write_fd, buf, buf_size);
 
             read_ready
@@ -301,6 +265,109 @@ stop_first_chain (bool discard_output)
         }
 }
 
+// move whatever available from idx to the end of chain, last helper output
+// goes to stdout
+static void
+pump_from (size_t idx)
+{
+    const size_t current_chain_size = active_helpers.size ();
+
+    if (idx >= current_chain_size)
+        return;
+
+    auto hcb = active_helpers.begin ();
+    for (size_t i = idx; i < current_chain_size - 1; i++)
+        handle_middle_chain (hcb + i);
+
+    const helper_chain_t &lhc = active_helpers.back ();
+
+    struct pollfd prfds[1];
+    prfds[0].events = POLLIN;
+    prfds[0].fd = lhc.read_fd;
+
+    ssize_t buf_size = 0;
+    uint8_t buf[PROCESSOR_BUFFER_SIZE];
+    while ((poll (prfds, 1, 0) > 0) && (prfds[0].revents & POLLIN)
+           && ((buf_size = read (lhc.read_fd, buf, PROCESSOR_BUFFER_SIZE))
+               > 0))
+        {
+            audio_processing::write_stdout (buf, &buf_size, true);
+        }
+}
+
+// stop a single helper and remove it from the chain while the rest keep
+// running. its buffered output is drained to the next helper (or stdout
+// when it's the last) so nothing in the chain is flushed
+static void
+remove_helper (size_t idx)
+{
+    // whatever previous helper has produced belongs to this helper
+    if (idx > 0)
+        handle_middle_chain (active_helpers.begin () + (idx - 1));
+
+    auto hci = active_helpers.begin () + idx;
+    const bool is_last_p = idx == active_helpers.size () - 1;
+
+    close_valid_fd (&hci->write_fd);
+
+    // output is still read when next helper is gone so this one can exit
+    bool next_gone = false;
+
+    ssize_t buf_size = 0;
+    uint8_t buf[PROCESSOR_BUFFER_SIZE];
+    while ((buf_size = read (hci->read_fd, buf, PROCESSOR_BUFFER_SIZE)) > 0)
+        {
+            if (is_last_p)
+                {
+                    audio_processing::write_stdout (buf, &buf_size, true);
+                    continue;
+                }
+
+            if (next_gone)
+                continue;
+
+            const int next_write_fd = (hci + 1)->write_fd;
+            ssize_t written = 0;
+            while (written < buf_size)
+                {
+                    const ssize_t current_written = write (
+                        next_write_fd, buf + written, buf_size - written);
+
+                    if (current_written == -1 && errno == EINTR)
+                        continue;
+
+                    if (current_written < 1)
+                        break;
+
+                    written += current_written;
+                }
+
+            if (written < buf_size)
+                {
+                    perror ("[helper_processor::remove_helper ERROR] "
+                            "write");
+                    next_gone = true;
+                    continue;
+                }
+
+            // keep the rest moving so next helper never blocks on
+            // its full output
+            pump_from (idx + 1);
+        }
+
+    int status = 0;
+    waitpid (hci->pid, &status, 0);
+
+    if (hci->options.debug)
+        fprintf (stderr,
+                 "[helper_processor::remove_helper] chain status: %d `%s`\n",
+                 status, hci->options.raw_args.c_str ());
+
+    close_valid_fd (&hci->read_fd);
+
+    active_helpers.erase (hci);
+}
+
 /*
 
 Cases that can happen:
@@ -310,76 +377,82 @@ Cases that can happen:
 4. There's required helper and active ones, in which can be 2 case:
     1. Both required and active helpers are the exact same args and index,
        do nothing
-    2. Changed required helpers, need to reorder/shutdown/create helper to
-       match required helper, pretty tricky so it's simply shutting everything
-       down and creating it all over for now
+    2. Changed required helpers, unchanged helpers at the start and the end
+       of the chain keep running, only helpers in between are removed and
+       the new ones are created in their place. Changing one helper only
+       restarts that one helper
+
+ffmpeg can't take runtime filter commands here as its stdin is the audio
+input, changing args of a helper always restarts it.
 
 */
 
 int
-manage_processor (const audio_processing::processor_options_t &options,
-                  void (*on_fork) ())
+manage_processor (const audio_processing::processor_options_t &options)
 {
-    size_t required_chain_size = options.helper_chain.size (),
+    // effects run by native processor don't need helper
+    std::deque<audio_processing::helper_chain_option_t> required_chain = {};
+    for (const audio_processing::helper_chain_option_t &i :
+         options.helper_chain)
+        {
+            if (i.parsed && i.native)
+                continue;
+
+            required_chain.push_back (i);
+        }
+
+    size_t required_chain_size = required_chain.size (),
            current_chain_size = active_helpers.size ();
 
     // no required helper and no active helper
     if (!required_chain_size && !current_chain_size)
         return 0;
 
-    bool need_stop = false;
-
-    if (required_chain_size == current_chain_size)
-        {
-            for (size_t i = 0; i < required_chain_size; i++)
-                {
-                    const audio_processing::helper_chain_option_t &hco
-                        = options.helper_chain[i];
-                    const audio_processing::helper_chain_option_t &chco
-                        = active_helpers[i].options;
-
-                    // check if there's order/args difference
-                    // !TODO: check for debug too? is it worth restarting just
-                    // for debug mode?
-                    if (hco.raw_args != chco.raw_args)
-                        {
-                            need_stop = true;
-                            break;
-                        }
-                }
-        }
-    // length difference, should stop/restart all chain
-    else
-        need_stop = true;
+    // unchanged helpers at the start of the chain
+    size_t prefix_size = 0;
+    while (prefix_size < required_chain_size
+           && prefix_size < current_chain_size
+           && required_chain[prefix_size].raw_args
+                  == active_helpers[prefix_size].options.raw_args)
+        prefix_size++;
+
+    // nothing changed
+    if (prefix_size == required_chain_size
+        && prefix_size == current_chain_size)
+        return 0;
 
-    if (!need_stop)
-        {
-            // nothing needs to be done
-            return 0;
-        }
+    // unchanged helpers at the end of the chain, not overlapping prefix
+    size_t suffix_size = 0;
+    while (prefix_size + suffix_size < required_chain_size
+           && prefix_size + suffix_size < current_chain_size
+           && required_chain[required_chain_size - 1 - suffix_size].raw_args
+                  == active_helpers[current_chain_size - 1 - suffix_size]
+                         .options.raw_args)
+        suffix_size++;
 
-    // stop all active chain, hci is automatically end if no entry in deque
-    shutdown_chain ();
+    // !TODO: check for debug too? is it worth restarting just
+    // for debug mode?
 
-    bool need_start = required_chain_size > 0;
+    // remove changed helpers, the next one shifts to the same index
+    const size_t remove_count
+        = current_chain_size - prefix_size - suffix_size;
 
-    if (!need_start)
-        {
-            // nothing needs to be done
-            return 0;
-        }
+    for (size_t i = 0; i < remove_count; i++)
+        remove_helper (prefix_size);
 
-    // start all required chain
+    // create required helpers in their place
     int status = 0;
-    for (const audio_processing::helper_chain_option_t &i :
-         options.helper_chain)
+    for (size_t i = prefix_size; i < required_chain_size - suffix_size; i++)
         {
-            if ((status = create_helper (i, on_fork)) != 0)
+            const audio_processing::helper_chain_option_t &hco
+                = required_chain[i];
+
+            if ((status = create_helper (hco, i)) != 0)
                 {
                     fprintf (stderr,
                              "[helper_processor::manage_processor ERROR] "
                              "Failed creating effect chain: %d `%s`\n",
-                             status, i.raw_args.c_str ());
+                             status, hco.raw_args.c_str ());
 
                     return status;
                 }
@@ -470,11 +543,49 @@ while (write_ready && wrote < *size
 
             if ((poll (prfds, 1, 0) > 0) && (prfds[0].revents & POLLIN))
                 *size = read (hci->read_fd, buffer, BUFFER_SIZE);
+
+            if (*size > 0)
+                mark_output (*hci);
         }
 
     return 0;
 }
 
+void
+pump_chain ()
+{
+    const size_t current_chain_size = active_helpers.size ();
+
+    if (current_chain_size < 2)
+        return;
+
+    auto hcb = active_helpers.begin ();
+    for (size_t i = 0; i < current_chain_size - 1; i++)
+        handle_middle_chain (hcb + i);
+}
+
+void
+mark_last_chain_output ()
+{
+    if (!active_helpers.empty ())
+        mark_output (active_helpers.back ());
+}
+
+const helper_chain_t *
+get_last_chain ()
+{
+    if (active_helpers.empty ())
+        return nullptr;
+
+    return &active_helpers.back ();
+}
+
+size_t
+get_chain_size ()
+{
+    return active_helpers.size ();
+}
+
 int
 shutdown_chain (bool discard_output)
 {
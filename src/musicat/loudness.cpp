@@ -0,0 +1,399 @@
+#include "musicat/loudness.h"
+#include "musicat/config.h"
+#include "musicat/musicat.h"
+#include "musicat/spawn.h"
+#include "musicat/thread_manager.h"
+#include "musicat/track_index.h"
+#include <fcntl.h>
+#include <math.h>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace musicat
+{
+namespace loudness
+{
+
+// K-weighting filter coefficients for 48kHz from ITU-R BS.1770,
+// high shelf then high pass. { b0, b1, b2, a1, a2 }
+inline constexpr double k_weighting[2][5]
+    = { { 1.53512485958697, -2.69169618940638, 1.19839281085285,
+          -1.69065929318241, 0.73248077421585 },
+        { 1.0, -2.0, 1.0, -1.99004745483398, 0.99007225036621 } };
+
+// 100 ms of 48kHz, gating blocks are 4 of these overlapping by 3
+inline constexpr size_t sub_block_frames = 4800;
+inline constexpr double absolute_gate_lufs = -70.0;
+inline constexpr double relative_gate_lu = -10.0;
+
+inline constexpr size_t true_peak_phases = 4;
+
+// polyphase interpolation filter, [phase][tap]
+static double true_peak_filter[true_peak_phases][true_peak_taps];
+static std::once_flag true_peak_filter_flag;
+
+static std::mutex analyzing_m; // analyzing
+static std::set<std::string> analyzing = {};
+
+static void
+init_true_peak_filter ()
+{
+    const size_t size = true_peak_phases * true_peak_taps;
+    const double center = (double)(size - 1) / 2.0;
+
+    // hann windowed sinc with cutoff at the original nyquist
+    for (size_t n = 0; n < size; n++)
+        {
+            const double t = ((double)n - center) / (double)true_peak_phases;
+            const double sinc = t == 0.0 ? 1.0 : sin (M_PI * t) / (M_PI * t);
+            const double window
+                = 0.5 - (0.5 * cos (2.0 * M_PI * (n + 0.5) / (double)size));
+
+            true_peak_filter[n % true_peak_phases][n / true_peak_phases]
+                = sinc * window;
+        }
+}
+
+static inline double
+power_to_lufs (double power)
+{
+    return -0.691 + (10.0 * log10 (power));
+}
+
+void
+init_analyzer (analyzer_t &analyzer)
+{
+    std::call_once (true_peak_filter_flag, init_true_peak_filter);
+
+    memset (analyzer.kz, 0, sizeof (analyzer.kz));
+    analyzer.sub_sum = 0.0;
+    analyzer.sub_frames = 0;
+    memset (analyzer.prev_sub_sums, 0, sizeof (analyzer.prev_sub_sums));
+    analyzer.sub_count = 0;
+    analyzer.block_powers.clear ();
+    memset (analyzer.history, 0, sizeof (analyzer.history));
+    analyzer.history_pos = 0;
+    analyzer.peak = 0.0;
+}
+
+static inline double
+k_weight (analyzer_t &analyzer, int channel, double x)
+{
+    for (int s = 0; s < 2; s++)
+        {
+            const double *c = k_weighting[s];
+            double *z = analyzer.kz[s][channel];
+
+            const double y = (c[0] * x) + z[0];
+            z[0] = (c[1] * x) - (c[3] * y) + z[1];
+            z[1] = (c[2] * x) - (c[4] * y);
+
+            x = y;
+        }
+
+    return x;
+}
+
+static inline void
+update_true_peak (analyzer_t &analyzer, int channel, float x)
+{
+    float *h = analyzer.history[channel];
+    const size_t pos = analyzer.history_pos;
+
+    // newest sample last
+    h[pos] = x;
+    h[pos + true_peak_taps] = x;
+
+    const float *window = h + pos + 1;
+
+    for (size_t p = 0; p < true_peak_phases; p++)
+        {
+            const double *f = true_peak_filter[p];
+
+            double y = 0.0;
+            for (size_t k = 0; k < true_peak_taps; k++)
+                y += f[k] * window[true_peak_taps - 1 - k];
+
+            y = fabs (y);
+            if (y > analyzer.peak)
+                analyzer.peak = y;
+        }
+}
+
+static void
+end_sub_block (analyzer_t &analyzer)
+{
+    const double sub_sum = analyzer.sub_sum;
+
+    // full 400 ms block available
+    if (analyzer.sub_count >= 3)
+        {
+            const double sum = analyzer.prev_sub_sums[0]
+                               + analyzer.prev_sub_sums[1]
+                               + analyzer.prev_sub_sums[2] + sub_sum;
+
+            analyzer.block_powers.push_back (
+                sum / (double)(sub_block_frames * 4));
+        }
+
+    analyzer.prev_sub_sums[0] = analyzer.prev_sub_sums[1];
+    analyzer.prev_sub_sums[1] = analyzer.prev_sub_sums[2];
+    analyzer.prev_sub_sums[2] = sub_sum;
+    analyzer.sub_count++;
+
+    analyzer.sub_sum = 0.0;
+    analyzer.sub_frames = 0;
+}
+
+void
+analyze_s16 (analyzer_t &analyzer, const int16_t *samples, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++)
+        {
+            double frame_sum = 0.0;
+
+            for (int c = 0; c < 2; c++)
+                {
+                    const float x = (float)samples[(i * 2) + c] / 32768.0f;
+
+                    const double sample_peak = fabs (x);
+                    if (sample_peak > analyzer.peak)
+                        analyzer.peak = sample_peak;
+
+                    update_true_peak (analyzer, c, x);
+
+                    const double y = k_weight (analyzer, c, x);
+                    // left and right channel weights are both 1.0
+                    frame_sum += y * y;
+                }
+
+            analyzer.history_pos
+                = (analyzer.history_pos + 1) % true_peak_taps;
+
+            analyzer.sub_sum += frame_sum;
+
+            if (++analyzer.sub_frames == sub_block_frames)
+                end_sub_block (analyzer);
+        }
+}
+
+void
+get_result (const analyzer_t &analyzer, loudness_t &result)
+{
+    result.true_peak_dbtp
+        = analyzer.peak > 0.0 ? 20.0 * log10 (analyzer.peak) : -HUGE_VAL;
+
+    double sum = 0.0;
+    size_t count = 0;
+
+    for (const double power : analyzer.block_powers)
+        {
+            if (power > 0.0 && power_to_lufs (power) > absolute_gate_lufs)
+                {
+                    sum += power;
+                    count++;
+                }
+        }
+
+    if (!count)
+        {
+            result.integrated_lufs = -HUGE_VAL;
+            return;
+        }
+
+    const double relative_gate
+        = power_to_lufs (sum / (double)count) + relative_gate_lu;
+
+    double gated_sum = 0.0;
+    size_t gated_count = 0;
+
+    for (const double power : analyzer.block_powers)
+        {
+            if (power <= 0.0)
+                continue;
+
+            const double lufs = power_to_lufs (power);
+
+            if (lufs > absolute_gate_lufs && lufs > relative_gate)
+                {
+                    gated_sum += power;
+                    gated_count++;
+                }
+        }
+
+    result.integrated_lufs
+        = gated_count ? power_to_lufs (gated_sum / (double)gated_count)
+                      : -HUGE_VAL;
+}
+
+int
+analyze_file (const std::string &file_path, loudness_t &result, bool debug)
+{
+    int pipefd[2];
+    if (pipe2 (pipefd, O_CLOEXEC) == -1)
+        {
+            perror ("[loudness::analyze_file ERROR] pipe");
+            return -1;
+        }
+
+    const char *args[]
+        = { "ffmpeg", "-v", "error", "-nostdin", "-i", file_path.c_str (),
+            "-f", "s16le", "-ac", "2", "-ar", "48000", "-threads", "1",
+            "pipe:1", NULL };
+
+    const spawn::fd_map_t fds[] = { { pipefd[1], STDOUT_FILENO } };
+
+    const spawn::time_point_t spawned_at = spawn::now ();
+
+    pid_t pid = spawn::spawn_process (args, fds, 1, !debug);
+    close (pipefd[1]);
+
+    if (pid == -1)
+        {
+            close (pipefd[0]);
+            return -1;
+        }
+
+    bool output_pending = true;
+
+    analyzer_t analyzer;
+    init_analyzer (analyzer);
+
+    // whole frames only, the rest is kept for the next read
+    uint8_t buffer[BUFSIZ * 4];
+    size_t buffer_size = 0;
+    ssize_t read_size = 0;
+
+    while ((read_size = read (pipefd[0], buffer + buffer_size,
+                              sizeof (buffer) - buffer_size))
+           > 0)
+        {
+            if (output_pending)
+                {
+                    spawn::record_first_byte (spawn::CHILD_LOUDNESS_FFMPEG,
+                                              spawned_at);
+                    output_pending = false;
+                }
+
+            buffer_size += read_size;
+
+            const size_t frames = buffer_size / 4;
+            analyze_s16 (analyzer, (const int16_t *)buffer, frames);
+
+            const size_t rest = buffer_size - (frames * 4);
+            memmove (buffer, buffer + (frames * 4), rest);
+            buffer_size = rest;
+        }
+
+    close (pipefd[0]);
+
+    int status = 0;
+    waitpid (pid, &status, 0);
+
+    if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        {
+            fprintf (stderr,
+                     "[loudness::analyze_file ERROR] ffmpeg exited with "
+                     "status %d: '%s'\n",
+                     status, file_path.c_str ());
+
+            return -1;
+        }
+
+    get_result (analyzer, result);
+
+    return 0;
+}
+
+double
+get_gain_db (const loudness_t &loudness)
+{
+    // silent, leave it be
+    if (!isfinite (loudness.integrated_lufs))
+        return 0.0;
+
+    double gain = LOUDNESS_TARGET_LUFS - loudness.integrated_lufs;
+
+    if (gain > LOUDNESS_MAX_GAIN_DB)
+        gain = LOUDNESS_MAX_GAIN_DB;
+
+    if (isfinite (loudness.true_peak_dbtp)
+        && loudness.true_peak_dbtp + gain > LOUDNESS_MAX_TRUE_PEAK_DBTP)
+        gain = LOUDNESS_MAX_TRUE_PEAK_DBTP - loudness.true_peak_dbtp;
+
+    if (fabs (gain) < LOUDNESS_GAIN_TOLERANCE_DB)
+        return 0.0;
+
+    return gain;
+}
+
+double
+get_track_gain_db (const std::string &file_path)
+{
+    track_index::track_index_t index;
+
+    if (track_index::read_index (file_path, index) != 0
+        || !index.has_loudness)
+        return 0.0;
+
+    return get_gain_db ({ index.integrated_lufs, index.true_peak_dbtp });
+}
+
+void
+analyze_track (const std::string &file_path)
+{
+    {
+        std::lock_guard<std::mutex> lk (analyzing_m);
+
+        if (!analyzing.insert (file_path).second)
+            return;
+    }
+
+    std::thread tj (
+        [] (std::string file_path) {
+            thread_manager::DoneSetter tmds;
+
+            const bool debug = get_debug_state ();
+
+            track_index::track_index_t index;
+            loudness_t result;
+
+            if (track_index::load_index (file_path, index) != 0
+                || index.has_loudness)
+                goto done;
+
+            if (analyze_file (file_path, result, debug) != 0)
+                goto done;
+
+            index.has_loudness = true;
+            index.integrated_lufs = result.integrated_lufs;
+            index.true_peak_dbtp = result.true_peak_dbtp;
+
+            if (track_index::write_index (file_path, index) != 0)
+                fprintf (stderr,
+                         "[loudness::analyze_track ERROR] Failed writing "
+                         "index: '%s'\n",
+                         file_path.c_str ());
+            else if (debug)
+                fprintf (stderr,
+                         "[loudness::analyze_track] %.2f LUFS %.2f dBTP: "
+                         "'%s'\n",
+                         result.integrated_lufs, result.true_peak_dbtp,
+                         file_path.c_str ());
+
+        done:
+            std::lock_guard<std::mutex> lk (analyzing_m);
+            analyzing.erase (file_path);
+        },
+        file_path);
+
+    thread_manager::dispatch (tj);
+}
+
+} // loudness
+} // musicat
@@ -0,0 +1,654 @@
+#include "musicat/native_processor.h"
+#include "musicat/audio_kernels.h"
+#include "musicat/audio_processing.h"
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+
+namespace musicat
+{
+namespace native_processor
+{
+inline constexpr double sample_rate = 48000.0;
+inline constexpr int channel_count = 2;
+
+// superequalizer band boundaries in Hz, the same as ffmpeg's.
+// first band is everything below the first boundary, last band is everything
+// above the last boundary, the rest are between two boundaries
+inline constexpr double superequalizer_bounds[]
+    = { 65.406392,  92.498606,  130.81278,  184.99721, 261.62557, 369.99442,
+        523.25113,  739.9884,   1046.5023,  1479.9768, 2093.0045, 2959.9536,
+        4186.0091,  5919.9072,  8372.0181,  11839.814, 16744.036 };
+
+inline constexpr size_t superequalizer_band_count
+    = (sizeof (superequalizer_bounds) / sizeof (*superequalizer_bounds)) + 1;
+
+// Q of a half octave wide band
+inline constexpr double superequalizer_band_q = 2.871;
+
+// lowest gain we process to avoid log of zero
+inline constexpr double min_gain = 0.001;
+
+native_chain_t active_chain = { {}, {}, 1.0 };
+
+// next sample channel, in case a buffer ended in the middle of a frame
+int next_channel = 0;
+
+// scratch buffer to process samples in
+std::vector<double> work_buffer = {};
+
+// volume stage gain, ramps toward volume_target for volume_ramp_left more
+// samples
+float volume_gain = 1.0f;
+float volume_target = 1.0f;
+float volume_step = 0.0f;
+size_t volume_ramp_left = 0;
+
+// volume stage gain is the product of these
+float volume_factor = 1.0f;
+float normalize_factor = 1.0f;
+
+struct filter_arg_t
+{
+    // empty when positional
+    std::string key;
+    std::string value;
+};
+
+static bool
+parse_double (const std::string &str, double &result)
+{
+    if (str.empty ())
+        return false;
+
+    char *end = NULL;
+    result = strtod (str.c_str (), &end);
+
+    return end && *end == '\0' && std::isfinite (result);
+}
+
+static std::vector<std::string>
+split (const std::string &str, char delim)
+{
+    std::vector<std::string> ret = {};
+
+    size_t start = 0, end = 0;
+    while ((end = str.find (delim, start)) != std::string::npos)
+        {
+            ret.push_back (str.substr (start, end - start));
+            start = end + 1;
+        }
+
+    ret.push_back (str.substr (start));
+
+    return ret;
+}
+
+static std::vector<filter_arg_t>
+parse_filter_args (const std::string &args)
+{
+    std::vector<filter_arg_t> ret = {};
+
+    if (args.empty ())
+        return ret;
+
+    for (const std::string &arg : split (args, ':'))
+        {
+            const size_t eq = arg.find ('=');
+
+            if (eq == std::string::npos)
+                ret.push_back ({ "", arg });
+            else
+                ret.push_back ({ arg.substr (0, eq), arg.substr (eq + 1) });
+        }
+
+    return ret;
+}
+
+static double
+width_to_alpha (char width_type, double width, double frequency, double w0,
+                double A)
+{
+    const double sn = sin (w0);
+
+    switch (width_type)
+        {
+        case 'h':
+            return sn / (2.0 * frequency / width);
+        case 'o':
+            return sn * sinh (M_LN2 / 2.0 * width * w0 / sn);
+        case 's':
+            return sn / 2.0 * sqrt ((A + 1.0 / A) * (1.0 / width - 1.0) + 2.0);
+        default:
+            return sn / (2.0 * width);
+        }
+}
+
+// create filter stage with coefficients from RBJ's audio EQ cookbook.
+// gain is linear amplitude, only used by peaking and shelving filter
+static biquad_t
+create_biquad (biquad_type_t type, double frequency, double gain,
+               char width_type, double width)
+{
+    const double A = sqrt (gain < min_gain ? min_gain : gain);
+    const double w0 = 2.0 * M_PI * frequency / sample_rate;
+    const double cs = cos (w0);
+    const double alpha = width_to_alpha (width_type, width, frequency, w0, A);
+    const double sa = 2.0 * sqrt (A) * alpha;
+
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0, a0 = 1.0, a1 = 0.0, a2 = 0.0;
+
+    switch (type)
+        {
+        case BIQUAD_PEAKING:
+            b0 = 1.0 + alpha * A;
+            b1 = -2.0 * cs;
+            b2 = 1.0 - alpha * A;
+            a0 = 1.0 + alpha / A;
+            a1 = -2.0 * cs;
+            a2 = 1.0 - alpha / A;
+            break;
+        case BIQUAD_LOWSHELF:
+            b0 = A * ((A + 1.0) - (A - 1.0) * cs + sa);
+            b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cs);
+            b2 = A * ((A + 1.0) - (A - 1.0) * cs - sa);
+            a0 = (A + 1.0) + (A - 1.0) * cs + sa;
+            a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cs);
+            a2 = (A + 1.0) + (A - 1.0) * cs - sa;
+            break;
+        case BIQUAD_HIGHSHELF:
+            b0 = A * ((A + 1.0) + (A - 1.0) * cs + sa);
+            b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cs);
+            b2 = A * ((A + 1.0) + (A - 1.0) * cs - sa);
+            a0 = (A + 1.0) - (A - 1.0) * cs + sa;
+            a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cs);
+            a2 = (A + 1.0) - (A - 1.0) * cs - sa;
+            break;
+        case BIQUAD_LOWPASS:
+            b0 = (1.0 - cs) / 2.0;
+            b1 = 1.0 - cs;
+            b2 = (1.0 - cs) / 2.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cs;
+            a2 = 1.0 - alpha;
+            break;
+        case BIQUAD_HIGHPASS:
+            b0 = (1.0 + cs) / 2.0;
+            b1 = -(1.0 + cs);
+            b2 = (1.0 + cs) / 2.0;
+            a0 = 1.0 + alpha;
+            a1 = -2.0 * cs;
+            a2 = 1.0 - alpha;
+            break;
+        }
+
+    return { type,    frequency, b0 / a0,    b1 / a0,   b2 / a0,
+             a1 / a0, a2 / a0,   { 0.0, 0.0 }, { 0.0, 0.0 } };
+}
+
+// volume=1.5 or volume=volume=1.5 or volume=6dB
+static bool
+parse_volume (const std::vector<filter_arg_t> &args, native_chain_t &chain)
+{
+    if (args.size () != 1)
+        return false;
+
+    const filter_arg_t &arg = args[0];
+    if (!arg.key.empty () && arg.key != "volume")
+        return false;
+
+    std::string value = arg.value;
+    bool is_db = false;
+
+    if (value.length () > 2
+        && strcasecmp (value.c_str () + value.length () - 2, "dB") == 0)
+        {
+            value = value.substr (0, value.length () - 2);
+            is_db = true;
+        }
+
+    double vol = 0.0;
+    if (!parse_double (value, vol))
+        return false;
+
+    if (is_db)
+        vol = pow (10.0, vol / 20.0);
+
+    if (vol < 0.0)
+        return false;
+
+    chain.gain *= vol;
+
+    return true;
+}
+
+// superequalizer=1b=0.5:2b=1.2:...:18b=1
+static bool
+parse_superequalizer (const std::vector<filter_arg_t> &args,
+                      native_chain_t &chain)
+{
+    double gains[superequalizer_band_count];
+    for (double &g : gains)
+        g = 1.0;
+
+    for (const filter_arg_t &arg : args)
+        {
+            // positional args aren't worth supporting
+            if (arg.key.length () < 2 || arg.key.back () != 'b')
+                return false;
+
+            double band = 0.0;
+            if (!parse_double (arg.key.substr (0, arg.key.length () - 1),
+                               band))
+                return false;
+
+            const size_t idx = (size_t)band;
+            if ((double)idx != band || idx < 1
+                || idx > superequalizer_band_count)
+                return false;
+
+            double gain = 0.0;
+            if (!parse_double (arg.value, gain))
+                return false;
+
+            // the same range as ffmpeg's
+            if (gain < 0.0)
+                gain = 0.0;
+            else if (gain > 20.0)
+                gain = 20.0;
+
+            gains[idx - 1] = gain < min_gain ? min_gain : gain;
+        }
+
+    // move average gain to broadband gain so overlapping bands don't stack
+    // up when most bands share the same gain
+    double log_sum = 0.0;
+    for (const double g : gains)
+        log_sum += log (g);
+
+    const double avg_gain = exp (log_sum / (double)superequalizer_band_count);
+
+    chain.gain *= avg_gain;
+
+    for (size_t i = 0; i < superequalizer_band_count; i++)
+        {
+            const double gain = gains[i] / avg_gain;
+
+            // skip stage doing nothing
+            if (fabs (gain - 1.0) < 1e-6)
+                continue;
+
+            if (i == 0)
+                {
+                    chain.biquads.push_back (
+                        create_biquad (BIQUAD_LOWSHELF,
+                                       superequalizer_bounds[0], gain, 's',
+                                       1.0));
+                    continue;
+                }
+
+            if (i == superequalizer_band_count - 1)
+                {
+                    chain.biquads.push_back (create_biquad (
+                        BIQUAD_HIGHSHELF, superequalizer_bounds[i - 1], gain,
+                        's', 1.0));
+                    continue;
+                }
+
+            const double center = sqrt (superequalizer_bounds[i - 1]
+                                        * superequalizer_bounds[i]);
+
+            chain.biquads.push_back (create_biquad (
+                BIQUAD_PEAKING, center, gain, 'q', superequalizer_band_q));
+        }
+
+    return true;
+}
+
+// bass=g=10:f=100:t=q:w=0.5, lowpass=f=500:t=q:w=0.707,
+// highpass=f=3000:t=q:w=0.707
+static bool
+parse_biquad_filter (const std::string &name,
+                     const std::vector<filter_arg_t> &args,
+                     native_chain_t &chain)
+{
+    const bool is_bass = name == "bass";
+
+    biquad_type_t type = BIQUAD_LOWSHELF;
+    // ffmpeg's defaults
+    double frequency = 100.0, gain_db = 0.0, width = 0.5;
+    char width_type = 'q';
+
+    if (name == "lowpass")
+        {
+            type = BIQUAD_LOWPASS;
+            frequency = 500.0;
+            width = 0.707;
+        }
+    else if (name == "highpass")
+        {
+            type = BIQUAD_HIGHPASS;
+            frequency = 3000.0;
+            width = 0.707;
+        }
+
+    for (const filter_arg_t &arg : args)
+        {
+            const std::string &key = arg.key;
+
+            if (key == "f" || key == "frequency")
+                {
+                    if (!parse_double (arg.value, frequency))
+                        return false;
+                }
+            else if (key == "w" || key == "width")
+                {
+                    if (!parse_double (arg.value, width))
+                        return false;
+                }
+            else if (key == "t" || key == "width_type")
+                {
+                    if (arg.value.length () != 1
+                        || !strchr ("hqos", arg.value[0]))
+                        return false;
+
+                    width_type = arg.value[0];
+
+                    // slope is only meaningful for shelving filter
+                    if (width_type == 's' && !is_bass)
+                        return false;
+                }
+            else if (is_bass && (key == "g" || key == "gain"))
+                {
+                    if (!parse_double (arg.value, gain_db))
+                        return false;
+                }
+            else if (!is_bass && (key == "p" || key == "poles"))
+                {
+                    // single pole filter isn't implemented
+                    if (arg.value != "2")
+                        return false;
+                }
+            else
+                // positional or unknown args
+                return false;
+        }
+
+    if (frequency <= 0.0 || frequency >= sample_rate / 2.0 || width <= 0.0)
+        return false;
+
+    chain.biquads.push_back (create_biquad (
+        type, frequency, pow (10.0, gain_db / 20.0), width_type, width));
+
+    return true;
+}
+
+static bool
+parse_filter (const std::string &filter, native_chain_t &chain)
+{
+    const size_t eq = filter.find ('=');
+
+    const std::string name = filter.substr (0, eq);
+    const std::vector<filter_arg_t> args = parse_filter_args (
+        eq == std::string::npos ? "" : filter.substr (eq + 1));
+
+    if (name == "volume")
+        return parse_volume (args, chain);
+
+    if (name == "superequalizer")
+        return parse_superequalizer (args, chain);
+
+    if (name == "bass" || name == "lowpass" || name == "highpass")
+        return parse_biquad_filter (name, args, chain);
+
+    return false;
+}
+
+// append every filter stage in raw_args to chain, returns false
+// if any of them can't be run natively
+static bool
+parse_raw_args (const std::string &raw_args, native_chain_t &chain)
+{
+    // quoting, escaping, labels and multiple filter chain are ffmpeg's job
+    if (raw_args.empty ()
+        || raw_args.find_first_of ("'\\[];") != std::string::npos)
+        return false;
+
+    for (const std::string &filter : split (raw_args, ','))
+        {
+            if (!parse_filter (filter, chain))
+                return false;
+        }
+
+    return true;
+}
+
+bool
+is_supported (const std::string &raw_args)
+{
+    native_chain_t chain = { {}, {}, 1.0 };
+
+    return parse_raw_args (raw_args, chain);
+}
+
+int
+manage_processor (audio_processing::processor_options_t &options)
+{
+    size_t required_idx = 0;
+    bool need_update = false;
+
+    for (audio_processing::helper_chain_option_t &hco : options.helper_chain)
+        {
+            if (!hco.parsed)
+                {
+                    hco.native = is_supported (hco.raw_args);
+                    hco.parsed = true;
+                }
+
+            if (!hco.native)
+                continue;
+
+            if (required_idx >= active_chain.raw_args.size ()
+                || active_chain.raw_args[required_idx] != hco.raw_args)
+                need_update = true;
+
+            required_idx++;
+        }
+
+    if (required_idx != active_chain.raw_args.size ())
+        need_update = true;
+
+    if (!need_update)
+        {
+            // nothing needs to be done
+            return 0;
+        }
+
+    native_chain_t new_chain = { {}, {}, 1.0 };
+
+    for (const audio_processing::helper_chain_option_t &hco :
+         options.helper_chain)
+        {
+            if (!hco.native)
+                continue;
+
+            // can't fail, it's been checked above
+            parse_raw_args (hco.raw_args, new_chain);
+            new_chain.raw_args.push_back (hco.raw_args);
+
+            if (options.debug)
+                fprintf (stderr,
+                         "[native_processor::manage_processor] native "
+                         "chain: `%s`\n",
+                         hco.raw_args.c_str ());
+        }
+
+    // keep the state of the same filter stage to avoid clicking
+    // when only its gain changed
+    const size_t old_size = active_chain.biquads.size ();
+    for (size_t i = 0; i < new_chain.biquads.size () && i < old_size; i++)
+        {
+            biquad_t &nb = new_chain.biquads[i];
+            const biquad_t &ob = active_chain.biquads[i];
+
+            if (nb.type != ob.type || nb.frequency != ob.frequency)
+                continue;
+
+            for (int c = 0; c < channel_count; c++)
+                {
+                    nb.z1[c] = ob.z1[c];
+                    nb.z2[c] = ob.z2[c];
+                }
+        }
+
+    active_chain = new_chain;
+
+    return 0;
+}
+
+ssize_t
+run_through_chain (uint8_t *buffer, ssize_t *size)
+{
+    if (*size < 2)
+        return 0;
+
+    if (active_chain.biquads.empty () && active_chain.gain == 1.0)
+        return 0;
+
+    const size_t sample_count = *size / 2;
+
+    if (work_buffer.size () < sample_count)
+        work_buffer.resize (sample_count);
+
+    double *work = work_buffer.data ();
+
+    for (size_t i = 0; i < sample_count; i++)
+        {
+            int16_t sample;
+            memcpy (&sample, buffer + (i * 2), sizeof (sample));
+
+            work[i] = (double)sample / 32768.0;
+        }
+
+    // run every stage over the whole buffer before the next one
+    for (biquad_t &bq : active_chain.biquads)
+        {
+            int c = next_channel;
+            for (size_t i = 0; i < sample_count; i++)
+                {
+                    const double x = work[i];
+                    const double y = bq.b0 * x + bq.z1[c];
+
+                    bq.z1[c] = bq.b1 * x - bq.a1 * y + bq.z2[c];
+                    bq.z2[c] = bq.b2 * x - bq.a2 * y;
+
+                    work[i] = y;
+                    c ^= 1;
+                }
+        }
+
+    const double gain = active_chain.gain * 32768.0;
+    for (size_t i = 0; i < sample_count; i++)
+        {
+            double v = work[i] * gain;
+
+            if (v > 32767.0)
+                v = 32767.0;
+            else if (v < -32768.0)
+                v = -32768.0;
+
+            const int16_t sample = (int16_t)lrint (v);
+            memcpy (buffer + (i * 2), &sample, sizeof (sample));
+        }
+
+    next_channel = (int)((next_channel + sample_count) % channel_count);
+
+    return 0;
+}
+
+static void
+update_volume_target (bool ramp)
+{
+    volume_target = volume_factor * normalize_factor;
+
+    if (!ramp)
+        {
+            volume_gain = volume_target;
+            volume_step = 0.0f;
+            volume_ramp_left = 0;
+            return;
+        }
+
+    volume_ramp_left = VOLUME_RAMP_SAMPLES;
+    volume_step = (volume_target - volume_gain) / (float)volume_ramp_left;
+}
+
+void
+set_volume (int volume, bool ramp)
+{
+    volume_factor = (float)volume / 100.0f;
+    update_volume_target (ramp);
+}
+
+void
+set_normalize_gain (double gain_db, bool ramp)
+{
+    normalize_factor = (float)pow (10.0, gain_db / 20.0);
+    update_volume_target (ramp);
+}
+
+ssize_t
+run_volume (uint8_t *buffer, ssize_t *size)
+{
+    if (*size < 2)
+        return 0;
+
+    const size_t sample_count = *size / 2;
+    size_t ramp_count = 0;
+
+    if (volume_ramp_left)
+        {
+            ramp_count = sample_count < volume_ramp_left ? sample_count
+                                                         : volume_ramp_left;
+
+            audio_kernels::gain_s16 ((int16_t *)buffer, ramp_count,
+                                     volume_gain, volume_step);
+
+            volume_ramp_left -= ramp_count;
+            volume_gain = volume_ramp_left
+                              ? volume_gain + (volume_step * ramp_count)
+                              : volume_target;
+        }
+
+    if (ramp_count < sample_count && volume_gain != 1.0f)
+        audio_kernels::gain_s16 ((int16_t *)buffer + ramp_count,
+                                 sample_count - ramp_count, volume_gain,
+                                 0.0f);
+
+    return 0;
+}
+
+bool
+is_passthrough ()
+{
+    return active_chain.biquads.empty () && active_chain.gain == 1.0
+           && !volume_ramp_left && volume_gain == 1.0f;
+}
+
+void
+reset_chain ()
+{
+    for (biquad_t &bq : active_chain.biquads)
+        {
+            for (int c = 0; c < channel_count; c++)
+                {
+                    bq.z1[c] = 0.0;
+                    bq.z2[c] = 0.0;
+                }
+        }
+
+    next_channel = 0;
+}
+
+} // native_processor
+} // musicat
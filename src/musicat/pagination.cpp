@@ -383,7 +383,8 @@ _construct_desc (std::deque<player::MCTrack> &queue,
             player::track_progress prog = { 0, 0, -1 };
             if (util::player_has_current_track (guild_player)
                 && !guild_player->current_track.info.raw.is_null ())
-                prog = util::get_track_progress (guild_player->current_track);
+                prog = util::get_track_progress (guild_player->current_track,
+                                                 &guild_player->clock);
             else if (!i->info.raw.is_null ())
                 prog = util::get_track_progress (*i);
 
@@ -16,6 +16,7 @@ MCTrack::MCTrack ()
     stopping = false;
     current_byte = 0;
     filesize = 0;
+    index = nullptr;
 }
 
 MCTrack::MCTrack (const YTrack &t)
@@ -25,11 +26,50 @@ MCTrack::MCTrack (const YTrack &t)
     stopping = false;
     current_byte = 0;
     filesize = 0;
+    index = nullptr;
     this->raw = t.raw;
 }
 
 MCTrack::~MCTrack () = default;
 
+playback_clock_t::playback_clock_t ()
+{
+    base_samples = 0;
+    sent_samples = 0;
+    buffered_samples = 0;
+}
+
+void
+playback_clock_t::reset (const int64_t start_ms)
+{
+    sent_samples = 0;
+    base_samples = start_ms * 48;
+}
+
+void
+playback_clock_t::add_samples (const int64_t samples)
+{
+    sent_samples.fetch_add (samples);
+}
+
+void
+playback_clock_t::set_buffered (const float secs_remaining)
+{
+    buffered_samples = (int64_t)(secs_remaining * 48000.0f);
+}
+
+int64_t
+playback_clock_t::get_ms () const
+{
+    int64_t played = sent_samples.load () - buffered_samples.load ();
+
+    // still playing audio buffered before reset
+    if (played < 0)
+        played = 0;
+
+    return (base_samples.load () + played) / 48;
+}
+
 void
 Player::init ()
 {
@@ -411,9 +451,36 @@ player_has_current_track (std::shared_ptr<player::Player> guild_player)
 }
 
 player::track_progress
-get_track_progress (player::MCTrack &track)
+get_track_progress (player::MCTrack &track,
+                    const player::playback_clock_t *clock)
 {
-    const int64_t duration = track.info.duration ();
+    // index gives exact duration of a vbr file
+    const int64_t duration = track.index && track.index->duration_ms
+                                 ? track.index->duration_ms
+                                 : track.info.duration ();
+
+    if (clock)
+        {
+            if (!duration)
+                return { 0, 0, 1 };
+
+            int64_t current_ms = clock->get_ms ();
+            if (current_ms > duration)
+                current_ms = duration;
+
+            return { current_ms, duration, 0 };
+        }
+
+    if (track.index && track.index->duration_ms)
+        {
+            const int64_t current_ms
+                = track.current_byte
+                      ? track_index::byte_to_ms (*track.index,
+                                                 track.current_byte)
+                      : 0;
+
+            return { current_ms, duration, 0 };
+        }
 
     if (!duration || !track.filesize)
         return { 0, 0, 1 };
@@ -427,6 +494,69 @@ get_track_progress (player::MCTrack &track)
     return { current_ms, duration, 0 };
 }
 
+std::string
+ms_to_seek_str (int64_t ms)
+{
+    if (ms < 0)
+        ms = 0;
+
+    std::string ms_str = std::to_string (ms % 1000);
+    while (ms_str.length () < 3)
+        ms_str = '0' + ms_str;
+
+    return std::to_string (ms / 1000) + '.' + ms_str;
+}
+
+int64_t
+seek_str_to_ms (const std::string &str)
+{
+    int64_t ms = 0, part = 0;
+    bool has_digit = false;
+
+    size_t i = 0;
+    for (; i < str.length () && str[i] != '.'; i++)
+        {
+            const char c = str[i];
+
+            if (c == ':')
+                {
+                    if (!has_digit)
+                        return -1;
+
+                    ms = (ms + part) * 60;
+                    part = 0;
+                    has_digit = false;
+                    continue;
+                }
+
+            if (c < '0' || c > '9')
+                return -1;
+
+            part = (part * 10) + (c - '0');
+            has_digit = true;
+        }
+
+    if (!has_digit)
+        return -1;
+
+    ms = (ms + part) * 1000;
+
+    // fraction of a second
+    int64_t scale = 100;
+    for (i++; i < str.length (); i++)
+        {
+            const char c = str[i];
+
+            if (c < '0' || c > '9')
+                return -1;
+
+            ms += (c - '0') * scale;
+            scale /= 10;
+        }
+
+    return ms;
+}
+
 } // util
 } // musicat
 
@@ -16,7 +16,11 @@ namespace player
 // this section looks so bad
 using string = std::string;
 
-Manager::Manager (dpp::cluster *cluster) { this->cluster = cluster; }
+Manager::Manager (dpp::cluster *cluster)
+{
+    this->cluster = cluster;
+    this->processor_seq = 0;
+}
 
 Manager::~Manager () = default;
 
@@ -98,6 +102,10 @@ Manager::delete_player (const dpp::snowflake &guild_id)
         return false;
 
     players.erase (l);
+
+    discard_prerolled_processor (guild_id);
+    discard_guild_processor (guild_id);
+
     return true;
 }
 
@@ -247,69 +255,9 @@ Manager::skip (dpp::voiceconn *v, const dpp::snowflake &guild_id,
 
 void
 Manager::download (const string &fname, const string &url,
-                   const dpp::snowflake &guild_id)
+                   const download_manager::priority_t priority)
 {
-    const string yt_dlp = get_ytdlp_exe ();
-    if (yt_dlp.empty ())
-        {
-            fprintf (stderr,
-                     "[ERROR Manager::download] yt-dlp executable isn't "
-                     "configured, unable to download track '%s'\n",
-                     fname.c_str ());
-
-            return;
-        }
-
-    std::thread tj (
-        [this, yt_dlp] (string fname, string url, dpp::snowflake guild_id) {
-            thread_manager::DoneSetter tmds;
-            {
-                std::lock_guard<std::mutex> lk (this->dl_m);
-                this->waiting_file_download[fname] = guild_id;
-            }
-
-            const string music_folder_path = get_music_folder_path ();
-
-            {
-                struct stat buf;
-                if (stat (music_folder_path.c_str (), &buf) != 0)
-                    std::filesystem::create_directory (music_folder_path);
-            }
-
-            string cmd
-                = yt_dlp + " -f 251 --http-chunk-size 2M '" + url
-                  + string ("' -x --audio-format opus --audio-quality 0 -o '")
-                  + music_folder_path
-                  + std::regex_replace (fname, std::regex ("(')"), "'\\''",
-                                        std::regex_constants::match_any)
-                  + string ("'");
-
-            bool debug = get_debug_state ();
-
-            if (!debug)
-                cmd += " 1>/dev/null";
-
-            // always log these to easily spot problem in prod
-            fprintf (stderr, "[Manager::download] Download: \"%s\" \"%s\"\n",
-                     fname.c_str (), url.c_str ());
-
-            fprintf (stderr, "[Manager::download] Command: %s\n",
-                     cmd.c_str ());
-
-            // !TODO: probably move this operation to child
-            // instead of using literal shell to run the command
-            system (cmd.c_str ());
-
-            {
-                std::lock_guard<std::mutex> lk (this->dl_m);
-                this->waiting_file_download.erase (fname);
-            }
-
-            this->dl_cv.notify_all ();
-        },
-        fname, url, guild_id);
-
-    thread_manager::dispatch (tj);
+    download_manager::enqueue (fname, url, priority);
 }
 
 void
@@ -330,65 +278,80 @@ Manager::play (dpp::discord_voice_client *v, player::MCTrack &track,
                 std::cerr << "[Manager::play] Attempt to stream: " << server_id
                           << ' ' << voice_channel_id << '\n';
 
+            // runs wherever the stream ends, usually a stream scheduler
+            // worker
+            const stream_end_t on_end = [this, &track, v, server_id,
+                                         voice_channel_id,
+                                         channel_id] (int e) {
+                if (e)
+                    {
+                        fprintf (stderr,
+                                 "[ERROR Manager::play] Stream thrown "
+                                 "error with "
+                                 "code: %d\n",
+                                 e);
+
+                        const bool has_send_msg_perm
+                            = server_id && voice_channel_id
+                              && has_permissions_from_ids (
+                                  server_id, this->cluster->me.id,
+                                  channel_id,
+                                  { dpp::p_view_channel,
+                                    dpp::p_send_messages });
+
+                        if (!has_send_msg_perm)
+                            goto skip_send_msg;
+
+                        string msg = "";
+
+                        // Maybe connect/reconnect here if there's
+                        // connection error
+                        if (e == 2)
+                            msg = "Can't start playback";
+                        else if (e == 1)
+                            msg = "No connection";
+
+                        if (!msg.empty ())
+                            {
+                                const dpp::message m (channel_id, msg);
+
+                                this->cluster->message_create (m);
+                            }
+                    }
+
+            skip_send_msg:
+                track.stopping = false;
+
+                if (v && !v->terminating)
+                    {
+                        v->insert_marker ("e");
+                        return;
+                    }
+
+                auto vcc = get_voice_from_gid (server_id, get_sha_id ());
+
+                if (vcc.first)
+                    {
+                        return;
+                    }
+
+                if (server_id && voice_channel_id)
+                    {
+                        this->set_connecting (server_id, voice_channel_id);
+                    }
+                // if (v) v->~discord_voice_client();
+            };
+
             try
                 {
-                    this->stream (v, track);
+                    // stream is handed to stream scheduler, this thread
+                    // only lives through its setup
+                    this->stream (v, track, on_end);
                 }
             catch (int e)
                 {
-                    fprintf (stderr,
-                             "[ERROR Manager::play] Stream thrown "
-                             "error with "
-                             "code: %d\n",
-                             e);
-
-                    const bool has_send_msg_perm
-                        = server_id && voice_channel_id
-                          && has_permissions_from_ids (
-                              server_id, this->cluster->me.id, channel_id,
-                              { dpp::p_view_channel, dpp::p_send_messages });
-
-                    if (!has_send_msg_perm)
-                        goto skip_send_msg;
-
-                    string msg = "";
-
-                    // Maybe connect/reconnect here if there's
-                    // connection error
-                    if (e == 2)
-                        msg = "Can't start playback";
-                    else if (e == 1)
-                        msg = "No connection";
-
-                    if (!msg.empty ())
-                        {
-                            const dpp::message m (channel_id, msg);
-
-                            this->cluster->message_create (m);
-                        }
-                }
-
-        skip_send_msg:
-            track.stopping = false;
-
-            if (v && !v->terminating)
-                {
-                    v->insert_marker ("e");
-                    return;
-                }
-
-            auto vcc = get_voice_from_gid (server_id, get_sha_id ());
-
-            if (vcc.first)
-                {
-                    return;
-                }
-
-            if (server_id && voice_channel_id)
-                {
-                    this->set_connecting (server_id, voice_channel_id);
+                    on_end (e);
                 }
-            // if (v) v->~discord_voice_client();
         },
         v, channel_id);
 
@@ -394,6 +394,8 @@ Manager::get_playing_info_embed (const dpp::snowflake &guild_id,
     guild_player->reset_shifted ();
 
     MCTrack track;
+    // whether track is the one currently streaming
+    bool is_current_track = false;
     MCTrack prev_track;
     MCTrack next_track;
     MCTrack skip_track;
@@ -407,7 +409,8 @@ Manager::get_playing_info_embed (const dpp::snowflake &guild_id,
                 throw exception ("No track");
             }
 
-        if (util::player_has_current_track (guild_player))
+        if ((is_current_track
+             = util::player_has_current_track (guild_player)))
             track = guild_player->current_track;
 
         else
@@ -511,7 +514,8 @@ Manager::get_playing_info_embed (const dpp::snowflake &guild_id,
     bool tinfo = !track.info.raw.is_null ();
     if (tinfo)
         {
-            track_progress prog = util::get_track_progress (track);
+            track_progress prog = util::get_track_progress (
+                track, is_current_track ? &guild_player->clock : nullptr);
             ft += "[" + format_duration (prog.current_ms) + "/"
                   + format_duration (prog.duration) + "]";
         }
@@ -3,6 +3,7 @@
 #include "musicat/musicat.h"
 #include "musicat/player.h"
 #include "musicat/thread_manager.h"
+#include "musicat/track_catalog.h"
 #include <memory>
 
 namespace musicat
@@ -137,6 +138,9 @@ Manager::handle_on_track_marker (const dpp::voice_track_marker_t &event)
                 database::delete_guild_current_queue (
                     event.voice_client->server_id);
 
+            this->discard_prerolled_processor (event.voice_client->server_id);
+            this->discard_guild_processor (event.voice_client->server_id);
+
             return false;
         }
 
@@ -162,6 +166,9 @@ Manager::handle_on_track_marker (const dpp::voice_track_marker_t &event)
                           << event.voice_client->channel_id << " ("
                           << guild_player->guild_id << ")\n";
 
+            this->discard_prerolled_processor (event.voice_client->server_id);
+            this->discard_guild_processor (event.voice_client->server_id);
+
             return false;
         }
 
@@ -207,7 +214,7 @@ Manager::handle_on_track_marker (const dpp::voice_track_marker_t &event)
 
             prepare_play_stage_channel_routine (v, g);
 
-            this->wait_for_download (track.filename);
+            const bool following = this->wait_for_playable (track.filename);
 
             // check for autoplay
             const string track_id = track.id ();
@@ -247,14 +254,9 @@ Manager::handle_on_track_marker (const dpp::voice_track_marker_t &event)
                 const string absolute_path
                     = get_music_folder_path () + track.filename;
 
-                std::ifstream test (absolute_path,
-                                    std::ios_base::in | std::ios_base::binary);
-
-                if (test.is_open ())
-                    {
-                        test.close ();
-                        goto has_file;
-                    }
+                // stream follows the partial file when still downloading
+                if (following || track_catalog::exists (track.filename))
+                    goto has_file;
 
                 fprintf (stderr,
                          "[Manager::handle_on_track_marker tj ERROR] "
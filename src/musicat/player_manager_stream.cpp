@@ -1,15 +1,28 @@
 #include "musicat/audio_processing.h"
+#include "musicat/audio_ring.h"
 #include "musicat/child.h"
 #include "musicat/child/command.h"
 #include "musicat/child/worker.h"
+#include "musicat/child/worker_command.h"
 #include "musicat/config.h"
+#include "musicat/download_manager.h"
+#include "musicat/loudness.h"
 #include "musicat/musicat.h"
 #include "musicat/player.h"
+#include "musicat/spawn.h"
+#include "musicat/stream_scheduler.h"
+#include "musicat/thread_manager.h"
+#include "musicat/track_cache.h"
+#include "musicat/track_catalog.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <memory>
 #include <oggz/oggz.h>
 #include <oggz/oggz_seek.h>
+#include <string.h>
 #include <sys/poll.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <thread>
 
@@ -36,20 +49,165 @@ inline constexpr long STREAM_BUFSIZ_OPUS = BUFSIZ / 8;
 inline constexpr long CHUNK_READ_OPUS = BUFSIZ / 2;
 inline constexpr long DRAIN_CHUNK_OPUS = BUFSIZ / 4;
 
+// output from before seek is drained once nothing came for this long
+inline constexpr int DRAIN_WAIT_MS = 1000;
+
 namespace musicat
 {
 namespace player
 {
 using string = std::string;
 namespace cc = child::command;
+namespace cw = child::worker_command;
 
 struct mc_oggz_user_data
 {
     dpp::discord_voice_client *voice_client;
     MCTrack &track;
     bool &debug;
+    playback_clock_t &clock;
+};
+
+#if !defined(MUSICAT_USE_PCM) || defined(MUSICAT_OPUS_PASSTHROUGH)
+// samples per channel at 48kHz in an opus packet, from its TOC byte as
+// described in RFC 6716 section 3.1
+static int64_t
+get_opus_packet_samples (const unsigned char *packet, const long bytes)
+{
+    if (bytes < 1)
+        return 0;
+
+    const int config = packet[0] >> 3;
+
+    // frame size in 48kHz samples
+    int64_t frame_size;
+    if (config < 12)
+        // SILK 10, 20, 40, 60 ms
+        frame_size = (config & 3) == 3 ? 2880 : 480 << (config & 3);
+    else if (config < 16)
+        // hybrid 10, 20 ms
+        frame_size = 480 << (config & 1);
+    else
+        // CELT 2.5, 5, 10, 20 ms
+        frame_size = 120 << (config & 3);
+
+    int64_t frame_count;
+    switch (packet[0] & 3)
+        {
+        case 0:
+            frame_count = 1;
+            break;
+        case 1:
+        case 2:
+            frame_count = 2;
+            break;
+        default:
+            if (bytes < 2)
+                return 0;
+
+            frame_count = packet[1] & 0x3F;
+        }
+
+    return frame_size * frame_count;
+}
+#endif
+
+// paces sends on a monotonic timer instead of sleep polling voice client
+// buffer, one for each stream. closes its timer when going out of scope as
+// stream can exit by throwing anywhere
+struct stream_pacer_t
+{
+    // -1 falls back to sleeping
+    int timer_fd;
+
+    // TFD_NONBLOCK for streams driven by stream scheduler, they only read
+    // the timer after it's readable
+    stream_pacer_t (const int flags = 0)
+    {
+        timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | flags);
+
+        if (timer_fd == -1)
+            perror ("[Manager::stream ERROR] timerfd_create");
+    }
+
+    ~stream_pacer_t () { close_valid_fd (&timer_fd); }
+
+    stream_pacer_t (const stream_pacer_t &) = delete;
+    stream_pacer_t &operator= (const stream_pacer_t &) = delete;
 };
 
+// one-shot expiry after wait_ms, returns 0 on success
+static int
+set_pacer_timer (stream_pacer_t &pacer, const long wait_ms)
+{
+    if (pacer.timer_fd == -1)
+        return -1;
+
+    struct itimerspec its;
+    memset (&its, 0, sizeof (its));
+    its.it_value.tv_sec = wait_ms / 1000;
+    its.it_value.tv_nsec = (wait_ms % 1000) * 1000000;
+
+    return timerfd_settime (pacer.timer_fd, 0, &its, NULL);
+}
+
+// returns 0 when voice client buffer is below STREAM_TARGET_BUFFER_MS and
+// more audio should be sent. otherwise arms pacer timer to expire when it's
+// expected to drain to target or after STREAM_PACER_MAX_WAIT_MS, whichever
+// is sooner, and returns 1. returns -1 when it had to sleep instead
+static int
+arm_pacer (stream_pacer_t &pacer, dpp::discord_voice_client *v)
+{
+    const long buffered_ms = (long)(v->get_secs_remaining () * 1000.0f);
+    const long over_ms = buffered_ms - STREAM_TARGET_BUFFER_MS;
+
+    if (over_ms <= 0)
+        return 0;
+
+    // voice client drains in real time
+    const long wait_ms
+        = over_ms < STREAM_PACER_MAX_WAIT_MS ? over_ms
+                                             : STREAM_PACER_MAX_WAIT_MS;
+
+    if (set_pacer_timer (pacer, wait_ms) == 0)
+        return 1;
+
+    std::this_thread::sleep_for (std::chrono::milliseconds (wait_ms));
+    return -1;
+}
+
+// consume expiry of a nonblocking pacer timer so it can be waited for again
+static void
+clear_pacer (stream_pacer_t &pacer)
+{
+    uint64_t expirations;
+
+    if (pacer.timer_fd != -1)
+        read (pacer.timer_fd, &expirations, sizeof (expirations));
+}
+
+// returns true when voice client buffer is below STREAM_TARGET_BUFFER_MS
+// and more audio should be sent. otherwise blocks until pacer timer expires
+// and returns false for the caller to recheck its states
+static bool
+pace_stream (stream_pacer_t &pacer, dpp::discord_voice_client *v)
+{
+    const int status = arm_pacer (pacer, v);
+
+    if (status == 0)
+        return true;
+
+    if (status == -1)
+        return false;
+
+    uint64_t expirations;
+    while (read (pacer.timer_fd, &expirations, sizeof (expirations)) == -1
+           && errno == EINTR)
+        ;
+
+    return false;
+}
+
 struct handle_effect_chain_change_states_t
 {
     std::shared_ptr<Player> &guild_player;
@@ -57,11 +215,23 @@ struct handle_effect_chain_change_states_t
     int &command_fd;
     int &read_fd;
     OGGZ *track_og;
+    // audio stream when using shared memory transport
+    audio_ring::ring_t *ring;
+    // whether next track processor is already requested
+    bool preroll_requested;
+    // seek drain is left to the caller as it must not block
+    bool defer_drain;
+    // output from before seek still has to be drained by the caller
+    bool drain_pending;
+    // drain read less than a chunk once
+    bool drain_short_read;
+    std::chrono::steady_clock::time_point drain_until;
 };
 
 struct run_stream_loop_states_t
 {
     dpp::discord_voice_client *&v;
+    stream_pacer_t &pacer;
     player::MCTrack &track;
     dpp::snowflake &server_id;
     OGGZ *&track_og;
@@ -70,6 +240,26 @@ struct run_stream_loop_states_t
     bool &debug;
 };
 
+// request next track processor once when current track is about to end
+static void
+check_preroll (Manager *manager, const std::shared_ptr<Player> &guild_player,
+               const player::MCTrack &track, bool &requested)
+{
+    if (requested)
+        return;
+
+    const int64_t duration = track.index && track.index->duration_ms
+                                 ? track.index->duration_ms
+                                 : track.info.duration ();
+
+    if (!duration
+        || duration - guild_player->clock.get_ms () > PREROLL_BEFORE_END_MS)
+        return;
+
+    requested = true;
+    manager->preroll_next_track (guild_player->guild_id);
+}
+
 void
 handle_effect_chain_change (handle_effect_chain_change_states_t &states)
 {
@@ -80,13 +270,18 @@ handle_effect_chain_change (handle_effect_chain_change_states_t &states)
 
     if (track_seek_queried)
         {
-            const std::string cmd = cc::command_options_keys_t.command + '='
-                                    + cc::command_options_keys_t.seek + ';'
-                                    + cc::command_options_keys_t.seek + '='
-                                    + states.track.seek_to + ';';
+            cc::command_t cmd = cc::create_command ();
+            cc::add_str_option (cmd, cc::CMD_KEY_COMMAND,
+                                cc::command_options_keys_t.seek);
+            cc::add_str_option (cmd, cc::CMD_KEY_SEEK, states.track.seek_to);
 
             cc::write_command (cmd, states.command_fd, "Manager::stream");
 
+            const int64_t seek_ms
+                = util::seek_str_to_ms (states.track.seek_to);
+            if (seek_ms >= 0)
+                states.guild_player->clock.reset (seek_ms);
+
             states.track.seek_to = "";
 
             // struct pollfd nfds[1];
@@ -123,11 +318,11 @@ handle_effect_chain_change (handle_effect_chain_change_states_t &states)
 
     if (volume_queried)
         {
-            const std::string cmd
-                = cc::command_options_keys_t.command + '='
-                  + cc::command_options_keys_t.volume + ';'
-                  + cc::command_options_keys_t.volume + '='
-                  + std::to_string (states.guild_player->set_volume) + ';';
+            cc::command_t cmd = cc::create_command ();
+            cc::add_str_option (cmd, cc::CMD_KEY_COMMAND,
+                                cc::command_options_keys_t.volume);
+            cc::add_int_option (cmd, cc::CMD_KEY_VOLUME,
+                                states.guild_player->set_volume);
 
             cc::write_command (cmd, states.command_fd, "Manager::stream");
 
@@ -145,11 +340,10 @@ handle_effect_chain_change (handle_effect_chain_change_states_t &states)
                       ? ""
                       : states.guild_player->set_equalizer;
 
-            const std::string cmd
-                = cc::command_options_keys_t.command + '='
-                  + cc::command_options_keys_t.helper_chain + ';'
-                  + cc::command_options_keys_t.helper_chain + '='
-                  + cc::sanitize_command_value (new_equalizer) + ';';
+            cc::command_t cmd = cc::create_command ();
+            cc::add_str_option (cmd, cc::CMD_KEY_COMMAND,
+                                cc::command_options_keys_t.helper_chain);
+            cc::add_str_option (cmd, cc::CMD_KEY_HELPER_CHAIN, new_equalizer);
 
             cc::write_command (cmd, states.command_fd, "Manager::stream");
 
@@ -167,6 +361,46 @@ handle_effect_chain_change (handle_effect_chain_change_states_t &states)
 
     //////////////////////////////////////////////////
 
+    if (no_send && states.defer_drain)
+        {
+            states.drain_pending = true;
+            states.drain_short_read = false;
+            states.drain_until
+                = std::chrono::steady_clock::now ()
+                  + std::chrono::milliseconds (DRAIN_WAIT_MS);
+
+            return;
+        }
+
+#ifdef MUSICAT_USE_SHM_RING
+    if (no_send && states.ring)
+        {
+            size_t drain_size = 0;
+            bool less_buffer_encountered = false;
+
+            // the same drain routine as fifo below
+            while ((drain_size
+                    = audio_ring::wait_ring (*states.ring, DRAIN_WAIT_MS))
+                   > 0)
+                {
+                    if (drain_size > (size_t)DRAIN_CHUNK)
+                        drain_size = DRAIN_CHUNK;
+
+                    audio_ring::consume_ring (*states.ring, drain_size);
+
+                    if (drain_size < (size_t)DRAIN_CHUNK)
+                        {
+                            if (less_buffer_encountered)
+                                break;
+
+                            less_buffer_encountered = true;
+                        }
+                }
+
+            return;
+        }
+#endif
+
     if (no_send)
         {
             //////////////////////////////////////////////////
@@ -178,7 +412,7 @@ handle_effect_chain_change (handle_effect_chain_change_states_t &states)
             pfds[0].events = POLLIN;
             pfds[0].fd = states.read_fd;
 
-            int has_event = poll (pfds, 1, 1000);
+            int has_event = poll (pfds, 1, DRAIN_WAIT_MS);
             bool drain_ready = (has_event > 0) && (pfds[0].revents & POLLIN);
 
             //////////////////////////////////////////////////
@@ -207,7 +441,7 @@ handle_effect_chain_change (handle_effect_chain_change_states_t &states)
                             less_buffer_encountered = true;
                         }
 
-                    has_event = poll (pfds, 1, 1000);
+                    has_event = poll (pfds, 1, DRAIN_WAIT_MS);
                     drain_ready
                         = (has_event > 0) && (pfds[0].revents & POLLIN);
                 }
@@ -265,6 +499,9 @@ run_stream_loop (Manager *manager, run_stream_loop_states_t &states,
 
             states.track.current_byte += read_bytes;
 
+            check_preroll (manager, effect_states.guild_player, states.track,
+                           effect_states.preroll_requested);
+
             if (states.debug)
                 std::cerr << "[Manager::stream] "
                              "[guild_id] [size] "
@@ -274,12 +511,8 @@ run_stream_loop (Manager *manager, run_stream_loop_states_t &states,
 
             while ((states.running_state = get_running_state ()) && states.v
                    && !states.v->terminating
-                   && states.v->get_secs_remaining ()
-                          > DPP_AUDIO_BUFFER_LENGTH_SECOND)
-                {
-                    std::this_thread::sleep_for (std::chrono::milliseconds (
-                        SLEEP_ON_BUFFER_THRESHOLD_MS));
-                }
+                   && !pace_stream (states.pacer, states.v))
+                ;
 
             // eof
             if (!read_bytes)
@@ -287,402 +520,1639 @@ run_stream_loop (Manager *manager, run_stream_loop_states_t &states,
         }
 }
 
-constexpr const char *msprrfmt
-    = "[Manager::stream ERROR] Processor not ready or exited: %s\n";
+#if defined(MUSICAT_USE_PCM) && defined(MUSICAT_OPUS_PASSTHROUGH)
 
-void
-Manager::stream (dpp::discord_voice_client *v, player::MCTrack &track)
+struct mc_oggz_passthrough_user_data
 {
-    const string &fname = track.filename;
+    dpp::discord_voice_client *voice_client;
+    // OpusHead pre-skip, in 48kHz samples
+    int64_t pre_skip;
+    // granule position of the last sent page
+    int64_t granulepos;
+    // OpusHead found, seeking needs it to be read first
+    bool header_read;
+    playback_clock_t *clock;
+};
 
-    dpp::snowflake server_id = 0;
-    std::chrono::high_resolution_clock::time_point start_time;
+// passthrough stream driven by stream scheduler, owned by it until it ends
+struct passthrough_stream_states_t
+{
+    Manager *manager;
+    dpp::discord_voice_client *v;
+    player::MCTrack &track;
+    std::shared_ptr<Player> guild_player;
+    dpp::snowflake server_id;
+    std::string file_path;
+    stream_end_t on_end;
 
-    const string music_folder_path = get_music_folder_path ();
-    const string file_path = music_folder_path + fname;
+    stream_pacer_t pacer;
+    OGGZ *track_og;
+    mc_oggz_passthrough_user_data data;
+
+    bool running_state;
+    bool is_stopping;
+    bool debug;
+    bool preroll_requested;
+    // processor is needed to continue playback
+    bool needs_processor;
+
+    passthrough_stream_states_t (Manager *manager,
+                                 dpp::discord_voice_client *v,
+                                 player::MCTrack &track,
+                                 std::shared_ptr<Player> guild_player,
+                                 const std::string &file_path,
+                                 const stream_end_t &on_end,
+                                 const bool debug)
+        : manager (manager), v (v), track (track),
+          guild_player (guild_player), server_id (v->server_id),
+          file_path (file_path), on_end (on_end), pacer (TFD_NONBLOCK),
+          track_og (NULL), data{ v, 0, 0, false, &guild_player->clock },
+          running_state (true), is_stopping (false), debug (debug),
+          preroll_requested (false), needs_processor (false)
+    {
+    }
+};
 
-    if (v && !v->terminating && v->is_ready ())
-        {
-            bool debug = get_debug_state ();
+inline constexpr const char opus_head_magic[] = "OpusHead";
+inline constexpr const char opus_tags_magic[] = "OpusTags";
+inline constexpr const size_t opus_magic_size = sizeof (opus_head_magic) - 1;
 
-            server_id = v->server_id;
-            auto guild_player
-                = server_id ? this->get_player (server_id) : nullptr;
+// whether playback state can be sent without decoding. volume and
+// equalizer are the ones about to be applied
+static bool
+can_passthrough (const int volume, const bool has_equalizer,
+                 const player::MCTrack &track)
+{
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+    // gain needs processor
+    if (track.index && track.index->has_loudness
+        && loudness::get_gain_db (
+               { track.index->integrated_lufs, track.index->true_peak_dbtp })
+               != 0.0)
+        return false;
+#endif
 
-            if (!server_id || !guild_player)
-                throw 2;
+    return volume == 100 && !has_equalizer;
+}
 
-            FILE *ofile = fopen (file_path.c_str (), "r");
+// whether the current playback state can be sent without decoding
+static bool
+can_passthrough (const std::shared_ptr<Player> &guild_player,
+                 const player::MCTrack &track)
+{
+    const int volume = guild_player->set_volume != -1
+                           ? guild_player->set_volume
+                           : guild_player->volume;
 
-            if (!ofile)
-                {
-                    std::filesystem::create_directory (music_folder_path);
-                    throw 2;
-                }
+    const bool has_equalizer = guild_player->set_equalizer.empty ()
+                                   ? !guild_player->equalizer.empty ()
+                                   : guild_player->set_equalizer != "0";
 
-            struct stat ofile_stat;
-            if (fstat (fileno (ofile), &ofile_stat) != 0)
-                {
-                    fclose (ofile);
-                    ofile = NULL;
-                    throw 2;
-                }
+    return can_passthrough (volume, has_equalizer, track);
+}
 
-            fclose (ofile);
-            ofile = NULL;
+// apply queried state changes which doesn't need processor,
+// returns false when processor is needed to apply them
+static bool
+handle_passthrough_state_change (std::shared_ptr<Player> &guild_player,
+                                 const player::MCTrack &track)
+{
+    if (!can_passthrough (guild_player, track))
+        return false;
 
-            track.filesize = ofile_stat.st_size;
+    if (guild_player->set_volume != -1)
+        {
+            guild_player->volume = guild_player->set_volume;
+            guild_player->set_volume = -1;
+        }
 
-            std::string server_id_str = std::to_string (server_id);
-            std::string slave_id = "processor-" + server_id_str;
+    if (!guild_player->set_equalizer.empty ())
+        {
+            guild_player->equalizer = "";
+            guild_player->set_equalizer = "";
+        }
+
+    return true;
+}
 
-            std::string cmd
-                = cc::command_options_keys_t.id + '=' + slave_id + ';'
-                  + cc::command_options_keys_t.guild_id + '=' + server_id_str
+static int
+passthrough_read_callback (OGGZ *oggz, oggz_packet *packet, long serialno,
+                           void *user_data)
+{
+    mc_oggz_passthrough_user_data *data
+        = (mc_oggz_passthrough_user_data *)user_data;
 
-                  + ';' + cc::command_options_keys_t.command + '='
-                  + cc::command_execute_commands_t.create_audio_processor
-                  + ';';
+    const unsigned char *op_packet = packet->op.packet;
+    const long op_bytes = packet->op.bytes;
 
-            if (debug)
+    // header packets aren't audio, don't send them to discord
+    if (op_bytes >= (long)opus_magic_size)
+        {
+            if (memcmp (op_packet, opus_head_magic, opus_magic_size) == 0)
                 {
-                    cmd += cc::command_options_keys_t.debug + "=1;";
+                    // pre-skip is little endian uint16 at offset 10
+                    if (op_bytes >= 12)
+                        data->pre_skip
+                            = op_packet[10] | (op_packet[11] << 8);
+
+                    data->header_read = true;
+
+                    return 0;
                 }
 
-            cmd += cc::command_options_keys_t.file_path + '='
-                   + cc::sanitize_command_value (file_path) + ';'
+            if (memcmp (op_packet, opus_tags_magic, opus_magic_size) == 0)
+                return 0;
+        }
+
+    if (packet->op.granulepos > 0)
+        data->granulepos = packet->op.granulepos;
 
-                   + cc::command_options_keys_t.volume + '='
-                   + std::to_string (guild_player->volume) + ';';
+    data->voice_client->send_audio_opus (packet->op.packet, op_bytes);
+    data->clock->add_samples (get_opus_packet_samples (op_packet, op_bytes));
 
-            if (!guild_player->equalizer.empty ())
-                cmd += cc::command_options_keys_t.helper_chain + '='
-                       + cc::sanitize_command_value (guild_player->equalizer)
-                       + ';';
+    return 0;
+}
 
-            // !TODO: convert current byte to timestamp string
-            // + cc::command_options_keys_t.seek + '=' +
-            // track.current_byte
-            // + ';';
+// seek to the granule position of requested timestamp in the opened file,
+// returns 0 on success with track seek_to cleared
+static int
+handle_passthrough_seek (passthrough_stream_states_t &states)
+{
+    OGGZ *track_og = states.track_og;
+    mc_oggz_passthrough_user_data &data = states.data;
 
-            const std::string exit_cmd
-                = cc::command_options_keys_t.id + '=' + slave_id + ';'
-                  + cc::command_options_keys_t.command + '='
-                  + cc::command_execute_commands_t.shutdown + ';';
+    const int64_t seek_ms = util::seek_str_to_ms (states.track.seek_to);
 
-            cc::send_command (cmd);
+    if (seek_ms < 0)
+        return -1;
 
-            int status = cc::wait_slave_ready (slave_id, 10);
+    const track_index::index_entry_t *entry
+        = states.track.index
+              ? track_index::find_entry_by_ms (*states.track.index, seek_ms)
+              : nullptr;
 
-            if (status == child::worker::ready_status_t.ERR_SLAVE_EXIST)
-                {
-                    // status won't be 0 if this block is executed
-                    const std::string force_exit_cmd
-                        = exit_cmd + cc::command_options_keys_t.force + "=1;";
+    // indexed page offset, no bisection over the file needed
+    if (entry && seek_ms <= states.track.index->duration_ms)
+        {
+            const oggz_off_t offset
+                = oggz_seek (track_og, entry->byte_offset, SEEK_SET);
 
-                    cc::send_command (force_exit_cmd);
-                }
+            if (states.debug)
+                fprintf (stderr,
+                         "[Manager::stream] Passthrough indexed seek [to] "
+                         "[ms] [offset] [result]: '%s' %ld %ld %ld\n",
+                         states.track.seek_to.c_str (), seek_ms,
+                         entry->byte_offset, (int64_t)offset);
 
-            if (status != 0)
+            if (offset == entry->byte_offset)
                 {
-                    throw 2;
-                }
+                    states.v->stop_audio ();
 
-            const std::string fifo_stream_path
-                = audio_processing::get_audio_stream_fifo_path (slave_id);
+                    data.granulepos = entry->granulepos > data.pre_skip
+                                          ? entry->granulepos
+                                          : data.pre_skip;
 
-            const std::string fifo_command_path
-                = audio_processing::get_audio_stream_stdin_path (slave_id);
+                    states.track.current_byte = entry->byte_offset;
+                    states.track.seek_to = "";
 
-            const std::string fifo_notify_path
-                = audio_processing::get_audio_stream_stdout_path (slave_id);
+                    states.guild_player->clock.reset (
+                        track_index::granulepos_to_ms (*states.track.index,
+                                                       data.granulepos));
 
-            // OPEN FIFOS
-            int read_fd = open (fifo_stream_path.c_str (), O_RDONLY);
-            if (read_fd < 0)
-                {
-                    throw 2;
+                    return 0;
                 }
+        }
 
-            int command_fd = open (fifo_command_path.c_str (), O_WRONLY);
-            if (command_fd < 0)
-                {
-                    close (read_fd);
-                    throw 2;
-                }
+    const ogg_int64_t units = oggz_seek_units (track_og, seek_ms, SEEK_SET);
 
-            int notification_fd = open (fifo_notify_path.c_str (), O_RDONLY);
-            if (notification_fd < 0)
-                {
-                    close (read_fd);
-                    close (command_fd);
-                    throw 2;
-                }
+    if (states.debug)
+        fprintf (stderr,
+                 "[Manager::stream] Passthrough seek [to] [ms] [result]: "
+                 "'%s' %ld %ld\n",
+                 states.track.seek_to.c_str (), seek_ms, (int64_t)units);
 
-            // wait for processor notification
-            char nbuf[CMD_BUFSIZE + 1];
-            size_t nread_size = read (notification_fd, nbuf, CMD_BUFSIZE);
+    // past the end or unknown granule rate
+    if (units < 0)
+        return -1;
 
-            bool processor_read_ready = false;
-            if (nread_size > 0)
-                {
-                    if (std::string (nbuf) == "0")
-                        {
-                            processor_read_ready = true;
-                        }
-                }
+    // drop audio queued from the old position
+    states.v->stop_audio ();
 
-            handle_effect_chain_change_states_t effect_states
-                = { guild_player, track, command_fd, read_fd, NULL };
+    data.granulepos = data.pre_skip + (units * 48);
+    states.track.current_byte = oggz_tell (track_og);
+    states.track.seek_to = "";
 
-            int throw_error = 0;
-            bool running_state = get_running_state (), is_stopping;
+    states.guild_player->clock.reset (units);
 
-            if (!processor_read_ready)
-                {
-                    fprintf (stderr, msprrfmt, slave_id.c_str ());
-                    close (read_fd);
-                    close (command_fd);
-                    close (notification_fd);
-                    throw 2;
-                }
+    return 0;
+}
 
-                // I LOVE C++!!!
+static void start_processor_stream (Manager *manager,
+                                    dpp::discord_voice_client *v,
+                                    player::MCTrack &track,
+                                    std::shared_ptr<Player> guild_player,
+                                    const std::string &file_path,
+                                    std::string start_seek, const bool debug,
+                                    const stream_end_t &on_end);
+
+// open passthrough stream of the downloaded file, returns nullptr when file
+// can't be read
+static passthrough_stream_states_t *
+open_passthrough_stream (Manager *manager, dpp::discord_voice_client *v,
+                         player::MCTrack &track,
+                         std::shared_ptr<Player> guild_player,
+                         const std::string &file_path,
+                         const stream_end_t &on_end, const bool debug)
+{
+    // auto to have granule rate for seeking
+    OGGZ *track_og = oggz_open (file_path.c_str (), OGGZ_READ | OGGZ_AUTO);
 
-                // track.seekable = true;
+    if (!track_og)
+        {
+            fprintf (stderr,
+                     "[Manager::stream ERROR] Can't open file for "
+                     "passthrough: %ld '%s'\n",
+                     v->server_id, file_path.c_str ());
 
-                // using raw pcm need to change ffmpeg output format to s16le!
-#ifdef MUSICAT_USE_PCM
-            ssize_t read_size = 0;
-            ssize_t last_read_size = 0;
-            ssize_t total_read = 0;
-            uint8_t buffer[STREAM_BUFSIZ];
-
-            while ((running_state = get_running_state ())
-                   && ((read_size += read (read_fd, buffer + read_size,
-                                           STREAM_BUFSIZ - read_size))
-                       > 0))
-                {
-                    // if (track.seek_to > -1 && track.seekable)
+            return nullptr;
+        }
 
-                    // prevent infinite loop when done reading the last
-                    // straw of data
-                    const bool is_last_data
-                        = read_size < (ssize_t)STREAM_BUFSIZ
-                          && last_read_size == read_size;
+    passthrough_stream_states_t *states = new passthrough_stream_states_t (
+        manager, v, track, guild_player, file_path, on_end, debug);
 
-                    if ((is_stopping = is_stream_stopping (server_id))
-                        || is_last_data)
-                        {
-                            break;
-                        }
+    states->track_og = track_og;
 
-                    handle_effect_chain_change (effect_states);
+    oggz_set_read_callback (track_og, -1, passthrough_read_callback,
+                            (void *)&states->data);
 
-                    last_read_size = read_size;
+    return states;
+}
 
-                    if (read_size == STREAM_BUFSIZ)
-                        {
-                            total_read += read_size;
+// stream opus packets straight from the downloaded file until voice client
+// buffer is full, stream scheduler step
+static int
+step_passthrough_stream (void *data)
+{
+    passthrough_stream_states_t &states = *(passthrough_stream_states_t *)data;
 
-                            if ((debug = get_debug_state ()))
-                                fprintf (stderr, "Sending buffer: %ld %ld\n",
-                                         total_read, read_size);
+    clear_pacer (states.pacer);
 
-                            if (audio_processing::send_audio_routine (
-                                    v, (uint16_t *)buffer, &read_size))
-                                {
-                                    break;
-                                }
+    while ((states.running_state = get_running_state ()) && states.v
+           && !states.v->terminating)
+        {
+            if ((states.is_stopping
+                 = states.manager->is_stream_stopping (states.server_id)))
+                break;
 
-                            float outbuf_duration;
+            states.debug = get_debug_state ();
 
-                            while ((running_state = get_running_state ()) && v
-                                   && !v->terminating
-                                   && ((outbuf_duration
-                                        = v->get_secs_remaining ())
-                                       > DPP_AUDIO_BUFFER_LENGTH_SECOND))
-                                {
-                                    // isn't very pretty for the terminal,
-                                    // disable for now if ((debug =
-                                    // get_debug_state ()))
-                                    //     {
-                                    //         static std::chrono::time_point
-                                    //             start_time
-                                    //             = std::chrono::
-                                    //                 high_resolution_clock::
-                                    //                     now ();
-
-                                    //         auto end_time = std::chrono::
-                                    //             high_resolution_clock::now
-                                    //             ();
-
-                                    //         auto done
-                                    //             =
-                                    //             std::chrono::duration_cast<
-                                    //                 std::chrono::
-                                    //                     milliseconds> (
-                                    //                 end_time - start_time);
-
-                                    //         start_time = end_time;
-
-                                    //         fprintf (
-                                    //             stderr,
-                                    //             "[audio_processing::send_"
-                                    //             "audio_routine] "
-                                    //             "outbuf_duration: %f >
-                                    //             %f\n", outbuf_duration,
-                                    //             DPP_AUDIO_BUFFER_LENGTH_SECOND);
-
-                                    //         fprintf (stderr,
-                                    //                  "[audio_processing::send_"
-                                    //                  "audio_routine] Delay "
-                                    //                  "between send: %ld "
-                                    //                  "milliseconds\n",
-                                    //                  done.count ());
-                                    //     }
-
-                                    handle_effect_chain_change (effect_states);
-
-                                    std::this_thread::sleep_for (
-                                        std::chrono::milliseconds (
-                                            SLEEP_ON_BUFFER_THRESHOLD_MS));
-                                }
-                        }
+            check_preroll (states.manager, states.guild_player, states.track,
+                           states.preroll_requested);
+
+            if (!handle_passthrough_state_change (states.guild_player,
+                                                  states.track))
+                {
+                    states.needs_processor = true;
+                    break;
                 }
 
-            if ((read_size > 0) && running_state && !is_stopping)
+            // seek is a jump in the same file instead of a processor restart
+            if (!states.track.seek_to.empty () && states.data.header_read
+                && handle_passthrough_seek (states) != 0)
                 {
-                    // ssize_t padding = STREAM_BUFSIZ - read_size;
+                    // let processor handle it
+                    states.needs_processor = true;
+                    break;
+                }
 
-                    // for (; read_size < STREAM_BUFSIZ; read_size++)
-                    //     {
-                    //         buffer[read_size] = 0;
-                    //     }
+            const int paced = arm_pacer (states.pacer, states.v);
 
-                    // if (debug)
-                    //     {
-                    //         fprintf (stderr, "Added padding: %ld\n",
-                    //                  padding);
-                    //     }
+            if (paced == 1)
+                return states.pacer.timer_fd;
 
-                    if (debug)
-                        fprintf (stderr, "Final buffer: %ld %ld\n",
-                                 (total_read += read_size), read_size);
+            if (paced == -1)
+                continue;
 
-                    audio_processing::send_audio_routine (
-                        v, (uint16_t *)buffer, &read_size, true);
-                }
+            const long read_bytes
+                = oggz_read (states.track_og, CHUNK_READ_OPUS);
 
-            close (read_fd);
+            if (states.debug)
+                std::cerr << "[Manager::stream] Passthrough "
+                             "[guild_id] [size] [read_bytes]: "
+                          << states.server_id << ' ' << states.track.filesize
+                          << ' ' << read_bytes << '\n';
 
-            // using raw pcm code ends here
-#else
-            // using OGGZ need to change ffmpeg output format to opus!
-            ofile = fdopen (read_fd, "r");
+            // eof or error
+            if (read_bytes <= 0)
+                break;
+        }
 
-            if (!ofile)
+    return -1;
+}
+
+// continue with processor from where passthrough stopped when an effect is
+// requested, stream scheduler end
+static void
+end_passthrough_stream (void *data)
+{
+    passthrough_stream_states_t *states = (passthrough_stream_states_t *)data;
+
+    oggz_close (states->track_og);
+    states->track_og = NULL;
+
+    if (!states->needs_processor)
+        {
+            if (!states->running_state || states->is_stopping)
                 {
-                    close (read_fd);
-                    close (command_fd);
-                    close (notification_fd);
-                    throw 2;
+                    // clear voice client buffer
+                    states->v->stop_audio ();
                 }
 
-            OGGZ *track_og = oggz_open_stdio (ofile, OGGZ_READ);
+            const stream_end_t on_end = states->on_end;
+            delete states;
+
+            on_end (0);
+            return;
+        }
 
-            if (track_og)
+    const int64_t resume_ms
+        = (states->data.granulepos - states->data.pre_skip) / 48;
+
+    // requested seek position is taken by processor
+    const std::string start_seek = states->track.seek_to.empty ()
+                                       ? util::ms_to_seek_str (resume_ms)
+                                       : "";
+
+    if (states->debug)
+        fprintf (stderr,
+                 "[Manager::stream] Passthrough falling back "
+                 "to processor at: %s\n",
+                 states->track.seek_to.empty ()
+                     ? start_seek.c_str ()
+                     : states->track.seek_to.c_str ());
+
+    // processor setup blocks, keep it off stream scheduler worker
+    std::thread tj (
+        [] (Manager *manager, dpp::discord_voice_client *v,
+            player::MCTrack *track, std::shared_ptr<Player> guild_player,
+            std::string file_path, std::string start_seek, bool debug,
+            stream_end_t on_end) {
+            thread_manager::DoneSetter tmds;
+
+            try
+                {
+                    start_processor_stream (manager, v, *track, guild_player,
+                                            file_path, start_seek, debug,
+                                            on_end);
+                }
+            catch (int e)
                 {
-                    mc_oggz_user_data data = { v, track, debug };
+                    on_end (e);
+                }
+        },
+        states->manager, states->v, &states->track, states->guild_player,
+        states->file_path, start_seek, states->debug, states->on_end);
 
-                    oggz_set_read_callback (
-                        track_og, -1,
-                        [] (OGGZ *oggz, oggz_packet *packet, long serialno,
-                            void *user_data) {
-                            mc_oggz_user_data *data
-                                = (mc_oggz_user_data *)user_data;
+    thread_manager::dispatch (tj);
 
-                            // if (data->debug)
-                            //     fprintf (stderr, "OGGZ Read Bytes: %ld\n ",
-                            //              packet->op.bytes);
+    delete states;
+}
 
-                            data->voice_client->send_audio_opus (
-                                packet->op.packet, packet->op.bytes);
+#endif
 
-                            // if (!data->track.seekable && packet->op.b_o_s ==
-                            // 0)
-                            //     {
-                            //         data->track.seekable = true;
-                            //     }
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+// check processor notification for end of input, closed notification
+// counts as ended too
+static bool
+poll_input_ended (const int notification_fd, const int timeout)
+{
+    struct pollfd pfds[1] = { { notification_fd, POLLIN, 0 } };
 
-                            return 0;
-                        },
-                        (void *)&data);
+    if (poll (pfds, 1, timeout) < 1)
+        return false;
 
-                    struct run_stream_loop_states_t states = {
-                        v,           track, server_id, track_og, running_state,
-                        is_stopping, debug,
-                    };
+    cc::command_options_t options = cc::create_command_options ();
 
-                    effect_states.track_og = track_og;
+    if (cc::read_command (notification_fd, options, "Manager::stream") != 1)
+        return true;
 
-                    // stream loop
-                    run_stream_loop (this, states, effect_states);
-                }
-            else
-                {
-                    fprintf (stderr,
-                             "[Manager::stream ERROR] Can't open file for "
-                             "reading: %ld '%s'\n",
-                             server_id, file_path.c_str ());
-                }
+    return options.command == PROCESSOR_NOTIFY_INPUT_END;
+}
+#endif
 
-            // read_fd already closed along with this
-            oggz_close (track_og);
-            track_og = NULL;
+#ifdef MUSICAT_USE_SHM_RING
 
-            // using OGGZ code ends here
-#endif
+struct run_ring_stream_loop_states_t
+{
+    dpp::discord_voice_client *&v;
+    stream_pacer_t &pacer;
+    audio_ring::ring_t &ring;
+    playback_clock_t &clock;
+    // persistent processor notifies end of input through this instead of
+    // closing the ring
+    int &notification_fd;
+    bool &input_ended;
+    dpp::snowflake &server_id;
+    bool &running_state;
+    bool &is_stopping;
+    bool &debug;
+};
 
-            close (command_fd);
-            command_fd = -1;
-            close (notification_fd);
-            notification_fd = -1;
+static void
+run_ring_stream_loop (Manager *manager, run_ring_stream_loop_states_t &states,
+                      handle_effect_chain_change_states_t &effect_states)
+{
+    // only used when a frame wraps around the end of the ring
+    uint8_t scratch[STREAM_BUFSIZ];
+    ssize_t total_read = 0;
 
-            if (debug)
-                std::cerr << "Exiting " << server_id << '\n';
+    while ((states.running_state = get_running_state ()) && states.v
+           && !states.v->terminating)
+        {
+            if ((states.is_stopping
+                 = manager->is_stream_stopping (states.server_id)))
+                break;
+
+            handle_effect_chain_change (effect_states);
 
-            // commented for testing purpose
-            cc::send_command (exit_cmd);
+            size_t read_size = 0;
+            const uint8_t *frame
+                = audio_ring::peek_ring (states.ring, scratch, STREAM_BUFSIZ,
+                                         &read_size,
+                                         SLEEP_ON_BUFFER_THRESHOLD_MS);
 
-            if (!running_state || is_stopping)
+            if (!read_size)
                 {
-                    // clear voice client buffer
-                    v->stop_audio ();
-                }
+                    // end of stream
+                    if (states.ring.header->writer_closed.load ())
+                        break;
 
-            auto end_time = std::chrono::high_resolution_clock::now ();
-            auto done = std::chrono::duration_cast<std::chrono::milliseconds> (
-                end_time - start_time);
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+                    if (!states.input_ended)
+                        states.input_ended
+                            = poll_input_ended (states.notification_fd, 0);
 
-            if (debug)
-                {
-                    fprintf (stderr, "Done streaming for %ld milliseconds\n",
-                             done.count ());
-                    // fprintf (stderr, "audio_processing status: %d\n",
-                    // status);
-                }
+                    if (!states.input_ended)
+                        continue;
 
-            if (throw_error != 0)
-                {
-                    throw throw_error;
+                    // send what's left of this track, can be less than
+                    // a full frame
+                    size_t rest_size = audio_ring::wait_ring (states.ring, 0);
+                    if (rest_size > STREAM_BUFSIZ)
+                        rest_size = STREAM_BUFSIZ;
+
+                    // whole s16le stereo samples only
+                    rest_size -= rest_size % 4;
+
+                    if (!rest_size)
+                        break;
+
+                    frame = audio_ring::peek_ring (states.ring, scratch,
+                                                   rest_size, &read_size, 0);
+
+                    if (!read_size)
+                        break;
+#else
+                    // timed out, recheck states
+                    continue;
+#endif
                 }
 
-            // if (status != audio_processing::SUCCESS)
-            //     throw 2;
-        }
-    else
-        throw 1;
+            ssize_t send_size = read_size;
+            total_read += send_size;
+
+            if ((states.debug = get_debug_state ()))
+                fprintf (stderr, "Sending buffer: %ld %ld\n", total_read,
+                         send_size);
+
+            // s16le stereo
+            states.clock.add_samples (send_size / 4);
+
+            // send straight from shared memory
+            const int status = audio_processing::send_audio_routine (
+                states.v, (uint16_t *)frame, &send_size);
+
+            audio_ring::consume_ring (states.ring, read_size);
+
+            if (status)
+                break;
+
+            check_preroll (manager, effect_states.guild_player,
+                           effect_states.track,
+                           effect_states.preroll_requested);
+
+            while ((states.running_state = get_running_state ()) && states.v
+                   && !states.v->terminating
+                   && !pace_stream (states.pacer, states.v))
+                {
+                    handle_effect_chain_change (effect_states);
+                }
+        }
+}
+
+#endif
+
+constexpr const char *msprrfmt
+    = "[Manager::stream ERROR] Processor not ready or exited: %s\n";
+
+static cc::command_t
+get_processor_exit_cmd (const std::string &slave_id, const bool force = false)
+{
+    cc::command_t cmd = cc::create_command ();
+    cc::add_str_option (cmd, cc::CMD_KEY_ID, slave_id);
+    cc::add_str_option (cmd, cc::CMD_KEY_COMMAND,
+                        cc::command_execute_commands_t.shutdown);
+
+    if (force)
+        cc::add_int_option (cmd, cc::CMD_KEY_FORCE, 1);
+
+    return cmd;
+}
+
+// close opened fifos and shut down the processor
+static void
+close_processor (processor_stream_t &processor)
+{
+    close_valid_fd (&processor.read_fd);
+    close_valid_fd (&processor.command_fd);
+    close_valid_fd (&processor.notification_fd);
+
+#ifdef MUSICAT_USE_SHM_RING
+    if (processor.ring.header)
+        {
+            // unblock processor if it's still writing
+            audio_ring::mark_reader_closed (processor.ring);
+            audio_ring::close_ring (processor.ring);
+        }
+#endif
+
+    cc::send_command (get_processor_exit_cmd (processor.slave_id),
+                      processor.guild_id);
+}
+
+// spawn processor and open its fifos, blocks until processor has its first
+// output ready. returns 0 on success
+static int
+open_processor (const std::string &slave_id, const uint64_t guild_id,
+                const std::string &file_path, const int volume,
+                const std::string &equalizer, const std::string &start_seek,
+                const bool debug, processor_stream_t &processor)
+{
+    cc::command_t cmd = cc::create_command ();
+    cc::add_str_option (cmd, cc::CMD_KEY_ID, slave_id);
+    cc::add_str_option (cmd, cc::CMD_KEY_GUILD_ID,
+                        std::to_string (guild_id));
+    cc::add_str_option (cmd, cc::CMD_KEY_COMMAND,
+                        cc::command_execute_commands_t.create_audio_processor);
+
+    if (debug)
+        {
+            cc::add_int_option (cmd, cc::CMD_KEY_DEBUG, 1);
+        }
+
+    cc::add_str_option (cmd, cc::CMD_KEY_FILE_PATH, file_path);
+    cc::add_int_option (cmd, cc::CMD_KEY_VOLUME, volume);
+
+    if (!equalizer.empty ())
+        cc::add_str_option (cmd, cc::CMD_KEY_HELPER_CHAIN, equalizer);
+
+    if (!start_seek.empty ())
+        cc::add_str_option (cmd, cc::CMD_KEY_SEEK, start_seek);
+
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+    const double normalize_gain = loudness::get_track_gain_db (file_path);
+    if (normalize_gain != 0.0)
+        cc::add_double_option (cmd, cc::CMD_KEY_NORMALIZE_GAIN,
+                               normalize_gain);
+#endif
+
+    // processor is ready once it has its first output
+    const spawn::time_point_t spawned_at = spawn::now ();
+
+    cc::send_command (cmd, guild_id);
+
+    int status = cc::wait_slave_ready (slave_id, 10);
+
+    if (status == child::worker::ready_status_t.ERR_SLAVE_EXIST)
+        {
+            // status won't be 0 if this block is executed
+            cc::send_command (get_processor_exit_cmd (slave_id, true),
+                              guild_id);
+        }
+
+    if (status != 0)
+        {
+            return -1;
+        }
+
+    processor = { slave_id, guild_id, file_path, volume, equalizer, -1, -1,
+                  -1, { nullptr, nullptr, 0 } };
+
+    cc::command_options_t notification = cc::create_command_options ();
+
+    // processor pipes came along with its ready status
+    int fds[cw::PROCESSOR_FD_MAX];
+    const size_t fd_count
+        = cc::take_slave_fds (slave_id, fds, cw::PROCESSOR_FD_MAX);
+
+    if (fd_count > cw::PROCESSOR_FD_COMMAND)
+        processor.command_fd = fds[cw::PROCESSOR_FD_COMMAND];
+
+    if (fd_count > cw::PROCESSOR_FD_NOTIFICATION)
+        processor.notification_fd = fds[cw::PROCESSOR_FD_NOTIFICATION];
+
+    // audio stream goes through ring when using shared memory transport,
+    // pipes only for control
+#ifdef MUSICAT_USE_SHM_RING
+    if (fd_count != cw::PROCESSOR_FD_STREAM)
+        goto err;
+
+    // created by worker before it reported ready
+    if (audio_ring::open_ring (slave_id, processor.ring) != 0)
+        goto err;
+#else
+    if (fd_count > cw::PROCESSOR_FD_STREAM)
+        processor.read_fd = fds[cw::PROCESSOR_FD_STREAM];
+
+    if (fd_count != cw::PROCESSOR_FD_MAX)
+        goto err;
+#endif
+
+    // wait for processor notification
+    if (cc::read_command (processor.notification_fd, notification,
+                          "Manager::stream")
+            == 1
+        && notification.command == PROCESSOR_NOTIFY_READY)
+        {
+            spawn::record_first_byte (spawn::CHILD_AUDIO_PROCESSOR,
+                                      spawned_at);
+            return 0;
+        }
+
+    fprintf (stderr, msprrfmt, slave_id.c_str ());
+
+err:
+    close_processor (processor);
+    return -1;
+}
+
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+// start reading another file in a running processor, blocks until its
+// first output is ready. returns 0 on success
+static int
+switch_processor_input (processor_stream_t &processor,
+                        const std::string &file_path,
+                        const std::string &start_seek)
+{
+    cc::command_t cmd = cc::create_command ();
+    cc::add_str_option (cmd, cc::CMD_KEY_COMMAND,
+                        cc::command_options_keys_t.file_path);
+    cc::add_str_option (cmd, cc::CMD_KEY_FILE_PATH, file_path);
+
+    if (!start_seek.empty ())
+        cc::add_str_option (cmd, cc::CMD_KEY_SEEK, start_seek);
+
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+    // always sent to reset the previous track gain
+    cc::add_double_option (cmd, cc::CMD_KEY_NORMALIZE_GAIN,
+                           loudness::get_track_gain_db (file_path));
+#endif
+
+    cc::write_command (cmd, processor.command_fd, "Manager::stream");
+
+    struct pollfd pfds[1] = { { processor.notification_fd, POLLIN, 0 } };
+
+    // same patience as waiting for a new processor
+    if (poll (pfds, 1, 10000) < 1)
+        {
+            fprintf (stderr, msprrfmt, processor.slave_id.c_str ());
+            return -1;
+        }
+
+    cc::command_options_t notification = cc::create_command_options ();
+
+    if (cc::read_command (processor.notification_fd, notification,
+                          "Manager::stream")
+            != 1
+        || notification.command != PROCESSOR_NOTIFY_READY)
+        return -1;
+
+    processor.file_path = file_path;
+
+    return 0;
+}
+#endif
+
+// stream of processor output, driven by stream scheduler with pcm fifo
+// transport and run in the setup thread by the others. owned by whichever
+// drives it until it ends
+struct processor_stream_states_t
+{
+    Manager *manager;
+    dpp::discord_voice_client *v;
+    player::MCTrack &track;
+    std::shared_ptr<Player> guild_player;
+    dpp::snowflake server_id;
+    stream_end_t on_end;
+
+    processor_stream_t processor;
+    stream_pacer_t pacer;
+    handle_effect_chain_change_states_t effect_states;
+
+#ifdef MUSICAT_USE_SHM_RING
+    audio_ring::ring_t stream_ring;
+#elif defined(MUSICAT_USE_PCM)
+    // buffered part of the next send
+    ssize_t read_size;
+    ssize_t total_read;
+    uint8_t buffer[STREAM_BUFSIZ];
+#endif
+
+    std::chrono::high_resolution_clock::time_point start_time;
+    bool running_state;
+    bool is_stopping;
+    bool debug;
+    // persistent processor done with this track's input
+    bool input_ended;
+    int throw_error;
+
+    processor_stream_states_t (Manager *manager,
+                               dpp::discord_voice_client *v,
+                               player::MCTrack &track,
+                               std::shared_ptr<Player> guild_player,
+                               const processor_stream_t &processor,
+                               const stream_end_t &on_end, const bool debug)
+        : manager (manager), v (v), track (track),
+          guild_player (guild_player), server_id (v->server_id),
+          on_end (on_end), processor (processor),
+#if defined(MUSICAT_USE_PCM) && !defined(MUSICAT_USE_SHM_RING)
+          pacer (TFD_NONBLOCK),
+#endif
+          effect_states{ this->guild_player,
+                         this->track,
+                         this->processor.command_fd,
+                         this->processor.read_fd,
+                         NULL,
+                         nullptr,
+                         false,
+#if defined(MUSICAT_USE_PCM) && !defined(MUSICAT_USE_SHM_RING)
+                         // driven by stream scheduler
+                         true,
+#else
+                         false,
+#endif
+                         false,
+                         false,
+                         {} },
+#ifdef MUSICAT_USE_SHM_RING
+          stream_ring (processor.ring),
+#elif defined(MUSICAT_USE_PCM)
+          read_size (0), total_read (0),
+#endif
+          start_time (std::chrono::high_resolution_clock::now ()),
+          running_state (get_running_state ()), is_stopping (false),
+          debug (debug), input_ended (false), throw_error (0)
+    {
+    }
+};
+
+#if defined(MUSICAT_USE_PCM) && !defined(MUSICAT_USE_SHM_RING)
+// discard processor output from before seek without blocking, returns fd
+// to wait for until more of it might come or -1 once it's drained
+static int
+step_seek_drain (processor_stream_states_t &states)
+{
+    handle_effect_chain_change_states_t &effect_states = states.effect_states;
+
+    char drain_buf[DRAIN_CHUNK];
+
+    while (true)
+        {
+            const ssize_t drain_size
+                = read (states.processor.read_fd, drain_buf, DRAIN_CHUNK);
+
+            if (drain_size > 0)
+                {
+                    effect_states.drain_until
+                        = std::chrono::steady_clock::now ()
+                          + std::chrono::milliseconds (DRAIN_WAIT_MS);
+
+                    // second short read is likely the end of it
+                    if (drain_size < DRAIN_CHUNK)
+                        {
+                            if (effect_states.drain_short_read)
+                                break;
+
+                            effect_states.drain_short_read = true;
+                        }
+
+                    continue;
+                }
+
+            if (drain_size == -1 && errno == EINTR)
+                continue;
+
+            // eof and errors are seen again by the read in step
+            if (drain_size == 0 || errno != EAGAIN)
+                break;
+
+            const long left_ms
+                = std::chrono::duration_cast<std::chrono::milliseconds> (
+                      effect_states.drain_until
+                      - std::chrono::steady_clock::now ())
+                      .count ();
+
+            if (left_ms <= 0)
+                break;
+
+            // keep seeing stop and effect changes while waiting
+            set_pacer_timer (states.pacer, left_ms < STREAM_PACER_MAX_WAIT_MS
+                                               ? left_ms
+                                               : STREAM_PACER_MAX_WAIT_MS);
+
+            return states.processor.read_fd;
+        }
+
+    effect_states.drain_pending = false;
+
+    return -1;
+}
+
+// read processor output and send it until voice client buffer is full,
+// stream scheduler step
+static int
+step_pcm_stream (void *data)
+{
+    processor_stream_states_t &states = *(processor_stream_states_t *)data;
+
+    clear_pacer (states.pacer);
+
+    while ((states.running_state = get_running_state ()) && states.v
+           && !states.v->terminating)
+        {
+            if ((states.is_stopping
+                 = states.manager->is_stream_stopping (states.server_id)))
+                break;
+
+            states.debug = get_debug_state ();
+
+            handle_effect_chain_change (states.effect_states);
+
+            if (states.effect_states.drain_pending)
+                {
+                    const int drain_fd = step_seek_drain (states);
+
+                    if (drain_fd != -1)
+                        return drain_fd;
+                }
+
+            const int paced = arm_pacer (states.pacer, states.v);
+
+            if (paced == 1)
+                return states.pacer.timer_fd;
+
+            if (paced == -1)
+                continue;
+
+            const ssize_t read_size
+                = read (states.processor.read_fd,
+                        states.buffer + states.read_size,
+                        STREAM_BUFSIZ - states.read_size);
+
+            if (read_size == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    if (errno != EAGAIN)
+                        break;
+
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+                    // processor never closes its output between inputs
+                    if (states.input_ended)
+                        break;
+
+                    // output written before the notification might still
+                    // be in the fifo
+                    if ((states.input_ended = poll_input_ended (
+                             states.processor.notification_fd, 0)))
+                        continue;
+
+                    // recheck the notification along with the output
+                    if (set_pacer_timer (states.pacer,
+                                         STREAM_PACER_MAX_WAIT_MS)
+                        == 0)
+                        return states.pacer.timer_fd;
+
+                    std::this_thread::sleep_for (
+                        std::chrono::milliseconds (STREAM_PACER_MAX_WAIT_MS));
+
+                    continue;
+#else
+                    // processor can stall for long, such as following a slow
+                    // download. keep seeing stop and effect changes meanwhile
+                    set_pacer_timer (states.pacer, STREAM_PACER_MAX_WAIT_MS);
+
+                    return states.processor.read_fd;
+#endif
+                }
+
+            // processor closed its output
+            if (read_size == 0)
+                break;
+
+            states.read_size += read_size;
+
+            if (states.read_size < (ssize_t)STREAM_BUFSIZ)
+                continue;
+
+            states.total_read += states.read_size;
+
+            if (states.debug)
+                fprintf (stderr, "Sending buffer: %ld %ld\n",
+                         states.total_read, states.read_size);
+
+            // s16le stereo
+            states.guild_player->clock.add_samples (states.read_size / 4);
+
+            if (audio_processing::send_audio_routine (
+                    states.v, (uint16_t *)states.buffer, &states.read_size))
+                {
+                    break;
+                }
+
+            check_preroll (states.manager, states.guild_player, states.track,
+                           states.effect_states.preroll_requested);
+        }
+
+    return -1;
+}
+#endif
+
+// send what's left, shut down or keep processor and report the end of
+// stream, also stream scheduler end
+static void
+end_processor_stream (void *data)
+{
+    processor_stream_states_t *states = (processor_stream_states_t *)data;
+    processor_stream_t &processor = states->processor;
+
+#if defined(MUSICAT_USE_PCM) && !defined(MUSICAT_USE_SHM_RING)
+    if ((states->read_size > 0) && states->running_state
+        && !states->is_stopping)
+        {
+            if (states->debug)
+                fprintf (stderr, "Final buffer: %ld %ld\n",
+                         (states->total_read += states->read_size),
+                         states->read_size);
+
+            states->guild_player->clock.add_samples (states->read_size / 4);
+
+            audio_processing::send_audio_routine (
+                states->v, (uint16_t *)states->buffer, &states->read_size,
+                true);
+        }
+#endif
+
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+    // only reusable when its input ran out, anything else might
+    // leave the rest of this track in its output
+    if (states->input_ended && states->running_state && !states->is_stopping
+        && !states->throw_error)
+        {
+            if (states->debug)
+                fprintf (stderr, "[Manager::stream] Keeping processor: %s\n",
+                         processor.slave_id.c_str ());
+
+            states->manager->keep_guild_processor (states->server_id,
+                                                   processor);
+        }
+    else
+        {
+            if (states->debug)
+                std::cerr << "Exiting " << states->server_id << '\n';
+
+            close_processor (processor);
+        }
+#else
+#ifdef MUSICAT_USE_SHM_RING
+    // unblock processor if it's still writing
+    audio_ring::mark_reader_closed (states->stream_ring);
+    audio_ring::close_ring (states->stream_ring);
+#endif
+
+    close_valid_fd (&processor.read_fd);
+    close_valid_fd (&processor.command_fd);
+    close_valid_fd (&processor.notification_fd);
+
+    if (states->debug)
+        std::cerr << "Exiting " << states->server_id << '\n';
+
+    // commented for testing purpose
+    cc::send_command (get_processor_exit_cmd (processor.slave_id),
+                      processor.guild_id);
+#endif
+
+    if (!states->running_state || states->is_stopping)
+        {
+            // clear voice client buffer
+            states->v->stop_audio ();
+        }
+
+    auto end_time = std::chrono::high_resolution_clock::now ();
+    auto done = std::chrono::duration_cast<std::chrono::milliseconds> (
+        end_time - states->start_time);
+
+    if (states->debug)
+        fprintf (stderr, "Done streaming for %ld milliseconds\n",
+                 done.count ());
+
+    const stream_end_t on_end = states->on_end;
+    const int throw_error = states->throw_error;
+
+    delete states;
+
+    on_end (throw_error);
+}
+
+// open processor of track and start streaming its output, on_end isn't
+// called when this throws
+static void
+start_processor_stream (Manager *manager, dpp::discord_voice_client *v,
+                        player::MCTrack &track,
+                        std::shared_ptr<Player> guild_player,
+                        const std::string &file_path, std::string start_seek,
+                        const bool debug, const stream_end_t &on_end)
+{
+    const dpp::snowflake server_id = v->server_id;
+
+    // start processor at the requested position instead of seeking
+    // right after it started
+    if (!track.seek_to.empty ())
+        {
+            start_seek = track.seek_to;
+            track.seek_to = "";
+
+            const int64_t start_ms = util::seek_str_to_ms (start_seek);
+            if (start_ms >= 0)
+                guild_player->clock.reset (start_ms);
+        }
+
+    processor_stream_t processor;
+
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+    // feed the next input to processor kept from the previous track
+    bool use_prerolled = false;
+
+    if (manager->take_guild_processor (server_id, processor))
+        {
+            use_prerolled
+                = switch_processor_input (processor, file_path, start_seek)
+                  == 0;
+
+            if (!use_prerolled)
+                close_processor (processor);
+            else if (debug)
+                fprintf (stderr, "[Manager::stream] Reusing processor: %s\n",
+                         processor.slave_id.c_str ());
+        }
+#else
+    // processor spawned ahead for this track is only usable when
+    // playing from the start with unchanged effects
+    bool use_prerolled = false;
+
+    if (start_seek.empty ())
+        use_prerolled = manager->take_prerolled_processor (
+            server_id, file_path, guild_player->volume,
+            guild_player->equalizer, processor);
+    else
+        manager->discard_prerolled_processor (server_id);
+
+    if (use_prerolled && debug)
+        fprintf (stderr, "[Manager::stream] Using prerolled processor: %s\n",
+                 processor.slave_id.c_str ());
+#endif
+
+    if (!use_prerolled
+        && open_processor (manager->get_processor_id (server_id),
+                           server_id, file_path, guild_player->volume,
+                           guild_player->equalizer, start_seek, debug,
+                           processor)
+               != 0)
+        {
+            throw 2;
+        }
+
+    processor_stream_states_t *states = new processor_stream_states_t (
+        manager, v, track, guild_player, processor, on_end, debug);
+
+    // I LOVE C++!!!
+
+    // track.seekable = true;
+
+#ifdef MUSICAT_USE_SHM_RING
+    states->effect_states.ring = &states->stream_ring;
+
+    run_ring_stream_loop_states_t ring_states
+        = { states->v,
+            states->pacer,
+            states->stream_ring,
+            states->guild_player->clock,
+            states->processor.notification_fd,
+            states->input_ended,
+            states->server_id,
+            states->running_state,
+            states->is_stopping,
+            states->debug };
+
+    run_ring_stream_loop (manager, ring_states, states->effect_states);
+
+    end_processor_stream (states);
+
+    // using raw pcm need to change ffmpeg output format to s16le!
+#elif defined(MUSICAT_USE_PCM)
+    // reading must never block stream scheduler worker
+    const int fl = fcntl (states->processor.read_fd, F_GETFL);
+    if (fl == -1
+        || fcntl (states->processor.read_fd, F_SETFL, fl | O_NONBLOCK) == -1)
+        perror ("[Manager::stream ERROR] fcntl");
+
+    stream_scheduler::submit (server_id,
+                              { (void *)states, step_pcm_stream,
+                                end_processor_stream,
+                                states->pacer.timer_fd });
+
+    // using raw pcm code ends here
+#else
+    // using OGGZ need to change ffmpeg output format to opus!
+    FILE *ofile = fdopen (states->processor.read_fd, "r");
+
+    if (!ofile)
+        {
+            close_valid_fd (&states->processor.read_fd);
+            close_valid_fd (&states->processor.command_fd);
+            close_valid_fd (&states->processor.notification_fd);
+
+            delete states;
+            throw 2;
+        }
+
+    OGGZ *track_og = oggz_open_stdio (ofile, OGGZ_READ);
+
+    if (track_og)
+        {
+            mc_oggz_user_data data = { states->v, states->track,
+                                       states->debug,
+                                       states->guild_player->clock };
+
+            oggz_set_read_callback (
+                track_og, -1,
+                [] (OGGZ *oggz, oggz_packet *packet, long serialno,
+                    void *user_data) {
+                    mc_oggz_user_data *data = (mc_oggz_user_data *)user_data;
+
+                    // if (data->debug)
+                    //     fprintf (stderr, "OGGZ Read Bytes: %ld\n ",
+                    //              packet->op.bytes);
+
+                    data->voice_client->send_audio_opus (packet->op.packet,
+                                                         packet->op.bytes);
+
+                    data->clock.add_samples (get_opus_packet_samples (
+                        packet->op.packet, packet->op.bytes));
+
+                    // if (!data->track.seekable && packet->op.b_o_s ==
+                    // 0)
+                    //     {
+                    //         data->track.seekable = true;
+                    //     }
+
+                    return 0;
+                },
+                (void *)&data);
+
+            struct run_stream_loop_states_t loop_states
+                = { states->v,
+                    states->pacer,
+                    states->track,
+                    states->server_id,
+                    track_og,
+                    states->running_state,
+                    states->is_stopping,
+                    states->debug };
+
+            states->effect_states.track_og = track_og;
+
+            // stream loop
+            run_stream_loop (manager, loop_states, states->effect_states);
+        }
+    else
+        {
+            fprintf (stderr,
+                     "[Manager::stream ERROR] Can't open file for "
+                     "reading: %ld '%s'\n",
+                     server_id, file_path.c_str ());
+        }
+
+    // read_fd already closed along with this
+    if (track_og)
+        oggz_close (track_og);
+    else
+        fclose (ofile);
+
+    track_og = NULL;
+    states->processor.read_fd = -1;
+
+    end_processor_stream (states);
+
+    // using OGGZ code ends here
+#endif
+}
+
+void
+Manager::stream (dpp::discord_voice_client *v, player::MCTrack &track,
+                 const stream_end_t &on_end)
+{
+    const string &fname = track.filename;
+
+    dpp::snowflake server_id = 0;
+
+    const string music_folder_path = get_music_folder_path ();
+    const string file_path = music_folder_path + fname;
+
+    if (v && !v->terminating && v->is_ready ())
+        {
+            bool debug = get_debug_state ();
+
+            server_id = v->server_id;
+            auto guild_player
+                = server_id ? this->get_player (server_id) : nullptr;
+
+            if (!server_id || !guild_player)
+                throw 2;
+
+            FILE *ofile = fopen (file_path.c_str (), "r");
+
+            bool following = false;
+
+            // still downloading, processor follows the partial file until
+            // download is done
+            if (!ofile && download_manager::is_pending (fname))
+                {
+                    const string partial_path
+                        = download_manager::get_partial_path (fname);
+
+                    ofile = fopen (partial_path.c_str (), "r");
+                    following = ofile != NULL;
+                }
+
+            if (!ofile)
+                {
+                    std::filesystem::create_directory (music_folder_path);
+                    throw 2;
+                }
+
+            struct stat ofile_stat;
+            if (fstat (fileno (ofile), &ofile_stat) != 0)
+                {
+                    fclose (ofile);
+                    ofile = NULL;
+                    throw 2;
+                }
+
+            fclose (ofile);
+            ofile = NULL;
+
+            track.filesize = ofile_stat.st_size;
+
+            // entry is added once download is done when following
+            if (!following)
+                track_cache::record_play (fname);
+
+            // no index for partial file, seek falls back to ffmpeg
+            if (following)
+                track.index = nullptr;
+
+            // sidecar is normally written by download, build it here for
+            // files downloaded before indexing existed or replaced since
+            else if (!track.index
+                     || track.index->filesize != (int64_t)track.filesize)
+                {
+                    auto index
+                        = std::make_shared<track_index::track_index_t> ();
+
+                    if (track_index::load_index (file_path, *index) == 0)
+                        track.index = index;
+                    else
+                        track.index = nullptr;
+                }
+
+#ifdef MUSICAT_LOUDNESS_NORMALIZATION
+            // analyzer might have finished since index was loaded
+            if (!following && track.index && !track.index->has_loudness)
+                {
+                    auto index
+                        = std::make_shared<track_index::track_index_t> ();
+
+                    if (track_index::read_index (file_path, *index) == 0
+                        && index->has_loudness)
+                        track.index = index;
+                    else
+                        // for the next time it's played
+                        loudness::analyze_track (file_path);
+                }
+#endif
+
+            // audio of the previous track still buffered isn't counted
+            guild_player->clock.reset (0);
+
+            // prerolled one is spawned for the complete file
+            if (following)
+                this->discard_prerolled_processor (server_id);
+
+#if defined(MUSICAT_USE_PCM) && defined(MUSICAT_OPUS_PASSTHROUGH)
+            // ogg reader can't wait on a file still being written
+            if (!following && can_passthrough (guild_player, track))
+                {
+                    // not needed, don't leave it decoding
+                    this->discard_prerolled_processor (server_id);
+
+                    passthrough_stream_states_t *states
+                        = open_passthrough_stream (this, v, track,
+                                                   guild_player, file_path,
+                                                   on_end, debug);
+
+                    if (!states)
+                        throw 2;
+
+                    stream_scheduler::submit (server_id,
+                                              { (void *)states,
+                                                step_passthrough_stream,
+                                                end_passthrough_stream, -1 });
+
+                    return;
+                }
+#endif
+
+            start_processor_stream (this, v, track, guild_player, file_path,
+                                    "", debug, on_end);
+        }
+    else
+        throw 1;
+}
+
+std::string
+Manager::get_processor_id (const dpp::snowflake &guild_id)
+{
+    std::lock_guard<std::mutex> lk (this->pr_m);
+
+    // unique so next track processor can be spawned while current one is
+    // still running
+    return "processor-" + std::to_string (guild_id) + '-'
+           + std::to_string (++this->processor_seq);
+}
+
+void
+Manager::preroll_next_track (const dpp::snowflake &guild_id)
+{
+    std::thread tj (
+        [this] (dpp::snowflake guild_id) {
+            thread_manager::DoneSetter tmds;
+
+            auto guild_player = this->get_player (guild_id);
+            if (!guild_player)
+                return;
+
+            // the track handle_on_track_marker will play next and the state
+            // it will be played with, copied as the queue changes under
+            // t_mutex while this runs
+            MCTrack next_track;
+            int volume;
+            std::string equalizer;
+#if defined(MUSICAT_USE_PCM) && defined(MUSICAT_OPUS_PASSTHROUGH)
+            int set_volume;
+            std::string set_equalizer;
+#endif
+            {
+                std::lock_guard<std::mutex> lk (guild_player->t_mutex);
+
+                const size_t siz = guild_player->queue.size ();
+                if (!siz)
+                    return;
+
+                switch (guild_player->loop_mode)
+                    {
+                    case loop_mode_t::l_song:
+                    case loop_mode_t::l_song_queue:
+                        next_track = guild_player->queue.front ();
+                        break;
+
+                    case loop_mode_t::l_queue:
+                        next_track = guild_player->queue.at (siz > 1 ? 1 : 0);
+                        break;
+
+                    default:
+                        if (siz < 2)
+                            return;
+
+                        next_track = guild_player->queue.at (1);
+                    }
+
+                volume = guild_player->volume;
+                equalizer = guild_player->equalizer;
+#if defined(MUSICAT_USE_PCM) && defined(MUSICAT_OPUS_PASSTHROUGH)
+                set_volume = guild_player->set_volume;
+                set_equalizer = guild_player->set_equalizer;
+#endif
+            }
+
+            if (next_track.filename.empty ())
+                return;
+
+            const string file_path
+                = get_music_folder_path () + next_track.filename;
+
+            if (!track_catalog::exists (next_track.filename))
+                {
+                    // at least have it downloaded by the time it's played
+                    this->download (next_track.filename, next_track.url ());
+
+                    return;
+                }
+
+#if defined(MUSICAT_USE_PCM) && defined(MUSICAT_OPUS_PASSTHROUGH)
+            // queue copy has no index, its loudness decides passthrough
+            {
+                auto index = std::make_shared<track_index::track_index_t> ();
+
+                if (track_index::read_index (file_path, *index) == 0)
+                    next_track.index = index;
+            }
+
+            const bool has_equalizer = set_equalizer.empty ()
+                                           ? !equalizer.empty ()
+                                           : set_equalizer != "0";
+
+            // no processor needed
+            if (can_passthrough (set_volume != -1 ? set_volume : volume,
+                                 has_equalizer, next_track))
+                return;
+#endif
+
+#ifdef MUSICAT_PERSISTENT_PROCESSOR
+            // current processor takes the next track, only make sure
+            // it's downloaded
+            return;
+#endif
+
+            const bool debug = get_debug_state ();
+
+            processor_stream_t processor;
+            if (open_processor (this->get_processor_id (guild_id), guild_id,
+                                file_path, volume, equalizer, "", debug,
+                                processor)
+                != 0)
+                {
+                    fprintf (stderr,
+                             "[Manager::preroll_next_track ERROR] Failed "
+                             "prerolling '%s'\n",
+                             file_path.c_str ());
+
+                    return;
+                }
+
+            if (debug)
+                fprintf (stderr,
+                         "[Manager::preroll_next_track] Prerolled %s: '%s'\n",
+                         processor.slave_id.c_str (), file_path.c_str ());
+
+            processor_stream_t replaced;
+            bool has_replaced = false;
+            {
+                std::lock_guard<std::mutex> lk (this->pr_m);
+
+                auto i = this->prerolled_processors.find (guild_id);
+                if (i != this->prerolled_processors.end ())
+                    {
+                        replaced = i->second;
+                        has_replaced = true;
+                    }
+
+                this->prerolled_processors[guild_id] = processor;
+            }
+
+            if (has_replaced)
+                close_processor (replaced);
+        },
+        guild_id);
+
+    thread_manager::dispatch (tj);
+}
+
+bool
+Manager::take_prerolled_processor (const dpp::snowflake &guild_id,
+                                   const std::string &file_path,
+                                   const int volume,
+                                   const std::string &equalizer,
+                                   processor_stream_t &processor)
+{
+    processor_stream_t prerolled;
+    {
+        std::lock_guard<std::mutex> lk (this->pr_m);
+
+        auto i = this->prerolled_processors.find (guild_id);
+        if (i == this->prerolled_processors.end ())
+            return false;
+
+        prerolled = i->second;
+        this->prerolled_processors.erase (i);
+    }
+
+    // queue or effects changed after it's spawned
+    if (prerolled.file_path != file_path || prerolled.volume != volume
+        || prerolled.equalizer != equalizer)
+        {
+            close_processor (prerolled);
+            return false;
+        }
+
+    processor = prerolled;
+    return true;
+}
+
+void
+Manager::discard_prerolled_processor (const dpp::snowflake &guild_id)
+{
+    processor_stream_t prerolled;
+    {
+        std::lock_guard<std::mutex> lk (this->pr_m);
+
+        auto i = this->prerolled_processors.find (guild_id);
+        if (i == this->prerolled_processors.end ())
+            return;
+
+        prerolled = i->second;
+        this->prerolled_processors.erase (i);
+    }
+
+    close_processor (prerolled);
+}
+
+bool
+Manager::take_guild_processor (const dpp::snowflake &guild_id,
+                               processor_stream_t &processor)
+{
+    std::lock_guard<std::mutex> lk (this->pr_m);
+
+    auto i = this->guild_processors.find (guild_id);
+    if (i == this->guild_processors.end ())
+        return false;
+
+    processor = i->second;
+    this->guild_processors.erase (i);
+
+    return true;
+}
+
+void
+Manager::keep_guild_processor (const dpp::snowflake &guild_id,
+                               const processor_stream_t &processor)
+{
+    processor_stream_t replaced;
+    bool has_replaced = false;
+    {
+        std::lock_guard<std::mutex> lk (this->pr_m);
+
+        auto i = this->guild_processors.find (guild_id);
+        if (i != this->guild_processors.end ())
+            {
+                replaced = i->second;
+                has_replaced = true;
+            }
+
+        this->guild_processors[guild_id] = processor;
+    }
+
+    if (has_replaced)
+        close_processor (replaced);
+}
+
+void
+Manager::discard_guild_processor (const dpp::snowflake &guild_id)
+{
+    processor_stream_t processor;
+    {
+        std::lock_guard<std::mutex> lk (this->pr_m);
+
+        auto i = this->guild_processors.find (guild_id);
+        if (i == this->guild_processors.end ())
+            return;
+
+        processor = i->second;
+        this->guild_processors.erase (i);
+    }
+
+    close_processor (processor);
 }
 
 bool
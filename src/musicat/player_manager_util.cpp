@@ -1,9 +1,10 @@
 #include "musicat/cmds.h"
+#include "musicat/config.h"
 #include "musicat/db.h"
 #include "musicat/musicat.h"
 #include "musicat/player.h"
 #include "musicat/thread_manager.h"
-#include <dirent.h>
+#include "musicat/track_catalog.h"
 
 namespace musicat
 {
@@ -355,49 +356,50 @@ Manager::stop_stream (const dpp::snowflake &guild_id)
 bool
 Manager::is_waiting_file_download (const string &file_name)
 {
-    return this->waiting_file_download.find (file_name)
-           != this->waiting_file_download.end ();
+    return download_manager::is_pending (file_name);
 }
 
 void
 Manager::wait_for_download (const string &file_name)
 {
-    if (!this->is_waiting_file_download (file_name))
-        return;
-
-    std::unique_lock<std::mutex> lk (this->dl_m);
+    download_manager::wait (file_name);
+}
 
-    this->dl_cv.wait (lk, [this, file_name] () {
-        return this->waiting_file_download.find (file_name)
-               == this->waiting_file_download.end ();
-    });
+bool
+Manager::wait_for_playable (const string &file_name)
+{
+    return download_manager::wait_playable (file_name, PROGRESSIVE_MIN_BYTES)
+           == 1;
 }
 
-std::vector<std::string>
-Manager::get_available_tracks (const size_t &amount) const
+bool
+Manager::get_tracks_in_use (std::set<std::string> &in_use)
 {
-    std::vector<std::string> ret = {};
-    size_t c = 0;
-    auto dir = opendir (get_music_folder_path ().c_str ());
+    std::lock_guard<std::mutex> lk (this->ps_m);
 
-    if (dir != NULL)
+    for (const auto &i : this->players)
         {
-            auto file = readdir (dir);
-            while (file != NULL)
-                {
-                    if (file->d_type == DT_REG)
-                        {
-                            string s = string (file->d_name);
-                            ret.push_back (s.substr (0, s.length () - 5));
-                        }
-
-                    if (amount && ++c == amount)
-                        break;
-                    file = readdir (dir);
-                }
-            closedir (dir);
+            // held while waiting for download, don't wait for it
+            std::unique_lock<std::mutex> plk (i.second->t_mutex,
+                                              std::try_to_lock);
+
+            if (!plk.owns_lock ())
+                return false;
+
+            if (!i.second->current_track.filename.empty ())
+                in_use.insert (i.second->current_track.filename);
+
+            for (const MCTrack &track : i.second->queue)
+                in_use.insert (track.filename);
         }
-    return ret;
+
+    return true;
+}
+
+std::vector<std::string>
+Manager::get_available_tracks (const size_t &amount) const
+{
+    return track_catalog::get_names (amount);
 }
 
 bool
@@ -2,6 +2,7 @@
 #include "musicat/cmds.h"
 #include "musicat/config.h"
 #include "musicat/db.h"
+#include "musicat/download_manager.h"
 #include "musicat/function_macros.h"
 #include "musicat/musicat.h"
 #include "musicat/pagination.h"
@@ -9,7 +10,10 @@
 #include "musicat/runtime_cli.h"
 #include "musicat/server.h"
 #include "musicat/storage.h"
+#include "musicat/stream_scheduler.h"
 #include "musicat/thread_manager.h"
+#include "musicat/track_cache.h"
+#include "musicat/track_catalog.h"
 #include "musicat/util.h"
 #include "nekos-best++.hpp"
 #include "nlohmann/json.hpp"
@@ -372,6 +376,19 @@ get_ytdlp_exe ()
     return get_config_value<std::string> ("YTDLP_EXE", "");
 }
 
+int64_t
+get_music_cache_quota_mb ()
+{
+    return get_config_value<int64_t> ("MUSIC_CACHE_QUOTA_MB", 0);
+}
+
+// tracks track cache must not evict
+static bool
+get_tracks_in_use (std::set<std::string> &in_use)
+{
+    return !player_manager || player_manager->get_tracks_in_use (in_use);
+}
+
 int _sigint_count = 0;
 
 void
@@ -479,26 +496,17 @@ _handle_modal_p_que_s_track (const dpp::form_submit_t &event,
 
     bool dling = false;
 
-    std::ifstream test (get_music_folder_path () + fname,
-                        std::ios_base::in | std::ios_base::binary);
-
-    if (!test.is_open ())
+    if (!track_cache::lookup (fname))
         {
             dling = true;
             event.edit_response (
                 prepend_name
                 + util::response::reply_downloading_track (result.title ()));
 
-            if (player_manager->waiting_file_download.find (fname)
-                == player_manager->waiting_file_download.end ())
-                {
-                    auto url = result.url ();
-                    player_manager->download (fname, url, guild_id);
-                }
+            player_manager->download (fname, result.url ());
         }
     else
         {
-            test.close ();
             event.edit_response (edit_response);
         }
 
@@ -513,7 +521,7 @@ _handle_modal_p_que_s_track (const dpp::form_submit_t &event,
 
             if (dling)
                 {
-                    player_manager->wait_for_download (fname);
+                    player_manager->wait_for_playable (fname);
                     event.edit_response (edit_response);
                 }
 
@@ -652,6 +660,9 @@ run (int argc, const char *argv[])
 
     player_manager = std::make_shared<player::Manager> (&client);
 
+    track_catalog::init ();
+    track_cache::init (get_tracks_in_use);
+
     std::function<void (const dpp::log_t &)> dpp_on_log_handler
         = dpp::utility::cout_logger ();
 
@@ -1040,15 +1051,9 @@ run (int argc, const char *argv[])
 
                         if (guild_player && guild_player->queue.size ())
                             {
-                                int64_t to_seek
-                                    = guild_player->current_track.current_byte
-                                      - (BUFSIZ * 8);
-
-                                if (to_seek < 0)
-                                    to_seek = 0;
-
-                                guild_player->queue.front ().current_byte
-                                    = to_seek;
+                                guild_player->queue.front ().seek_to
+                                    = util::ms_to_seek_str (
+                                        guild_player->clock.get_ms ());
                             }
 
                         // rejoin channel
@@ -1070,9 +1075,6 @@ run (int argc, const char *argv[])
     });
 
     client.on_voice_buffer_send ([] (const dpp::voice_buffer_send_t &event) {
-#ifndef MUSICAT_USE_PCM
-        return;
-#endif
         auto manager = get_player_manager_ptr ();
         auto player = manager
                           ? manager->get_player (event.voice_client->server_id)
@@ -1081,19 +1083,14 @@ run (int argc, const char *argv[])
         if (!player)
             return;
 
-        if (player->current_track.current_byte
-            >= (INT64_MAX - event.buffer_size))
-            return;
-
-        static constexpr const double ratio = 1.3067854;
-
-        player->current_track.current_byte
-            += round ((double)event.buffer_size * ratio);
+        // audio sent so far is counted by stream, what's left in the
+        // buffer hasn't been played yet
+        player->clock.set_buffered (event.voice_client->get_secs_remaining ());
 
         if (get_debug_state ())
             fprintf (stderr,
-                     "[on_voice_buffer_send] size current_byte: %d %ld\n",
-                     event.buffer_size, player->current_track.current_byte);
+                     "[on_voice_buffer_send] size position_ms: %d %ld\n",
+                     event.buffer_size, player->clock.get_ms ());
     });
 
 #ifdef MUSICAT_WS_P_ETF
@@ -1113,8 +1110,10 @@ run (int argc, const char *argv[])
 
     time_t last_gc;
     time_t last_recon;
+    time_t last_cache;
     time (&last_gc);
     time (&last_recon);
+    time (&last_cache);
 
     while (get_running_state ())
         {
@@ -1158,9 +1157,29 @@ run (int argc, const char *argv[])
                                  status);
                 }
 
+            if (r_s && (time (NULL) - last_cache) > 60)
+                {
+                    track_cache::enforce_quota ();
+
+                    if (track_cache::save () != 0)
+                        fprintf (stderr,
+                                 "[ERROR TRACK_CACHE] Failed saving state\n");
+
+                    time (&last_cache);
+                }
+
             thread_manager::join_done ();
         }
 
+    download_manager::shutdown ();
+
+    // downloads finishing above are recorded
+    track_cache::save ();
+    track_catalog::shutdown ();
+
+    // streams still talk to child to shut down their processor
+    stream_scheduler::shutdown ();
+
     child::shutdown ();
 
     server::shutdown ();
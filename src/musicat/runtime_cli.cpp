@@ -1,6 +1,9 @@
 #include "musicat/runtime_cli.h"
+#include "musicat/download_manager.h"
 #include "musicat/musicat.h"
+#include "musicat/spawn.h"
 #include "musicat/thread_manager.h"
+#include "musicat/track_cache.h"
 #include <map>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +35,9 @@ static inline const std::map<std::pair<const char *, const char *>,
         { { "help", "-h" }, "Print this message" },
         { { "debug", "-d" }, "Toggle debug mode" },
         { { "clear", "-c" }, "Clear console" },
+        { { "spawn", "-s" }, "Print child spawn latency" },
+        { { "downloads", "-D" }, "Print queued and running downloads" },
+        { { "cache", "-C" }, "Print music folder usage and hit rate" },
     };
 
 int
@@ -122,6 +128,18 @@ attach_listener ()
                     {
                         system ("clear");
                     }
+                else if (cmd == "spawn" || cmd == "-s")
+                    {
+                        spawn::print_stats ();
+                    }
+                else if (cmd == "downloads" || cmd == "-D")
+                    {
+                        download_manager::print_jobs ();
+                    }
+                else if (cmd == "cache" || cmd == "-C")
+                    {
+                        track_cache::print_stats ();
+                    }
             }
     });
 
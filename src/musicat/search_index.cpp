@@ -0,0 +1,329 @@
+#include "musicat/search_index.h"
+#include <algorithm>
+#include <ctype.h>
+#include <string_view>
+
+namespace musicat
+{
+namespace search_index
+{
+
+// match kind dominates, the rest only orders matches of the same kind
+inline constexpr int64_t kind_weight = 1 << 24;
+// later and more scattered matches rank lower
+inline constexpr int64_t position_weight = 16;
+
+static uint32_t
+pack_trigram (const char *p)
+{
+    return ((uint32_t)(uint8_t)p[0] << 16) | ((uint32_t)(uint8_t)p[1] << 8)
+           | (uint32_t)(uint8_t)p[2];
+}
+
+static bool
+is_word_char (const unsigned char c)
+{
+    // utf-8 sequences are kept as is
+    return c >= 0x80 || isalnum (c);
+}
+
+std::string
+normalize (const std::string &str)
+{
+    std::string ret;
+    ret.reserve (str.size ());
+
+    bool pending_space = false;
+
+    for (const char ch : str)
+        {
+            const unsigned char c = (unsigned char)ch;
+
+            if (!is_word_char (c))
+                {
+                    pending_space = !ret.empty ();
+                    continue;
+                }
+
+            if (pending_space)
+                {
+                    ret += ' ';
+                    pending_space = false;
+                }
+
+            ret += (char)tolower (c);
+        }
+
+    return ret;
+}
+
+void
+build (index_t &index,
+       const std::vector<std::pair<std::string, std::string> > &candidates)
+{
+    index.entries.clear ();
+    index.word_keys.clear ();
+    index.trigrams.clear ();
+
+    index.entries.reserve (candidates.size ());
+
+    std::vector<uint32_t> entry_trigrams;
+
+    for (const auto &candidate : candidates)
+        {
+            const uint32_t pos = (uint32_t)index.entries.size ();
+
+            index.entries.push_back (
+                { candidate.first, candidate.second,
+                  normalize (candidate.first) });
+
+            const std::string &normalized = index.entries.back ().normalized;
+
+            for (size_t i = 0; i < normalized.size (); i++)
+                {
+                    if (i == 0 || normalized[i - 1] == ' ')
+                        index.word_keys.push_back ({ pos, (uint32_t)i });
+                }
+
+            entry_trigrams.clear ();
+            for (size_t i = 0; i + 3 <= normalized.size (); i++)
+                entry_trigrams.push_back (pack_trigram (&normalized[i]));
+
+            std::sort (entry_trigrams.begin (), entry_trigrams.end ());
+            entry_trigrams.erase (
+                std::unique (entry_trigrams.begin (), entry_trigrams.end ()),
+                entry_trigrams.end ());
+
+            // entries are visited in order, lists stay ascending
+            for (const uint32_t trigram : entry_trigrams)
+                index.trigrams[trigram].push_back (pos);
+        }
+
+    const std::vector<entry_t> &entries = index.entries;
+
+    std::sort (index.word_keys.begin (), index.word_keys.end (),
+               [&entries] (const word_key_t &a, const word_key_t &b) {
+                   return std::string_view (entries[a.entry].normalized)
+                              .substr (a.offset)
+                          < std::string_view (entries[b.entry].normalized)
+                                .substr (b.offset);
+               });
+}
+
+int64_t
+score (const std::string &query, const std::string &name, const bool fuzzy)
+{
+    if (query.empty () || query.size () > name.size ())
+        return 0;
+
+    const int64_t length_penalty = (int64_t)name.size ();
+
+    if (query == name)
+        return MATCH_EXACT * kind_weight;
+
+    size_t pos = name.find (query);
+
+    if (pos == 0)
+        return MATCH_PREFIX * kind_weight - length_penalty;
+
+    // first occurrence might be mid word while a later one starts a word
+    const size_t first_pos = pos;
+    while (pos != std::string::npos && name[pos - 1] != ' ')
+        pos = name.find (query, pos + 1);
+
+    if (pos != std::string::npos)
+        return MATCH_WORD_START * kind_weight
+               - (int64_t)pos * position_weight - length_penalty;
+
+    if (first_pos != std::string::npos)
+        return MATCH_SUBSTRING * kind_weight
+               - (int64_t)first_pos * position_weight - length_penalty;
+
+    if (!fuzzy)
+        return 0;
+
+    size_t start = std::string::npos;
+    size_t i = 0;
+
+    for (const char c : query)
+        {
+            while (i < name.size () && name[i] != c)
+                i++;
+
+            if (i == name.size ())
+                return 0;
+
+            if (start == std::string::npos)
+                start = i;
+
+            i++;
+        }
+
+    // characters skipped between first and last matched one
+    const int64_t gaps = (int64_t)(i - start - query.size ());
+
+    return MATCH_SUBSEQUENCE * kind_weight
+           - (gaps + (int64_t)start) * position_weight - length_penalty;
+}
+
+// add entries having every trigram of query, superset of entries containing
+// query
+static void
+collect_trigram_matches (const index_t &index, const std::string &query,
+                         std::vector<uint8_t> &seen,
+                         std::vector<uint32_t> &candidates)
+{
+    std::vector<const std::vector<uint32_t> *> lists;
+
+    for (size_t i = 0; i + 3 <= query.size (); i++)
+        {
+            auto list = index.trigrams.find (pack_trigram (&query[i]));
+
+            // no entry contains query
+            if (list == index.trigrams.end ())
+                return;
+
+            lists.push_back (&list->second);
+        }
+
+    std::sort (lists.begin (), lists.end (),
+               [] (const std::vector<uint32_t> *a,
+                   const std::vector<uint32_t> *b) {
+                   return a->size () < b->size ();
+               });
+
+    std::vector<uint32_t> matches = *lists[0];
+    std::vector<uint32_t> next;
+
+    for (size_t i = 1; i < lists.size () && !matches.empty (); i++)
+        {
+            next.clear ();
+            std::set_intersection (matches.begin (), matches.end (),
+                                   lists[i]->begin (), lists[i]->end (),
+                                   std::back_inserter (next));
+            matches.swap (next);
+        }
+
+    for (const uint32_t pos : matches)
+        {
+            if (!seen[pos])
+                {
+                    seen[pos] = 1;
+                    candidates.push_back (pos);
+                }
+        }
+}
+
+std::vector<std::pair<std::string, std::string> >
+search (const index_t &index, const std::string &query, const size_t limit,
+        const bool fuzzy)
+{
+    std::vector<std::pair<std::string, std::string> > ret;
+
+    const std::string q = normalize (query);
+
+    if (q.empty ())
+        {
+            const size_t count = std::min (limit, index.entries.size ());
+            ret.reserve (count);
+
+            for (size_t i = 0; i < count; i++)
+                ret.push_back (std::make_pair (index.entries[i].name,
+                                               index.entries[i].value));
+
+            return ret;
+        }
+
+    std::vector<uint8_t> seen (index.entries.size (), 0);
+    std::vector<uint32_t> candidates;
+
+    // prefix and word start matches
+    const std::string_view qv (q);
+    auto key = std::lower_bound (
+        index.word_keys.begin (), index.word_keys.end (), qv,
+        [&index] (const word_key_t &k, const std::string_view &v) {
+            return std::string_view (index.entries[k.entry].normalized)
+                       .substr (k.offset)
+                   < v;
+        });
+
+    for (; key != index.word_keys.end (); key++)
+        {
+            const std::string_view text
+                = std::string_view (index.entries[key->entry].normalized)
+                      .substr (key->offset);
+
+            if (text.compare (0, qv.size (), qv) != 0)
+                break;
+
+            if (!seen[key->entry])
+                {
+                    seen[key->entry] = 1;
+                    candidates.push_back (key->entry);
+                }
+        }
+
+    // substring matches, too short a query has no trigram to narrow them
+    // down and is left to the scan below
+    const bool short_query = q.size () < 3;
+    if (!short_query)
+        collect_trigram_matches (index, q, seen, candidates);
+
+    // best kind the scan below can't find
+    const int64_t scan_floor
+        = (short_query ? MATCH_SUBSTRING : MATCH_SUBSEQUENCE) * kind_weight;
+
+    std::vector<std::pair<int64_t, uint32_t> > scored;
+    scored.reserve (candidates.size ());
+
+    size_t above_scan = 0;
+
+    for (const uint32_t pos : candidates)
+        {
+            const int64_t s = score (q, index.entries[pos].normalized, fuzzy);
+            if (s > 0)
+                scored.push_back (std::make_pair (s, pos));
+
+            if (s > scan_floor)
+                above_scan++;
+        }
+
+    // every entry is only checked when it can still make it to the result
+    if (above_scan < limit && (short_query || fuzzy))
+        for (uint32_t pos = 0; pos < (uint32_t)index.entries.size (); pos++)
+            {
+                if (seen[pos])
+                    continue;
+
+                const int64_t s
+                    = score (q, index.entries[pos].normalized, fuzzy);
+                if (s > 0)
+                    scored.push_back (std::make_pair (s, pos));
+            }
+
+    const size_t count = std::min (limit, scored.size ());
+
+    std::partial_sort (
+        scored.begin (), scored.begin () + count, scored.end (),
+        [&index] (const std::pair<int64_t, uint32_t> &a,
+                  const std::pair<int64_t, uint32_t> &b) {
+            if (a.first != b.first)
+                return a.first > b.first;
+
+            return index.entries[a.second].name
+                   < index.entries[b.second].name;
+        });
+
+    ret.reserve (count);
+
+    for (size_t i = 0; i < count; i++)
+        {
+            const entry_t &entry = index.entries[scored[i].second];
+            ret.push_back (std::make_pair (entry.name, entry.value));
+        }
+
+    return ret;
+}
+
+} // search_index
+} // musicat
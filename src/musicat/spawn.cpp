@@ -0,0 +1,159 @@
+#include "musicat/spawn.h"
+#include "musicat/musicat.h"
+#include <fcntl.h>
+#include <mutex>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace musicat
+{
+namespace spawn
+{
+
+static std::mutex stats_m; // stats
+static stats_t stats[CHILD_TYPE_MAX] = {};
+
+static const char *const child_type_names[CHILD_TYPE_MAX]
+    = { "audio_processor", "processor_ffmpeg", "helper_ffmpeg",
+        "loudness_ffmpeg" };
+
+inline constexpr const char *spfmt
+    = "[spawn::spawn_process ERROR] Can't spawn %s: %s\n";
+
+pid_t
+spawn_process (const char *const argv[], const fd_map_t *fds,
+               const size_t fd_count, const bool null_stderr)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    pid_t pid = -1;
+    int status;
+
+    if (posix_spawn_file_actions_init (&actions) != 0)
+        return -1;
+
+    if (posix_spawnattr_init (&attr) != 0)
+        {
+            posix_spawn_file_actions_destroy (&actions);
+            return -1;
+        }
+
+    // mapped fds are kept
+    int close_from = STDERR_FILENO + 1;
+
+    for (size_t i = 0; i < fd_count; i++)
+        {
+            posix_spawn_file_actions_adddup2 (&actions, fds[i].fd,
+                                              fds[i].child_fd);
+
+            if (fds[i].child_fd >= close_from)
+                close_from = fds[i].child_fd + 1;
+        }
+
+    if (null_stderr)
+        posix_spawn_file_actions_addopen (&actions, STDERR_FILENO,
+                                          "/dev/null", O_WRONLY, 0);
+
+#if defined(__GLIBC__)                                                        \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    // whatever isn't O_CLOEXEC yet doesn't leak either
+    posix_spawn_file_actions_addclosefrom_np (&actions, close_from);
+#endif
+
+    // ignored signals and blocked mask survive exec
+    sigemptyset (&mask);
+    posix_spawnattr_setsigmask (&attr, &mask);
+
+    sigfillset (&mask);
+    sigdelset (&mask, SIGKILL);
+    sigdelset (&mask, SIGSTOP);
+    posix_spawnattr_setsigdefault (&attr, &mask);
+
+    posix_spawnattr_setflags (&attr,
+                              POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    // glibc spawns with CLONE_VM | CLONE_VFORK, caller memory isn't copied
+    status = posix_spawnp (&pid, argv[0], &actions, &attr, (char *const *)argv,
+                           environ);
+
+    if (status != 0)
+        {
+            fprintf (stderr, spfmt, argv[0], strerror (status));
+            pid = -1;
+        }
+
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&actions);
+
+    return pid;
+}
+
+time_point_t
+now ()
+{
+    return std::chrono::steady_clock::now ();
+}
+
+void
+record_first_byte (const child_type_t type, const time_point_t &spawned_at)
+{
+    if (type >= CHILD_TYPE_MAX)
+        return;
+
+    const uint64_t us = std::chrono::duration_cast<std::chrono::microseconds> (
+                            now () - spawned_at)
+                            .count ();
+
+    {
+        std::lock_guard<std::mutex> lk (stats_m);
+
+        stats_t &s = stats[type];
+        s.count++;
+        s.total_us += us;
+        s.last_us = us;
+
+        if (us > s.max_us)
+            s.max_us = us;
+    }
+
+    if (get_debug_state ())
+        fprintf (stderr, "[spawn] %s first byte after %lu us\n",
+                 child_type_names[type], us);
+}
+
+stats_t
+get_stats (const child_type_t type)
+{
+    if (type >= CHILD_TYPE_MAX)
+        return {};
+
+    std::lock_guard<std::mutex> lk (stats_m);
+    return stats[type];
+}
+
+void
+print_stats ()
+{
+    for (int i = 0; i < CHILD_TYPE_MAX; i++)
+        {
+            const stats_t s = get_stats ((child_type_t)i);
+
+            if (!s.count)
+                continue;
+
+            fprintf (stderr,
+                     "[spawn] %s: count %lu, avg %lu us, max %lu us, "
+                     "last %lu us\n",
+                     child_type_names[i], s.count, s.total_us / s.count,
+                     s.max_us, s.last_us);
+        }
+}
+
+} // spawn
+} // musicat
@@ -0,0 +1,329 @@
+#include "musicat/stream_scheduler.h"
+#include "musicat/config.h"
+#include "musicat/musicat.h"
+#include <atomic>
+#include <errno.h>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace musicat
+{
+namespace stream_scheduler
+{
+
+inline constexpr int worker_max_events = 64;
+
+struct entry_t
+{
+    stream_t stream;
+    // fd stream is currently waiting for
+    int fd;
+    // stream.timer_fd is watched along with fd
+    bool timer_watched;
+    // worker round it was last stepped in, its events left in that round
+    // are from before it was stepped
+    uint64_t round;
+    bool ended;
+};
+
+struct worker_t
+{
+    int epoll_fd;
+    // wakes worker to take submitted streams or exit, registered with null
+    // data
+    int wake_fd;
+    std::thread t;
+
+    std::mutex m; // pending, stopped
+    std::vector<stream_t> pending;
+    // worker no longer takes streams
+    bool stopped;
+
+    // only touched by worker thread
+    std::set<entry_t *> entries;
+    // epoll_wait calls so far
+    uint64_t round;
+    // freed once events of the current round are handled, they might still
+    // point to these
+    std::vector<entry_t *> ended;
+};
+
+// never shrinks once started so submit can read it without locking
+static std::vector<worker_t *> workers;
+static std::once_flag workers_flag;
+static std::atomic<bool> stopping (false);
+
+static void
+run_inline (const stream_t &stream)
+{
+    int fd;
+
+    while ((fd = stream.step (stream.data)) != -1)
+        {
+            struct pollfd pfds[2]
+                = { { fd, POLLIN, 0 }, { stream.timer_fd, POLLIN, 0 } };
+
+            const nfds_t nfds
+                = stream.timer_fd != -1 && stream.timer_fd != fd ? 2 : 1;
+
+            int n;
+            while ((n = poll (pfds, nfds, -1)) == -1 && errno == EINTR)
+                ;
+
+            if (n == -1)
+                {
+                    perror ("[stream_scheduler::run_inline ERROR] poll");
+                    break;
+                }
+        }
+
+    stream.end (stream.data);
+}
+
+static int
+watch_fd (worker_t *w, entry_t *e, const int fd)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = e;
+
+    return epoll_ctl (w->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void
+unwatch (worker_t *w, entry_t *e)
+{
+    if (e->fd != -1)
+        epoll_ctl (w->epoll_fd, EPOLL_CTL_DEL, e->fd, NULL);
+
+    if (e->timer_watched)
+        epoll_ctl (w->epoll_fd, EPOLL_CTL_DEL, e->stream.timer_fd, NULL);
+
+    e->timer_watched = false;
+}
+
+static void
+step_entry (worker_t *w, entry_t *e)
+{
+    e->round = w->round;
+    e->fd = e->stream.step (e->stream.data);
+
+    if (e->fd != -1)
+        {
+            if (watch_fd (w, e, e->fd) == 0)
+                {
+                    const int timer_fd = e->stream.timer_fd;
+
+                    e->timer_watched = timer_fd != -1 && timer_fd != e->fd
+                                       && watch_fd (w, e, timer_fd) == 0;
+                    return;
+                }
+
+            perror ("[stream_scheduler::step_entry ERROR] epoll_ctl");
+            e->fd = -1;
+        }
+
+    w->entries.erase (e);
+    e->stream.end (e->stream.data);
+
+    e->ended = true;
+    w->ended.push_back (e);
+}
+
+static void
+take_pending (worker_t *w)
+{
+    uint64_t count;
+    while (read (w->wake_fd, &count, sizeof (count)) == -1 && errno == EINTR)
+        ;
+
+    std::vector<stream_t> pending;
+    {
+        std::lock_guard<std::mutex> lk (w->m);
+        pending.swap (w->pending);
+    }
+
+    for (const stream_t &stream : pending)
+        {
+            entry_t *e = new entry_t{ stream, -1, false, 0, false };
+            w->entries.insert (e);
+
+            step_entry (w, e);
+        }
+}
+
+static void
+run_worker (worker_t *w)
+{
+    struct epoll_event events[worker_max_events];
+
+    while (!stopping.load ())
+        {
+            const int n
+                = epoll_wait (w->epoll_fd, events, worker_max_events, -1);
+
+            if (n == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    perror ("[stream_scheduler::run_worker ERROR] "
+                            "epoll_wait");
+                    break;
+                }
+
+            w->round++;
+
+            for (int i = 0; i < n; i++)
+                {
+                    if (!events[i].data.ptr)
+                        {
+                            take_pending (w);
+                            continue;
+                        }
+
+                    entry_t *e = (entry_t *)events[i].data.ptr;
+
+                    // both of its fds were ready, already stepped
+                    if (e->ended || e->round == w->round)
+                        continue;
+
+                    // stream might wait for another fd next
+                    unwatch (w, e);
+
+                    step_entry (w, e);
+                }
+
+            for (entry_t *e : w->ended)
+                delete e;
+
+            w->ended.clear ();
+        }
+
+    std::vector<stream_t> pending;
+    {
+        std::lock_guard<std::mutex> lk (w->m);
+        w->stopped = true;
+        pending.swap (w->pending);
+    }
+
+    // running state is unset by now, streams end on their next step
+    for (entry_t *e : w->entries)
+        {
+            unwatch (w, e);
+            run_inline (e->stream);
+            delete e;
+        }
+
+    for (entry_t *e : w->ended)
+        delete e;
+
+    w->ended.clear ();
+
+    w->entries.clear ();
+
+    for (const stream_t &stream : pending)
+        run_inline (stream);
+}
+
+static void
+start_workers ()
+{
+    size_t count = STREAM_WORKER_COUNT;
+    if (!count)
+        count = std::thread::hardware_concurrency ();
+    if (!count)
+        count = 1;
+
+    for (size_t i = 0; i < count; i++)
+        {
+            worker_t *w = new worker_t ();
+            w->stopped = false;
+            w->round = 0;
+            w->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+            w->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+
+            if (w->epoll_fd == -1 || w->wake_fd == -1
+                || epoll_ctl (w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &ev)
+                       == -1)
+                {
+                    perror ("[stream_scheduler::start_workers ERROR] "
+                            "Can't create worker");
+
+                    close_valid_fd (&w->epoll_fd);
+                    close_valid_fd (&w->wake_fd);
+                    delete w;
+                    break;
+                }
+
+            w->t = std::thread (run_worker, w);
+            workers.push_back (w);
+        }
+}
+
+void
+submit (const uint64_t guild_id, const stream_t &stream)
+{
+    std::call_once (workers_flag, start_workers);
+
+    bool queued = false;
+
+    if (!workers.empty ())
+        {
+            worker_t *w = workers[guild_id % workers.size ()];
+
+            std::lock_guard<std::mutex> lk (w->m);
+
+            if (!w->stopped)
+                {
+                    w->pending.push_back (stream);
+
+                    const uint64_t one = 1;
+                    write (w->wake_fd, &one, sizeof (one));
+
+                    queued = true;
+                }
+        }
+
+    if (!queued)
+        run_inline (stream);
+}
+
+void
+shutdown ()
+{
+    // no worker is started after this
+    std::call_once (workers_flag, [] () {});
+
+    stopping = true;
+
+    for (worker_t *w : workers)
+        {
+            const uint64_t one = 1;
+            write (w->wake_fd, &one, sizeof (one));
+        }
+
+    for (worker_t *w : workers)
+        {
+            if (w->t.joinable ())
+                w->t.join ();
+
+            std::lock_guard<std::mutex> lk (w->m);
+            close_valid_fd (&w->epoll_fd);
+            close_valid_fd (&w->wake_fd);
+        }
+}
+
+} // stream_scheduler
+} // musicat
@@ -0,0 +1,484 @@
+#include "musicat/track_cache.h"
+#include "musicat/config.h"
+#include "musicat/download_manager.h"
+#include "musicat/musicat.h"
+#include "musicat/track_catalog.h"
+#include "musicat/track_index.h"
+#include <algorithm>
+#include <errno.h>
+#include <limits.h>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace musicat
+{
+namespace track_cache
+{
+
+inline constexpr const char state_magic[8] = { 'M', 'C', 'T', 'C',
+                                               'A', 'C', 'H', 'E' };
+inline constexpr uint32_t state_version = 1;
+
+inline constexpr const char state_file_name[] = ".track_cache";
+
+// state file header, native endian as it never leaves the machine
+struct state_file_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entry_count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// followed by name_len bytes of file name
+struct state_file_entry_t
+{
+    int64_t bytes;
+    int64_t last_access;
+    uint32_t play_count;
+    uint32_t name_len;
+};
+
+static std::map<std::string, entry_t> entries;
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t evictions = 0;
+// entries or counters changed since last save
+static bool dirty = false;
+static in_use_fn_t get_in_use = nullptr;
+static std::mutex m; // everything above
+
+static int64_t
+get_quota_bytes ()
+{
+    const int64_t quota_mb = get_music_cache_quota_mb ();
+
+    return quota_mb > 0 ? quota_mb * 1024 * 1024 : 0;
+}
+
+// size of track and its sidecar, -1 when track isn't in music folder
+static int64_t
+get_track_bytes (const std::string &fname)
+{
+    track_catalog::track_t track;
+    if (!track_catalog::get (fname, track))
+        return -1;
+
+    return track.filesize + track.index_size;
+}
+
+// returns nullptr and drops its entry when track isn't in music folder.
+// caller must lock m
+static entry_t *
+touch_entry (const std::string &fname, const time_t now)
+{
+    const int64_t bytes = get_track_bytes (fname);
+
+    auto i = entries.find (fname);
+
+    if (bytes < 0)
+        {
+            if (i != entries.end ())
+                {
+                    entries.erase (i);
+                    dirty = true;
+                }
+
+            return nullptr;
+        }
+
+    if (i == entries.end ())
+        i = entries.insert ({ fname, { fname, bytes, now, 0 } }).first;
+
+    i->second.bytes = bytes;
+    i->second.last_access = now;
+    dirty = true;
+
+    return &i->second;
+}
+
+static int
+load_state (const std::string &state_path,
+            std::map<std::string, entry_t> &saved)
+{
+    FILE *f = fopen (state_path.c_str (), "rb");
+    if (!f)
+        return -1;
+
+    state_file_header_t header;
+    int status = -1;
+
+    if (fread (&header, sizeof (header), 1, f) != 1
+        || memcmp (header.magic, state_magic, sizeof (header.magic)) != 0
+        || header.version != state_version)
+        goto exit;
+
+    for (uint64_t i = 0; i < header.entry_count; i++)
+        {
+            state_file_entry_t file_entry;
+            if (fread (&file_entry, sizeof (file_entry), 1, f) != 1
+                || file_entry.name_len == 0 || file_entry.name_len > NAME_MAX)
+                goto exit;
+
+            std::string fname (file_entry.name_len, '\0');
+            if (fread (&fname[0], 1, file_entry.name_len, f)
+                != file_entry.name_len)
+                goto exit;
+
+            saved[fname] = { fname, file_entry.bytes,
+                             (time_t)file_entry.last_access,
+                             file_entry.play_count };
+        }
+
+    hits = header.hits;
+    misses = header.misses;
+    evictions = header.evictions;
+
+    status = 0;
+
+exit:
+    fclose (f);
+    return status;
+}
+
+void
+init (in_use_fn_t in_use_fn)
+{
+    const std::string music_folder_path = get_music_folder_path ();
+
+    std::lock_guard<std::mutex> lk (m);
+
+    get_in_use = in_use_fn;
+
+    std::map<std::string, entry_t> saved;
+    if (load_state (music_folder_path + state_file_name, saved) != 0)
+        saved.clear ();
+
+    entries.clear ();
+
+    // saved entries of tracks deleted by hand are dropped, tracks added by
+    // hand start as last accessed when they were modified
+    for (const track_catalog::track_t &track : track_catalog::get_tracks ())
+        {
+            const int64_t bytes = track.filesize + track.index_size;
+
+            auto i = saved.find (track.fname);
+            if (i != saved.end ())
+                {
+                    i->second.bytes = bytes;
+                    entries.insert (*i);
+                }
+            else
+                entries.insert (
+                    { track.fname, { track.fname, bytes, track.mtime, 0 } });
+        }
+
+    dirty = true;
+}
+
+bool
+lookup (const std::string &fname)
+{
+    const time_t now = time (NULL);
+
+    std::lock_guard<std::mutex> lk (m);
+
+    const bool hit = touch_entry (fname, now) != nullptr;
+
+    if (hit)
+        hits++;
+    else
+        misses++;
+
+    dirty = true;
+
+    return hit;
+}
+
+void
+add (const std::string &fname)
+{
+    const int64_t bytes = get_track_bytes (fname);
+    if (bytes < 0)
+        return;
+
+    const time_t now = time (NULL);
+
+    std::lock_guard<std::mutex> lk (m);
+
+    auto i = entries.find (fname);
+    if (i != entries.end ())
+        {
+            i->second.bytes = bytes;
+            i->second.last_access = now;
+        }
+    else
+        entries.insert ({ fname, { fname, bytes, now, 0 } });
+
+    dirty = true;
+}
+
+void
+record_play (const std::string &fname)
+{
+    const time_t now = time (NULL);
+
+    std::lock_guard<std::mutex> lk (m);
+
+    entry_t *entry = touch_entry (fname, now);
+    if (entry)
+        entry->play_count++;
+}
+
+// first to evict goes first
+static bool
+compare_eviction_order (const entry_t *a, const entry_t *b)
+{
+#ifdef MUSICAT_TRACK_CACHE_LFU
+    if (a->play_count != b->play_count)
+        return a->play_count < b->play_count;
+#endif
+
+    return a->last_access < b->last_access;
+}
+
+// sizes from catalog, returns total bytes
+static int64_t
+refresh_sizes ()
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    int64_t total_bytes = 0;
+    for (auto i = entries.begin (); i != entries.end ();)
+        {
+            const int64_t bytes = get_track_bytes (i->first);
+
+            if (bytes < 0)
+                {
+                    i = entries.erase (i);
+                    dirty = true;
+                    continue;
+                }
+
+            i->second.bytes = bytes;
+            total_bytes += bytes;
+            i++;
+        }
+
+    return total_bytes;
+}
+
+size_t
+enforce_quota ()
+{
+    const int64_t quota_bytes = get_quota_bytes ();
+    if (!quota_bytes)
+        return 0;
+
+    const std::string music_folder_path = get_music_folder_path ();
+
+    // sidecar grows once loudness is analyzed, tracks might be deleted by
+    // hand
+    if (refresh_sizes () <= quota_bytes)
+        return 0;
+
+    // not under m, collecting locks players
+    std::set<std::string> in_use;
+    if (get_in_use && !get_in_use (in_use))
+        {
+            if (get_debug_state ())
+                fprintf (stderr, "[track_cache::enforce_quota] Tracks in use "
+                                 "unavailable, skipping\n");
+
+            return 0;
+        }
+
+    std::lock_guard<std::mutex> lk (m);
+
+    int64_t total_bytes = 0;
+    for (const auto &i : entries)
+        total_bytes += i.second.bytes;
+
+    const time_t idle_before = time (NULL) - TRACK_CACHE_MIN_IDLE_S;
+
+    std::vector<const entry_t *> candidates;
+    candidates.reserve (entries.size ());
+
+    for (const auto &i : entries)
+        {
+            const entry_t &entry = i.second;
+
+            if (entry.last_access > idle_before
+                || in_use.find (entry.fname) != in_use.end ()
+                || download_manager::is_pending (entry.fname))
+                continue;
+
+            candidates.push_back (&entry);
+        }
+
+    std::sort (candidates.begin (), candidates.end (),
+               compare_eviction_order);
+
+    std::vector<std::string> evicted;
+
+    for (const entry_t *entry : candidates)
+        {
+            if (total_bytes <= quota_bytes)
+                break;
+
+            const std::string file_path = music_folder_path + entry->fname;
+
+            if (unlink (file_path.c_str ()) != 0 && errno != ENOENT)
+                {
+                    fprintf (stderr,
+                             "[track_cache::enforce_quota ERROR] Can't "
+                             "evict '%s': %s\n",
+                             file_path.c_str (), strerror (errno));
+                    continue;
+                }
+
+            unlink (track_index::get_index_path (file_path).c_str ());
+
+            // before its inotify event so it isn't found anymore right away
+            track_catalog::update (entry->fname);
+
+            total_bytes -= entry->bytes;
+            evicted.push_back (entry->fname);
+        }
+
+    for (const std::string &fname : evicted)
+        entries.erase (fname);
+
+    if (!evicted.empty ())
+        {
+            evictions += evicted.size ();
+            dirty = true;
+
+            fprintf (stderr,
+                     "[track_cache] Evicted %ld track(s), %ld/%ld bytes "
+                     "used\n",
+                     evicted.size (), total_bytes, quota_bytes);
+        }
+
+    if (total_bytes > quota_bytes)
+        fprintf (stderr,
+                 "[track_cache::enforce_quota WARN] Still over quota, "
+                 "%ld/%ld bytes used by tracks in use or recently "
+                 "accessed\n",
+                 total_bytes, quota_bytes);
+
+    return evicted.size ();
+}
+
+int
+save ()
+{
+    const std::string state_path = get_music_folder_path () + state_file_name;
+    const std::string temp_path = state_path + ".tmp";
+
+    std::lock_guard<std::mutex> lk (m);
+
+    if (!dirty)
+        return 0;
+
+    FILE *f = fopen (temp_path.c_str (), "wb");
+    if (!f)
+        return -1;
+
+    state_file_header_t header;
+    memcpy (header.magic, state_magic, sizeof (header.magic));
+    header.version = state_version;
+    header.reserved = 0;
+    header.entry_count = entries.size ();
+    header.hits = hits;
+    header.misses = misses;
+    header.evictions = evictions;
+
+    bool ok = fwrite (&header, sizeof (header), 1, f) == 1;
+
+    for (auto i = entries.begin (); ok && i != entries.end (); i++)
+        {
+            const entry_t &entry = i->second;
+
+            const state_file_entry_t file_entry
+                = { entry.bytes, (int64_t)entry.last_access,
+                    entry.play_count, (uint32_t)entry.fname.size () };
+
+            ok = fwrite (&file_entry, sizeof (file_entry), 1, f) == 1
+                 && fwrite (entry.fname.data (), 1, entry.fname.size (), f)
+                        == entry.fname.size ();
+        }
+
+    ok = (fclose (f) == 0) && ok;
+    f = NULL;
+
+    // rename to never leave half written state
+    if (!ok || rename (temp_path.c_str (), state_path.c_str ()) != 0)
+        {
+            unlink (temp_path.c_str ());
+            return -1;
+        }
+
+    dirty = false;
+
+    return 0;
+}
+
+stats_t
+get_stats ()
+{
+    stats_t stats = { 0, 0, 0, 0, get_quota_bytes (), 0 };
+
+    std::lock_guard<std::mutex> lk (m);
+
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.entry_count = entries.size ();
+
+    for (const auto &i : entries)
+        stats.total_bytes += i.second.bytes;
+
+    return stats;
+}
+
+std::vector<entry_t>
+get_entries ()
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    std::vector<entry_t> ret;
+    ret.reserve (entries.size ());
+
+    for (const auto &i : entries)
+        ret.push_back (i.second);
+
+    return ret;
+}
+
+void
+print_stats ()
+{
+    const stats_t stats = get_stats ();
+    const uint64_t lookups = stats.hits + stats.misses;
+
+    fprintf (stderr,
+             "[track_cache] %ld track(s), %ld/%ld bytes used (0 quota is "
+             "unlimited)\n",
+             stats.entry_count, stats.total_bytes, stats.quota_bytes);
+
+    fprintf (stderr,
+             "  hits %lu misses %lu hit rate %.1f%% evictions %lu\n",
+             stats.hits, stats.misses,
+             lookups ? (double)stats.hits * 100.0 / (double)lookups : 0.0,
+             stats.evictions);
+}
+
+} // track_cache
+} // musicat
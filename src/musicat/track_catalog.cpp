@@ -0,0 +1,495 @@
+#include "musicat/track_catalog.h"
+#include "musicat/musicat.h"
+#include "musicat/search_index.h"
+#include "musicat/track_index.h"
+#include <dirent.h>
+#include <errno.h>
+#include <filesystem>
+#include <mutex>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace musicat
+{
+namespace track_catalog
+{
+
+inline constexpr const char track_ext[] = ".opus";
+inline constexpr size_t track_ext_len = sizeof (track_ext) - 1;
+inline constexpr const char index_ext[] = ".idx";
+inline constexpr size_t index_ext_len = sizeof (index_ext) - 1;
+
+inline constexpr size_t video_id_len = 11;
+
+// track files are renamed into place, sidecars too. IN_CLOSE_WRITE covers
+// files copied in by hand
+inline constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO
+                                       | IN_MOVED_FROM | IN_DELETE
+                                       | IN_DELETE_SELF | IN_MOVE_SELF;
+
+static std::unordered_map<std::string, track_t> tracks;
+// video id to fname
+static std::unordered_map<std::string, std::string> ids;
+static std::mutex m; // tracks, ids, search_stale
+
+// names of tracks for autocomplete, rebuilt on the first search after the
+// catalog changed
+static search_index::index_t search_idx;
+static bool search_stale = true;
+static std::mutex search_m; // search_idx
+
+static int inotify_fd = -1;
+// wakes watcher to exit
+static int wake_fd = -1;
+// never destroyed, exiting without shutdown doesn't terminate
+static std::thread *watcher = nullptr;
+
+static bool
+ends_with (const std::string &s, const char *suffix, const size_t len)
+{
+    return s.size () > len && s.compare (s.size () - len, len, suffix) == 0;
+}
+
+static bool
+is_track_name (const std::string &name)
+{
+    return ends_with (name, track_ext, track_ext_len);
+}
+
+static void
+parse_name (track_t &track)
+{
+    const size_t base_len = track.fname.size () - track_ext_len;
+    const size_t sep = base_len - video_id_len - 1;
+
+    if (base_len > video_id_len && track.fname[sep] == '-')
+        {
+            track.id = track.fname.substr (sep + 1, video_id_len);
+            track.title = track.fname.substr (0, sep);
+        }
+    else
+        track.title = track.fname.substr (0, base_len);
+}
+
+/**
+ * @brief Stat track and its sidecar. Sidecar is only read when it changed
+ * from what old has
+ *
+ * @return int 0 on success, -1 when track doesn't exist
+ */
+static int
+load_track (const std::string &music_folder_path, const std::string &fname,
+            const track_t *old, track_t &track)
+{
+    const std::string file_path = music_folder_path + fname;
+
+    struct stat file_stat;
+    if (stat (file_path.c_str (), &file_stat) != 0
+        || !S_ISREG (file_stat.st_mode))
+        return -1;
+
+    track.fname = fname;
+    track.filesize = file_stat.st_size;
+    track.mtime = file_stat.st_mtime;
+    track.index_size = 0;
+    track.duration_ms = 0;
+    parse_name (track);
+
+    struct stat index_stat;
+    if (stat (track_index::get_index_path (file_path).c_str (), &index_stat)
+        != 0)
+        return 0;
+
+    track.index_size = index_stat.st_size;
+
+    if (old && old->filesize == track.filesize
+        && old->index_size == track.index_size)
+        {
+            track.duration_ms = old->duration_ms;
+            return 0;
+        }
+
+    track_index::track_index_t index;
+    if (track_index::read_index (file_path, index) == 0)
+        track.duration_ms = index.duration_ms;
+
+    return 0;
+}
+
+// caller must lock m
+static void
+erase_track (const std::string &fname)
+{
+    auto i = tracks.find (fname);
+    if (i == tracks.end ())
+        return;
+
+    if (!i->second.id.empty ())
+        {
+            auto id = ids.find (i->second.id);
+            if (id != ids.end () && id->second == fname)
+                ids.erase (id);
+        }
+
+    tracks.erase (i);
+    search_stale = true;
+}
+
+// caller must lock m
+static void
+insert_track (const track_t &track)
+{
+    erase_track (track.fname);
+
+    tracks[track.fname] = track;
+    search_stale = true;
+
+    if (!track.id.empty ())
+        ids[track.id] = track.fname;
+}
+
+// read the whole folder, on startup and when inotify events were dropped.
+// catalog is replaced at once so tracks never disappear while rescanning
+static void
+scan ()
+{
+    const std::string music_folder_path = get_music_folder_path ();
+
+    std::unordered_map<std::string, track_t> loaded;
+    std::unordered_map<std::string, std::string> loaded_ids;
+
+    DIR *dir = opendir (music_folder_path.c_str ());
+    if (!dir)
+        return;
+
+    struct dirent *file;
+    while ((file = readdir (dir)) != NULL)
+        {
+            if (file->d_type != DT_REG && file->d_type != DT_UNKNOWN)
+                continue;
+
+            const std::string fname = file->d_name;
+            if (!is_track_name (fname))
+                continue;
+
+            track_t old;
+            const bool has_old = get (fname, old);
+
+            track_t track;
+            if (load_track (music_folder_path, fname,
+                            has_old ? &old : nullptr, track)
+                != 0)
+                continue;
+
+            if (!track.id.empty ())
+                loaded_ids[track.id] = fname;
+
+            loaded[fname] = track;
+        }
+
+    closedir (dir);
+
+    const size_t count = loaded.size ();
+
+    {
+        std::lock_guard<std::mutex> lk (m);
+        tracks.swap (loaded);
+        ids.swap (loaded_ids);
+        search_stale = true;
+    }
+
+    fprintf (stderr, "[track_catalog] Loaded %ld track(s)\n", count);
+}
+
+void
+update (const std::string &fname)
+{
+    if (!is_track_name (fname))
+        return;
+
+    track_t old;
+    const bool has_old = get (fname, old);
+
+    track_t track;
+    const int status
+        = load_track (get_music_folder_path (), fname,
+                      has_old ? &old : nullptr, track);
+
+    std::lock_guard<std::mutex> lk (m);
+
+    if (status == 0)
+        insert_track (track);
+    else
+        erase_track (fname);
+}
+
+// returns false when folder is no longer watched
+static bool
+handle_event (const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+        {
+            fprintf (stderr, "[track_catalog::handle_event WARN] inotify "
+                             "queue overflowed, rescanning\n");
+            scan ();
+            return true;
+        }
+
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        {
+            fprintf (stderr, "[track_catalog::handle_event ERROR] Music "
+                             "folder is gone, catalog is no longer "
+                             "updated\n");
+            return false;
+        }
+
+    if (!event->len)
+        return true;
+
+    std::string fname = event->name;
+
+    // sidecar changes duration of its track
+    if (ends_with (fname, index_ext, index_ext_len))
+        fname.resize (fname.size () - index_ext_len);
+
+    update (fname);
+
+    return true;
+}
+
+static void
+run_watcher ()
+{
+    alignas (struct inotify_event) char buffer[8192];
+
+    struct pollfd pfds[2]
+        = { { inotify_fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+
+    while (true)
+        {
+            if (poll (pfds, 2, -1) == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    perror ("[track_catalog::run_watcher ERROR] poll");
+                    break;
+                }
+
+            if (pfds[1].revents)
+                break;
+
+            const ssize_t size = read (inotify_fd, buffer, sizeof (buffer));
+            if (size == -1)
+                {
+                    if (errno == EINTR || errno == EAGAIN)
+                        continue;
+
+                    perror ("[track_catalog::run_watcher ERROR] read");
+                    break;
+                }
+
+            bool watching = true;
+
+            for (ssize_t offset = 0; watching && offset < size;)
+                {
+                    const struct inotify_event *event
+                        = (const struct inotify_event *)(buffer + offset);
+
+                    watching = handle_event (event);
+
+                    offset += sizeof (struct inotify_event) + event->len;
+                }
+
+            if (!watching)
+                break;
+        }
+}
+
+int
+init ()
+{
+    const std::string music_folder_path = get_music_folder_path ();
+
+    if (music_folder_path.empty ())
+        {
+            fprintf (stderr, "[track_catalog::init ERROR] Music folder "
+                             "isn't configured\n");
+            return -1;
+        }
+
+    {
+        struct stat buf;
+        if (stat (music_folder_path.c_str (), &buf) != 0)
+            std::filesystem::create_directory (music_folder_path);
+    }
+
+    // watch first so nothing added while scanning is missed
+    inotify_fd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+    wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (inotify_fd == -1 || wake_fd == -1
+        || inotify_add_watch (inotify_fd, music_folder_path.c_str (),
+                              watch_mask)
+               == -1)
+        {
+            perror ("[track_catalog::init ERROR] Can't watch music folder");
+
+            close_valid_fd (&inotify_fd);
+            close_valid_fd (&wake_fd);
+
+            scan ();
+            return -1;
+        }
+
+    scan ();
+
+    watcher = new std::thread (run_watcher);
+
+    return 0;
+}
+
+void
+shutdown ()
+{
+    if (wake_fd != -1)
+        {
+            const uint64_t one = 1;
+            write (wake_fd, &one, sizeof (one));
+        }
+
+    if (watcher && watcher->joinable ())
+        watcher->join ();
+
+    close_valid_fd (&inotify_fd);
+    close_valid_fd (&wake_fd);
+}
+
+bool
+exists (const std::string &fname)
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    return tracks.find (fname) != tracks.end ();
+}
+
+bool
+get (const std::string &fname, track_t &track)
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    auto i = tracks.find (fname);
+    if (i == tracks.end ())
+        return false;
+
+    track = i->second;
+
+    return true;
+}
+
+bool
+find_by_id (const std::string &id, track_t &track)
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    auto i = ids.find (id);
+    if (i == ids.end ())
+        return false;
+
+    auto t = tracks.find (i->second);
+    if (t == tracks.end ())
+        return false;
+
+    track = t->second;
+
+    return true;
+}
+
+std::vector<track_t>
+get_tracks ()
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    std::vector<track_t> ret;
+    ret.reserve (tracks.size ());
+
+    for (const auto &i : tracks)
+        ret.push_back (i.second);
+
+    return ret;
+}
+
+std::vector<std::string>
+get_names (const size_t amount)
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    const size_t count
+        = amount && amount < tracks.size () ? amount : tracks.size ();
+
+    std::vector<std::string> ret;
+    ret.reserve (count);
+
+    for (const auto &i : tracks)
+        {
+            if (ret.size () == count)
+                break;
+
+            ret.push_back (
+                i.first.substr (0, i.first.size () - track_ext_len));
+        }
+
+    return ret;
+}
+
+std::vector<std::pair<std::string, std::string> >
+search (const std::string &query, const size_t limit)
+{
+    std::lock_guard<std::mutex> slk (search_m);
+
+    std::vector<std::pair<std::string, std::string> > names;
+    bool stale = false;
+
+    {
+        std::lock_guard<std::mutex> lk (m);
+
+        if (search_stale)
+            {
+                stale = true;
+                search_stale = false;
+
+                names.reserve (tracks.size ());
+
+                for (const auto &i : tracks)
+                    {
+                        const std::string name = i.first.substr (
+                            0, i.first.size () - track_ext_len);
+                        names.push_back (std::make_pair (name, name));
+                    }
+            }
+    }
+
+    // built outside m so the watcher isn't held up
+    if (stale)
+        search_index::build (search_idx, names);
+
+    return search_index::search (search_idx, query, limit, true);
+}
+
+size_t
+get_count ()
+{
+    std::lock_guard<std::mutex> lk (m);
+
+    return tracks.size ();
+}
+
+} // track_catalog
+} // musicat
@@ -0,0 +1,349 @@
+#include "musicat/track_index.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace musicat
+{
+namespace track_index
+{
+
+inline constexpr const char index_magic[8] = { 'M', 'C', 'T', 'I',
+                                               'D', 'X', '\0', '\0' };
+inline constexpr uint32_t index_version = 2;
+
+inline constexpr const char ogg_capture_pattern[] = "OggS";
+inline constexpr const char opus_head_magic[] = "OpusHead";
+inline constexpr size_t ogg_page_header_size = 27;
+
+// sidecar file header, native endian as it never leaves the machine
+struct index_file_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t interval_ms;
+    int64_t duration_ms;
+    int64_t filesize;
+    int64_t pre_skip;
+    uint64_t entry_count;
+    uint32_t has_loudness;
+    uint32_t reserved;
+    double integrated_lufs;
+    double true_peak_dbtp;
+};
+
+static int64_t
+read_le64 (const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+
+    return (int64_t)v;
+}
+
+std::string
+get_index_path (const std::string &file_path)
+{
+    return file_path + ".idx";
+}
+
+int
+build_index (const std::string &file_path, track_index_t &index,
+             const uint32_t interval_ms)
+{
+    FILE *f = fopen (file_path.c_str (), "rb");
+    if (!f)
+        return -1;
+
+    struct stat file_stat;
+    if (fstat (fileno (f), &file_stat) != 0)
+        {
+            fclose (f);
+            return -1;
+        }
+
+    index.duration_ms = 0;
+    index.filesize = 0;
+    index.pre_skip = 0;
+    index.interval_ms = interval_ms ? interval_ms : TRACK_INDEX_INTERVAL_MS;
+    index.entries.clear ();
+    index.has_loudness = false;
+    index.integrated_lufs = 0.0;
+    index.true_peak_dbtp = 0.0;
+
+    uint8_t header[ogg_page_header_size];
+    uint8_t segments[255];
+    std::vector<uint8_t> body;
+
+    int64_t offset = 0;
+    int64_t last_granulepos = 0;
+    int64_t next_mark_ms = 0;
+    bool head_found = false;
+    int status = 0;
+
+    while (fread (header, 1, ogg_page_header_size, f)
+           == ogg_page_header_size)
+        {
+            if (memcmp (header, ogg_capture_pattern, 4) != 0)
+                {
+                    // corrupted or not an ogg file
+                    status = -1;
+                    break;
+                }
+
+            const int64_t granulepos = read_le64 (header + 6);
+            const size_t segment_count = header[26];
+
+            if (fread (segments, 1, segment_count, f) != segment_count)
+                break;
+
+            size_t body_size = 0;
+            for (size_t i = 0; i < segment_count; i++)
+                body_size += segments[i];
+
+            if (!head_found)
+                {
+                    // first page only contains OpusHead
+                    body.resize (body_size);
+                    if (fread (body.data (), 1, body_size, f) != body_size)
+                        break;
+
+                    if (body_size < 12
+                        || memcmp (body.data (), opus_head_magic, 8) != 0)
+                        {
+                            status = -1;
+                            break;
+                        }
+
+                    index.pre_skip = body[10] | (body[11] << 8);
+                    head_found = true;
+                }
+            else if (fseek (f, body_size, SEEK_CUR) != 0)
+                break;
+
+            // header pages have zero granule, -1 means no packet ends here
+            if (granulepos > 0)
+                {
+                    const int64_t end_ms
+                        = granulepos_to_ms (index, granulepos);
+
+                    // every mark reached in this page
+                    while (end_ms >= next_mark_ms)
+                        {
+                            index.entries.push_back (
+                                { last_granulepos, offset });
+
+                            next_mark_ms += index.interval_ms;
+                        }
+
+                    last_granulepos = granulepos;
+                }
+
+            offset += ogg_page_header_size + segment_count + body_size;
+        }
+
+    fclose (f);
+    f = NULL;
+
+    if (status != 0 || !head_found)
+        return -1;
+
+    index.duration_ms = granulepos_to_ms (index, last_granulepos);
+    // not offset as trailing garbage would make the index always stale
+    index.filesize = file_stat.st_size;
+
+    return 0;
+}
+
+int
+write_index (const std::string &file_path, const track_index_t &index)
+{
+    const std::string index_path = get_index_path (file_path);
+    const std::string temp_path = index_path + ".tmp";
+
+    FILE *f = fopen (temp_path.c_str (), "wb");
+    if (!f)
+        return -1;
+
+    index_file_header_t header;
+    memcpy (header.magic, index_magic, sizeof (header.magic));
+    header.version = index_version;
+    header.interval_ms = index.interval_ms;
+    header.duration_ms = index.duration_ms;
+    header.filesize = index.filesize;
+    header.pre_skip = index.pre_skip;
+    header.entry_count = index.entries.size ();
+    header.has_loudness = index.has_loudness;
+    header.reserved = 0;
+    header.integrated_lufs = index.integrated_lufs;
+    header.true_peak_dbtp = index.true_peak_dbtp;
+
+    bool ok = fwrite (&header, sizeof (header), 1, f) == 1;
+
+    if (ok && !index.entries.empty ())
+        ok = fwrite (index.entries.data (), sizeof (index_entry_t),
+                     index.entries.size (), f)
+             == index.entries.size ();
+
+    ok = (fclose (f) == 0) && ok;
+    f = NULL;
+
+    // rename to not leave half written index for readers
+    if (!ok || rename (temp_path.c_str (), index_path.c_str ()) != 0)
+        {
+            unlink (temp_path.c_str ());
+            return -1;
+        }
+
+    return 0;
+}
+
+int
+read_index (const std::string &file_path, track_index_t &index)
+{
+    struct stat file_stat;
+    if (stat (file_path.c_str (), &file_stat) != 0)
+        return -1;
+
+    FILE *f = fopen (get_index_path (file_path).c_str (), "rb");
+    if (!f)
+        return -1;
+
+    index_file_header_t header;
+    int status = -1;
+
+    if (fread (&header, sizeof (header), 1, f) != 1
+        || memcmp (header.magic, index_magic, sizeof (header.magic)) != 0
+        || header.version != index_version
+        || header.filesize != (int64_t)file_stat.st_size
+        || !header.interval_ms)
+        goto exit;
+
+    index.duration_ms = header.duration_ms;
+    index.filesize = header.filesize;
+    index.pre_skip = header.pre_skip;
+    index.interval_ms = header.interval_ms;
+    index.has_loudness = header.has_loudness != 0;
+    index.integrated_lufs = header.integrated_lufs;
+    index.true_peak_dbtp = header.true_peak_dbtp;
+
+    // sanity check against corrupted count, an entry per page at most
+    if (header.entry_count
+        > (uint64_t)header.filesize / ogg_page_header_size)
+        goto exit;
+
+    index.entries.resize (header.entry_count);
+
+    if (header.entry_count
+        && fread (index.entries.data (), sizeof (index_entry_t),
+                  header.entry_count, f)
+               != header.entry_count)
+        {
+            index.entries.clear ();
+            goto exit;
+        }
+
+    status = 0;
+
+exit:
+    fclose (f);
+    return status;
+}
+
+int
+load_index (const std::string &file_path, track_index_t &index)
+{
+    if (read_index (file_path, index) == 0)
+        return 0;
+
+    if (build_index (file_path, index) != 0)
+        return -1;
+
+    // not fatal, can always be built again
+    if (write_index (file_path, index) != 0)
+        fprintf (stderr,
+                 "[track_index::load_index ERROR] Failed writing index: "
+                 "'%s'\n",
+                 get_index_path (file_path).c_str ());
+
+    return 0;
+}
+
+const index_entry_t *
+find_entry_by_ms (const track_index_t &index, int64_t ms)
+{
+    if (index.entries.empty ())
+        return nullptr;
+
+    const int64_t granulepos = (ms * 48) + index.pre_skip;
+
+    auto i = std::upper_bound (
+        index.entries.begin (), index.entries.end (), granulepos,
+        [] (const int64_t &g, const index_entry_t &e) {
+            return g < e.granulepos;
+        });
+
+    if (i != index.entries.begin ())
+        i--;
+
+    return &(*i);
+}
+
+int64_t
+ms_to_byte (const track_index_t &index, int64_t ms)
+{
+    const index_entry_t *entry = find_entry_by_ms (index, ms);
+
+    return entry ? entry->byte_offset : 0;
+}
+
+int64_t
+byte_to_ms (const track_index_t &index, int64_t byte)
+{
+    if (index.entries.empty ())
+        return 0;
+
+    auto i = std::upper_bound (
+        index.entries.begin (), index.entries.end (), byte,
+        [] (const int64_t &b, const index_entry_t &e) {
+            return b < e.byte_offset;
+        });
+
+    if (i == index.entries.begin ())
+        return 0;
+
+    const index_entry_t &prev = *(i - 1);
+    const int64_t prev_ms = granulepos_to_ms (index, prev.granulepos);
+
+    int64_t next_ms = index.duration_ms, next_byte = index.filesize;
+    if (i != index.entries.end ())
+        {
+            next_ms = granulepos_to_ms (index, i->granulepos);
+            next_byte = i->byte_offset;
+        }
+
+    if (next_byte <= prev.byte_offset)
+        return prev_ms;
+
+    // linear between two entries, which is at most interval_ms apart
+    const int64_t ms
+        = prev_ms
+          + ((byte - prev.byte_offset) * (next_ms - prev_ms)
+             / (next_byte - prev.byte_offset));
+
+    return ms > index.duration_ms ? index.duration_ms : ms;
+}
+
+int64_t
+granulepos_to_ms (const track_index_t &index, int64_t granulepos)
+{
+    const int64_t ms = (granulepos - index.pre_skip) / 48;
+
+    return ms < 0 ? 0 : ms;
+}
+
+} // track_index
+} // musicat